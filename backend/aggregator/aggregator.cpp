@@ -16,6 +16,12 @@
 #include "output.hpp"
 #include "configuration.hpp"
 #include "aggregator.hpp"
+#include "../timer_service.hpp"
+#include "../checkpoint.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <math.h>
 
 //#define DEBUG
 #ifdef DEBUG
@@ -24,8 +30,6 @@
 #define DBG(x)
 #endif
 
-/** Value (2^21) for default hash map space reservation before rehash needed.*/
-#define MAP_RESERVE 2097152
 #define MAX_ARGS 128
 #define MAX_STRING 1024
 
@@ -33,7 +37,11 @@
  * Statically defined fields COUNT, TIME_FIRST, TIME_LAST always used by module
  */
 
-int Agg::stop = 0;
+thread_local int Agg::worker = -1;
+std::atomic<size_t> Agg::all_used_bytes(0);
+size_t Agg::all_quota_bytes = 0;
+std::vector<Agg*> Agg::instances;
+std::mutex Agg::instances_mutex;
 
 
 /* ================================================================= */
@@ -75,39 +83,45 @@ void print_template_fields(ur_template_t* tmplt)
  */
 void Agg::clean_memory(){
    std::unordered_map<Key, void*>::iterator it;
-   for ( it = storage.begin(); it != storage.end(); it++) {
-      ur_free_record(it->second);
+   for (auto &shard : storage) {
+      for ( it = shard.map.begin(); it != shard.map.end(); it++) {
+         ur_free_record(it->second);
+      }
+      size_t stored = shard.map.size();
+      std::unordered_map<Key, void*>().swap(shard.map);
+      count_groups(shard, -(long) stored);
    }
-   storage.clear();
 
    if (outputTemp.out_tmplt){
       ur_free_template(outputTemp.out_tmplt);
       outputTemp.out_tmplt = NULL;
    }
-   ur_finalize();
 }
 
 void Agg::clean_memory_with_ptrs(){
    std::unordered_map<Key, void*>::iterator it;
-   if (outputTemp.used_fields_like_ptrs > 0) {
-      for ( it = storage.begin(); it != storage.end(); it++) {
-         for (int i = 0; i < outputTemp.used_fields_like_ptrs; i++){
-            outputTemp.dealloc_ptr_fields[i]((void*)(*((uint64_t*) ur_get_ptr_by_id(outputTemp.out_tmplt, it->second, outputTemp.fields_like_ptr[i]))));
+   for (auto &shard : storage) {
+      if (outputTemp.used_fields_like_ptrs > 0) {
+         for ( it = shard.map.begin(); it != shard.map.end(); it++) {
+            for (int i = 0; i < outputTemp.used_fields_like_ptrs; i++){
+               outputTemp.dealloc_ptr_fields[i]((void*)(*((uint64_t*) ur_get_ptr_by_id(outputTemp.out_tmplt, it->second, outputTemp.fields_like_ptr[i]))));
+            }
          }
       }
-   }
-   else{
-      for ( it = storage.begin(); it != storage.end(); it++) {
-         ur_free_record(it->second);
+      else{
+         for ( it = shard.map.begin(); it != shard.map.end(); it++) {
+            ur_free_record(it->second);
+         }
       }
+      size_t stored = shard.map.size();
+      std::unordered_map<Key, void*>().swap(shard.map);
+      count_groups(shard, -(long) stored);
    }
-   storage.clear();
 
    if (outputTemp.out_tmplt){
       ur_free_template(outputTemp.out_tmplt);
       outputTemp.out_tmplt = NULL;
    }
-   ur_finalize();
 }
 
 /* ----------------------------------------------------------------- */
@@ -133,6 +147,17 @@ void * create_record(ur_template_t *tmplt, int length)
  */
 void Agg::process_agg_functions(ur_template_t const* in_tmplt, void const* src_rec, void* dst_rec)
 {
+   if (use_update_plan) {
+      // Offsets in plan depend on input template
+      if (!update_plan.is_built_for(in_tmplt))
+         update_plan.build(outputTemp, in_tmplt);
+      if (update_plan.is_ready()) {
+         update_plan.apply(src_rec, dst_rec);
+         process_ptr_functions(in_tmplt, src_rec, dst_rec);
+         return;
+      }
+   }
+
    // Always increase count when processing functions
    ur_set(outputTemp.out_tmplt, dst_rec, F_COUNT, ur_get(outputTemp.out_tmplt, dst_rec, F_COUNT) + 1);
 
@@ -164,6 +189,20 @@ void Agg::process_agg_functions(ur_template_t const* in_tmplt, void const* src_r
       }
    }
 
+   process_ptr_functions(in_tmplt, src_rec, dst_rec);
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Update pointer fields (count distinct) of stored record with received record.
+ * @param [in] in_tmplt UniRec template of received record.
+ * @param [in] src_rec pointer to received record.
+ * @param [in, out] dst_rec pointer to stored/updated record.
+ */
+void Agg::process_ptr_functions(ur_template_t const* in_tmplt, void const* src_rec, void* dst_rec)
+{
+   void *ptr_dst;
+   void *ptr_src;
    // Process all ptr registered fields with their agg function
    for (int i = 0; i < outputTemp.used_fields_like_ptrs; i++) {
       ptr_dst = ur_get_ptr_by_id(outputTemp.out_tmplt, dst_rec, outputTemp.fields_like_ptr[i]);
@@ -193,8 +232,13 @@ void Agg::init_ptr_field(ur_template_t const* in_tmplt, void const* src_rec, voi
 void Agg::init_record_data(ur_template_t const* in_tmplt, void const* src_rec, void* dst_rec)
 {
    ur_clear_varlen(outputTemp.out_tmplt, dst_rec);
-   // Copy all fields which are part of output template
-   ur_copy_fields(outputTemp.out_tmplt, dst_rec, in_tmplt, src_rec);
+   // Copy all fields which are part of output template, plan is rebuilt only when one thread aggregates
+   if (use_update_plan && !copy_plan.is_built_for(in_tmplt))
+      copy_plan.build(outputTemp, in_tmplt);
+   if (use_update_plan && copy_plan.is_ready())
+      copy_plan.apply(src_rec, dst_rec);
+   else
+      ur_copy_fields(outputTemp.out_tmplt, dst_rec, in_tmplt, src_rec);
    // Set initial value of module field(s)
    ur_set(outputTemp.out_tmplt, dst_rec, F_COUNT, 1);
 
@@ -239,15 +283,41 @@ void Agg::prepare_to_send(void *stored_rec)
    }
 
 }
+/* ----------------------------------------------------------------- */
+/**
+ * Release data of stored record which is not sent, same as prepare_to_send does for sent one.
+ * Record itself stays allocated.
+ * @param [in,out] stored_rec pointer to stored record.
+ */
+void Agg::drop_record(void *stored_rec)
+{
+   for (int i = 0; i < outputTemp.used_fields_like_ptrs; i++) {
+      outputTemp.dealloc_ptr_fields[i]((void*)(*((uint64_t*)ur_get_ptr_by_id(outputTemp.out_tmplt, stored_rec, outputTemp.fields_like_ptr[i]))));
+   }
+}
+
 /* ----------------------------------------------------------------- */
 /**
  * Makes all necessary steps before record can be send to output interface.
+ * Record which does not pass group filter is dropped before it is finished.
  * @param [in] out_tmplt UniRec template of stored/output record.
  * @param [in] out_rec pointer to record which is going to be send
- * @return True if record successfully sent, false if record was not send.
+ * @return True if record successfully sent or dropped by group filter, false if record was not send.
  */
 bool Agg::send_record_out(void *out_rec)
 {
+   if (group_filter != NULL) {
+      groups_checked++;
+      if (!group_filter->match(out_rec, outputTemp.out_tmplt, &group_view)) {
+         groups_dropped++;
+         drop_record(out_rec);
+         return true;
+      }
+      // Sum lowered by the error could be at threshold, group may pass only because of collisions
+      if (use_admission && admission_field_value(out_rec) <= admission_bound + admission_error) {
+         uncertain_groups++;
+      }
+   }
 
    DBG((stderr, "Count of message to send is: %d\n", ur_get(outputTemp.out_tmplt, out_rec, F_COUNT)));
 
@@ -256,7 +326,16 @@ bool Agg::send_record_out(void *out_rec)
    }
 
    //Warning - for threading -> copy
-   send(out_rec, outputTemp.out_tmplt);
+   // Timer thread and eval can send from different shards at once
+   // Group filter already matched the record, it is passed behind it
+   if (use_locks)
+      send_mutex.lock();
+   if (group_filter != NULL)
+      group_filter->forward(out_rec, outputTemp.out_tmplt);
+   else
+      send(out_rec, outputTemp.out_tmplt);
+   if (use_locks)
+      send_mutex.unlock();
    return true;
 
    //fprintf(stderr, "Cannot send record due to error or time_out\n");
@@ -266,226 +345,1323 @@ bool Agg::send_record_out(void *out_rec)
 /* ----------------------------------------------------------------- */
 /**
  * Tries to send out all stored records, free their memory and clear the storage.
+ * Shards are locked one by one, so eval is blocked only on the shard being flushed.
  */
 void Agg::flush_storage()
 {
+   if (use_columns) {
+      flush_columns();
+      return;
+   }
+   if (use_spill) {
+      merge_spilled();
+   }
+   if (use_admission) {
+      update_admission_error();
+   }
    // Send all stored data
   
    std::unordered_map<Key, void*>::iterator it;
-   for ( it = storage.begin(); it != storage.end(); it++) {
-      send_record_out(it->second);
-      ur_free_record(it->second);
+   for (auto &shard : storage) {
+      // Lock the shard -- CRITICAL SECTION START
+      lock_shard(shard);
+      for ( it = shard.map.begin(); it != shard.map.end(); it++) {
+         send_record_out(it->second);
+         ur_free_record(it->second);
+      }
+      // Buckets for cardinality of the ending window, bucket array of a larger peak is released
+      size_t observed = shard.map.size();
+      std::unordered_map<Key, void*>(observed).swap(shard.map);
+      count_groups(shard, -(long) observed);
+      // Unlock the shard -- CRITICAL SECTION END
+      unlock_shard(shard);
+   }
+   if (use_admission) {
+      clear_sketch();
    }
-   storage.clear();
 }
 
 /* ----------------------------------------------------------------- */
 /**
- * Passive and global timeout control function.
- * Specially designed to run with another thread.
- * @param [in] input pointer to structure which pass all needed parameters to run by another thread.
- * @return nothing valuable, always NULL.
+ * Prepare columnar storage and batch used to send its groups.
+ * @return 0 on success, -1 if configuration cannot be stored in columns.
  */
-void Agg::check_timeouts()
+int Agg::init_columns()
 {
-   int timeout_type = config.get_timeout_type();
+   if (config.get_timeout_type() != TIMEOUT_GLOBAL || !combiners.empty() ||
+       column_state.init(outputTemp, keyTemp) != 0) {
+      return -1;
+   }
 
-   if (timeout_type == TIMEOUT_GLOBAL) {
-      int timeout = config.get_timeout(TIMEOUT_GLOBAL);
-      while (!Agg::stop) {
-         time_t start = time(NULL);
-
-         // Lock the storage -- CRITICAL SECTION START
-         storage_mutex.lock();
-         flush_storage();
-         // Unlock the storage -- CRITICAL SECTION END
-         storage_mutex.unlock();
-         time_t end = time(NULL);
-
-         int elapsed = difftime(end, start);
-         int sec_to_sleep = (timeout - elapsed);
-         if (sec_to_sleep > 0){
-            sleep(sec_to_sleep);
-         }
+   char *tmplt_def = config.return_template_def();
+   int ret = column_batch.init(tmplt_def, BATCH_MAX_SIZE, true);
+   delete [] tmplt_def;
+   if (ret != 0) {
+      return -1;
+   }
+   column_rec = create_record(outputTemp.out_tmplt, 0);
+   if (column_rec == NULL) {
+      return -1;
+   }
+   column_sel.resize(BATCH_MAX_SIZE);
+   for (size_t i = 0; i < column_sel.size(); i++) {
+      column_sel[i] = i;
+   }
+   return 0;
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Aggregate received record into columnar storage.
+ * @param [in] key key of received record.
+ * @param [in] in_tmplt UniRec template of received record.
+ * @param [in] in_rec pointer to received record.
+ */
+void Agg::aggregate_to_columns(Key const& key, ur_template_t const* in_tmplt, void const* in_rec)
+{
+   bool created;
+
+   if (use_locks)
+      column_mutex.lock();
+   uint32_t slot = column_state.find_or_insert(key, in_tmplt, in_rec, created);
+   if (!created)
+      column_state.update(slot, in_tmplt, in_rec);
+   if (use_locks)
+      column_mutex.unlock();
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Send all groups of columnar storage and clear it.
+ * Average and rate are finished over whole columns, then groups are written to records
+ * of one batch and passed to successors by eval_batch, so group filter can use its kernels.
+ */
+void Agg::flush_columns()
+{
+   if (use_locks)
+      column_mutex.lock();
+   column_state.finish();
+
+   size_t n = column_state.size();
+   uint16_t rec_size = ur_rec_fixlen_size(outputTemp.out_tmplt);
+   column_batch.reset(outputTemp.out_tmplt);
+   for (size_t slot = 0; slot < n; slot++) {
+      column_state.materialize(slot, column_rec);
+      if (column_batch.add(column_rec, rec_size) || slot + 1 == n) {
+         column_batch.seal();
+         if (use_locks)
+            send_mutex.lock();
+         send_batch(column_batch, column_sel.data(), column_batch.size());
+         if (use_locks)
+            send_mutex.unlock();
+         column_batch.reset(outputTemp.out_tmplt);
       }
-      return;
    }
+   column_state.clear();
+   if (use_locks)
+      column_mutex.unlock();
+}
 
-   if ((timeout_type == TIMEOUT_PASSIVE) || (timeout_type == TIMEOUT_ACTIVE_PASSIVE)) {
-      int timeout = config.get_timeout(TIMEOUT_PASSIVE);
+/* ----------------------------------------------------------------- */
+/**
+ * Update estimated memory of stored groups and of bucket array of the shard, which grows on insert.
+ * @param [in] shard locked shard whose map was changed.
+ * @param [in] n number of added groups, negative for removed ones.
+ */
+void Agg::count_groups(Storage_shard &shard, long n)
+{
+   size_t bucket_bytes = shard.map.bucket_count() * sizeof(void*);
+   size_t added = 0;
+   size_t removed = 0;
+
+   if (n >= 0)
+      added += n * group_bytes;
+   else
+      removed += -n * group_bytes;
+   if (bucket_bytes >= shard.bucket_bytes)
+      added += bucket_bytes - shard.bucket_bytes;
+   else
+      removed += shard.bucket_bytes - bucket_bytes;
+   shard.bucket_bytes = bucket_bytes;
+
+   used_bytes += added;
+   all_used_bytes += added;
+   used_bytes -= removed;
+   all_used_bytes -= removed;
+}
 
-      time_last_from_record_mutex.lock();
-      time_last_from_record += timeout;
-      time_last_from_record_mutex.unlock();
+/* ----------------------------------------------------------------- */
+/**
+ * @return True if memory limit of this aggregator or of all aggregators is exceeded.
+ */
+bool Agg::over_quota() const
+{
+   return (quota_bytes > 0 && used_bytes > quota_bytes) ||
+          (all_quota_bytes > 0 && all_used_bytes > all_quota_bytes);
+}
 
-      while (!Agg::stop) {
-         time_t start = time(NULL);
+/* ----------------------------------------------------------------- */
+/**
+ * Evict groups of locked shard until memory limits are kept.
+ * Victim is the best group by eviction policy among groups of few randomly chosen buckets,
+ * so eviction does not scan whole storage. Victim is spilled to run file when spilling is set,
+ * otherwise oldest and LRU policies send it out early and smallest policy drops it. Only the locked shard is searched, so limit of all aggregators
+ * can be exceeded temporarily when the shard has no other group.
+ * @param [in] shard locked shard where new group was inserted.
+ * @param [in] keep key of new group, never evicted.
+ */
+void Agg::make_room(Storage_shard &shard, Key const &keep)
+{
+   static thread_local uint32_t cursor = 0;
+   int policy = config.get_evict_policy();
 
-         /* Can happen that record accesed for timeout check is being processed by main thread, need to use lock
-          * Only accessing and modifying different elements is thread safe in stl map container */
-         // Lock the storage -- CRITICAL SECTION START
-         storage_mutex.lock();
+   if (use_admission && over_quota()) {
+      update_admission_error();
+   }
 
-         for (std::unordered_map<Key, void*>::iterator it = storage.begin(); it != storage.end(); ) {
-            if (ur_time_get_sec(ur_get(outputTemp.out_tmplt, it->second, F_TIME_LAST)) < time_last_from_record - timeout) {
-               // Send record out
-               send_record_out(it->second);
-               ur_free_record(it->second);
-               it = storage.erase(it);
-            }
-            else {
-               ++it;
-            }
+   while (over_quota() && shard.map.size() > 1) {
+      Key const *victim = NULL;
+      uint64_t victim_score = 0;
+      size_t buckets = shard.map.bucket_count();
+
+      auto consider = [&](Key const &key, void *rec) {
+         if (key == keep)
+            return;
+         uint64_t score;
+         if (policy == EVICT_LRU)
+            score = ur_get(outputTemp.out_tmplt, rec, F_TIME_LAST);
+         else if (policy == EVICT_SMALLEST)
+            score = ur_get(outputTemp.out_tmplt, rec, F_COUNT);
+         else
+            score = ur_get(outputTemp.out_tmplt, rec, F_TIME_FIRST);
+         if (victim == NULL || score < victim_score) {
+            victim = &key;
+            victim_score = score;
          }
-         // Unlock the storage -- CRITICAL SECTION END
-         storage_mutex.unlock();
+      };
 
-         time_t end = time(NULL);
-         int elapsed = difftime(end, start);
-         int sec_to_sleep = (timeout - elapsed);
+      for (int i = 0; i < EVICT_SAMPLES; i++) {
+         cursor = cursor * 1664525U + 1013904223U;
+         size_t bucket = cursor % buckets;
+         for (auto it = shard.map.begin(bucket); it != shard.map.end(bucket); ++it) {
+            consider(it->first, it->second);
+         }
+      }
+      // Sparse table, take the first groups
+      for (auto it = shard.map.begin(); victim == NULL && it != shard.map.end(); ++it) {
+         consider(it->first, it->second);
+      }
+      if (victim == NULL) {
+         break;
+      }
+
+      std::unordered_map<Key, void*>::iterator it = shard.map.find(*victim);
+      if (use_spill && spill_group(it->first, it->second) == 0) {
+         // Group continues on disk, it is merged back when window closes
+      }
+      else if (policy == EVICT_SMALLEST) {
+         drop_record(it->second);
+      }
+      else {
+         send_record_out(it->second);
+      }
+      ur_free_record(it->second);
+      shard.map.erase(it);
+      count_groups(shard, -1);
+      evicted_groups++;
+   }
+}
 
-         time_last_from_record_mutex.lock();
-         // Update the last record time with elapsed time interval
-         time_last_from_record += (elapsed + sec_to_sleep);
-         time_last_from_record_mutex.unlock();
+/* ----------------------------------------------------------------- */
+/**
+ * Set up admission of keys through sketch. Group filter must require summed unsigned field
+ * (or COUNT) to be greater than some threshold, keys are stored when their estimated sum
+ * reaches configured fraction of it. Only global window without pre-aggregation and columns.
+ */
+void Agg::init_admission()
+{
+   uint64_t bound = 0;
 
-         // Assume regularly timeout period
-         if (sec_to_sleep > 0) {
-            sleep(sec_to_sleep);
-         }
+   if (group_filter == NULL || config.get_timeout_type() != TIMEOUT_GLOBAL || !combiners.empty() || use_columns) {
+      fprintf(stderr, "Warning: admission needs group filter, global timeout and record storage, all keys are stored.\n");
+      return;
+   }
+   // Other fields of admitted group miss records before admission
+   if (config.is_other_aggregates_read()) {
+      fprintf(stderr, "Warning: admission needs successors which read only key fields and one COUNT or sum, "
+              "all keys are stored.\n");
+      return;
+   }
 
+   if (group_filter->get_lower_bound(F_COUNT, bound)) {
+      admission_field = F_COUNT;
+      admission_type = Update_plan::TYPE_U32;
+   }
+   for (int i = 0; admission_field < 0 && i < outputTemp.used_fields; i++) {
+      Update_plan::Step step;
+      Update_plan::classify(outputTemp.process[i], step);
+      bool is_sum = step.func == Update_plan::STEP_SUM && outputTemp.avg_fields[i] == NULL &&
+                    outputTemp.rate_fields[i] == NULL;
+      bool is_unsigned = step.type == Update_plan::TYPE_U8 || step.type == Update_plan::TYPE_U16 ||
+                         step.type == Update_plan::TYPE_U32 || step.type == Update_plan::TYPE_U64;
+
+      if (is_sum && is_unsigned && group_filter->get_lower_bound(outputTemp.indexes_to_record[i], bound)) {
+         admission_field = outputTemp.indexes_to_record[i];
+         admission_type = step.type;
       }
+   }
+   if (admission_field < 0) {
+      fprintf(stderr, "Warning: group filter does not compare sum or COUNT with threshold, all keys are stored.\n");
       return;
    }
 
-   // Timeout is ACTIVE only, no thread checks needed, close the thread.
-   return;
+   // Group passes when sum is at least bound + 1
+   admission_bound = bound;
+   admission_level = (uint64_t) ceil(config.get_admission_fraction() * (bound + 1));
+   if (admission_level == 0)
+      admission_level = 1;
+   sketch.init(config.get_sketch_width());
+   use_admission = true;
 }
-/* ----------------------------------------------------------------- */
 
+/* ----------------------------------------------------------------- */
+/**
+ * @param [in] in_tmplt UniRec template of received record.
+ * @param [in] in_rec pointer to received record.
+ * @return value which received record adds to sum of admission field.
+ */
+uint64_t Agg::admission_value(ur_template_t const* in_tmplt, void const* in_rec) const
+{
+   if (admission_field == F_COUNT)
+      return 1;
+   void const *ptr = ur_get_ptr_by_id(in_tmplt, in_rec, admission_field);
+   switch (admission_type) {
+   case Update_plan::TYPE_U8:
+      return *(uint8_t const*) ptr;
+   case Update_plan::TYPE_U16:
+      return *(uint16_t const*) ptr;
+   case Update_plan::TYPE_U32:
+      return *(uint32_t const*) ptr;
+   default:
+      return *(uint64_t const*) ptr;
+   }
+}
 
-void get_argc_argv(char* const input, int& argc, char*(&argv)[MAX_ARGS]){
-    argc = 0;
-    char *p2 = strtok(input, " ");
-    while (p2 && argc < MAX_ARGS-1)
-    {
-        argv[argc++] = p2;
-        p2 = strtok(0, " ");
-    }
-    argv[argc] = 0;
+/* ----------------------------------------------------------------- */
+/**
+ * Add estimated sum of records counted before admission to stored record.
+ * @param [in,out] stored_rec new stored record.
+ * @param [in] value estimated sum before received record.
+ */
+void Agg::add_to_admission_field(void *stored_rec, uint64_t value)
+{
+   if (admission_field == F_COUNT) {
+      ur_set(outputTemp.out_tmplt, stored_rec, F_COUNT, ur_get(outputTemp.out_tmplt, stored_rec, F_COUNT) + value);
+      return;
+   }
+   void *ptr = ur_get_ptr_by_id(outputTemp.out_tmplt, stored_rec, admission_field);
+   switch (admission_type) {
+   case Update_plan::TYPE_U8:
+      *(uint8_t*) ptr += value;
+      break;
+   case Update_plan::TYPE_U16:
+      *(uint16_t*) ptr += value;
+      break;
+   case Update_plan::TYPE_U32:
+      *(uint32_t*) ptr += value;
+      break;
+   default:
+      *(uint64_t*) ptr += value;
+      break;
+   }
 }
 
+/* ----------------------------------------------------------------- */
+/**
+ * @param [in] stored_rec stored record.
+ * @return value of admission field of stored record.
+ */
+uint64_t Agg::admission_field_value(void const *stored_rec) const
+{
+   if (admission_field == F_COUNT)
+      return ur_get(outputTemp.out_tmplt, stored_rec, F_COUNT);
+   return admission_value(outputTemp.out_tmplt, stored_rec);
+}
 
-int Agg::init(char const* options, const std::vector<Stage_intf*> succ)
+/* ----------------------------------------------------------------- */
+/**
+ * Take current error bound of sketch for groups which are going to be sent.
+ * Called once per flush, so sent groups do not lock the sketch.
+ */
+void Agg::update_admission_error()
 {
-   int argc;
-   char* argv[MAX_ARGS];
-   char text[MAX_STRING];
-   strcpy(text, options);
-   get_argc_argv(text, argc, argv);
+   if (use_locks)
+      sketch_mutex.lock();
+   admission_error = (uint64_t) ceil(sketch.get_epsilon() * sketch.get_total());
+   if (use_locks)
+      sketch_mutex.unlock();
+}
 
-   signed char opt;
-   //WARNING: getopt is not thread-safe
-   /*
-    * Parse program arguments defined by MODULE_PARAMS macro with getopt() function (getopt_long() if available)
-    * This macro is defined in config.h file generated by configure script
-    */
-   while ((opt = getopt(argc, argv, "k:t:s:a:m:M:f:l:o:n:c:r:")) != -1) {
-      switch (opt) {
-      case 'k':
-         config.add_member(KEY, optarg);
-         break;
-      case 't':
-         config.set_timeout(optarg);
-         break;
-      case 's':
-         config.add_member(SUM, optarg);
-         break;
-      case 'a':
-         config.add_member(AVG, optarg);
-         break;
-      case 'm':
-         config.add_member(MIN, optarg);
-         break;
-      case 'M':
-         config.add_member(MAX, optarg);
-         break;
-      case 'f':
-         config.add_member(FIRST, optarg);
-         break;
-      case 'l':
-         config.add_member(LAST, optarg);
-         break;
-      case 'o':
-         config.add_member(BIT_OR, optarg);
-         break;
-      case 'n':
-         config.add_member(BIT_AND, optarg);
-         break;
-      case 'c':
-         config.add_ptr_member("COUNT_DISTINCT", optarg);
-         break;
-      case 'r':
-         config.add_member(RATE, optarg);
-         break;
-      default:
-         fprintf(stderr, "Invalid argument %c, skipped...\n", opt);
-      }
+/* ----------------------------------------------------------------- */
+/**
+ * Aggregate received record when admission is used. Stored key is updated as usual,
+ * other key is counted in sketch and stored only when its estimated sum reaches admission_level.
+ * Sum counted before admission is added to admission field of new record from the estimate,
+ * so stored sum is never lower than the true one and no group passing group filter is lost.
+ * The estimate can include sums of other keys (collisions), such group can pass group filter
+ * only because of them, it is counted in uncertain_groups when it is sent.
+ * Other fields of admitted group contain only records since admission, so Builder passes
+ * admission option only to Aggregator whose successors read no other aggregated field.
+ * @param [in] key key of received record.
+ * @param [in] in_tmplt UniRec template of received record.
+ * @param [in] in_rec pointer to received record.
+ * @return 0 on success, -1 on allocation error.
+ */
+int Agg::eval_admission(Key const& key, ur_template_t const* in_tmplt, void const* in_rec)
+{
+   Storage_shard &shard = get_shard(key);
+   // Lock the shard -- CRITICAL SECTION START
+   lock_shard(shard);
+   std::unordered_map<Key, void*>::iterator it = shard.map.find(key);
+
+   if (it != shard.map.end()) {
+      int ret = update_stored_record(it->second, in_tmplt, in_rec);
+      unlock_shard(shard);
+      return ret;
    }
-   // important for reuse getopt function more times
-   optind = 1;
 
-   int id;
-   for (int i = 0; i < config.get_used_fields(); i++) {
-       id = ur_get_id_by_name(config.get_name(i));
+   uint64_t value = admission_value(in_tmplt, in_rec);
+   if (use_locks)
+      sketch_mutex.lock();
+   uint64_t estimate = sketch.add(std::hash<Key>()(key), value);
+   if (use_locks)
+      sketch_mutex.unlock();
+   if (estimate < admission_level) {
+      sketched_records++;
+      unlock_shard(shard);
+      return 0;
+   }
 
-       if (id == UR_E_INVALID_NAME) {
-           fprintf(stderr, "Requested field %s not in input records, cannot continue.\n", config.get_name(i));
-           clean_memory();
-           return 1;
-       }
+   void *stored_rec = NULL;
+   if (update_stored_record(stored_rec, in_tmplt, in_rec) != 0) {
+      unlock_shard(shard);
+      clean_memory_with_ptrs();
+      fprintf(stderr, "Error: Memory allocation problem (output record).\n");
+      return -1;
+   }
+   add_to_admission_field(stored_rec, estimate - value);
+   shard.map.insert(std::make_pair(key, stored_rec));
+   admitted_keys++;
+   count_groups(shard, 1);
+   if (use_quota)
+      make_room(shard, key);
+   // Unlock the shard -- CRITICAL SECTION END
+   unlock_shard(shard);
+   return 0;
+}
 
-       if (ur_is_varlen(id) && !config.is_variable())
-           config.set_variable(true);
+/* ----------------------------------------------------------------- */
+/**
+ * Clear sketch at the end of window and remember error bound of the window.
+ */
+void Agg::clear_sketch()
+{
+   if (use_locks)
+      sketch_mutex.lock();
+   max_sketch_error = std::max(max_sketch_error, sketch.get_epsilon() * sketch.get_total());
+   sketch.clear();
+   if (use_locks)
+      sketch_mutex.unlock();
+}
 
-       if (config.is_key(i)) {
-           keyTemp.add_field(id, ur_get_size(id));
-       }
-       else if (config.is_ptr(i)){
-           int assocId = config.get_associated_id(i);
-           outputTemp.add_ptr_field(id,
-                                    assocId,
-                                    config.get_alloc_ptr(i, ur_get_type(assocId)),
-                                    config.get_function_ptr(i, ur_get_type(assocId)),
-                                    config.get_final_make_ptr(i, ur_get_type(assocId)),
-                                    config.get_dealloc_ptr(i, ur_get_type(assocId))
-                                   );
-       }
-       else {
-           outputTemp.add_field(id, config.get_function_ptr(i, ur_get_type(id)), config.is_func(i, AVG), config.is_func(i, RATE), config.get_avg_ptr(i, ur_get_type(id)));
-       }
+/* ----------------------------------------------------------------- */
+/**
+ * Set up spilling of groups evicted by memory limit to run files. Spilled records are merged
+ * back like partial records of combiners, so only global window with fields which can be merged.
+ */
+void Agg::init_spill()
+{
+   if (!use_quota || config.get_timeout_type() != TIMEOUT_GLOBAL || config.is_variable() ||
+       outputTemp.used_fields_like_ptrs > 0 || use_columns) {
+      fprintf(stderr, "Warning: spilling needs memory limit, global timeout and fixed-length fields without "
+              "COUNT_DISTINCT, groups are evicted.\n");
+      return;
    }
-   char *tmplt_def = config.return_template_def();
-   outputTemp.out_tmplt = ur_create_template(tmplt_def, NULL);
-   delete [] tmplt_def;
 
-   if (outputTemp.out_tmplt == NULL){
-       fprintf(stderr, "Error: Output template could not be created.\n");
-       clean_memory();
-       return -1;
+   size_t rec_size = ur_rec_fixlen_size(outputTemp.out_tmplt);
+   if (spills[0].open(config.get_spill_dir(), keyTemp.key_size, rec_size) != 0 ||
+       spills[1].open(config.get_spill_dir(), keyTemp.key_size, rec_size) != 0) {
+      fprintf(stderr, "Warning: groups are evicted instead of spilled.\n");
+      return;
    }
+   use_spill = true;
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Write evicted group to run file of current window.
+ * @param [in] key key of group.
+ * @param [in] stored_rec stored record of group, it can be freed afterwards.
+ * @return 0 on success, -1 on write error.
+ */
+int Agg::spill_group(Key const &key, void const *stored_rec)
+{
+   if (use_locks)
+      spill_mutex.lock();
+   int ret = spills[spill_index].append(std::hash<Key>()(key), key.get_data(), stored_rec);
+   if (use_locks)
+      spill_mutex.unlock();
+   if (ret == 0)
+      spilled_groups++;
+   return ret;
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Merge groups of run file with stored groups and send them, at the end of window.
+ * Run file is read partition by partition, so memory holds groups of one partition only.
+ * Stored record with the same key is merged into spilled one and removed from storage,
+ * the rest of storage is sent by flush_storage as usual. New groups are spilled
+ * to the other run file meanwhile.
+ */
+void Agg::merge_spilled()
+{
+   if (use_locks)
+      spill_mutex.lock();
+   Spill_file &file = spills[spill_index];
+   spill_index ^= 1;
+   if (use_locks)
+      spill_mutex.unlock();
+
+   if (file.size() == 0) {
+      return;
+   }
+   max_spill_bytes = std::max(max_spill_bytes, file.bytes());
+
+   std::unordered_map<Key, void*> part;
+   size_t rec_size = ur_rec_fixlen_size(outputTemp.out_tmplt);
+
+   auto add_entry = [&](char const *key_data, void const *rec) {
+      Key key(keyTemp.key_size);
+      key.add_field(key_data, keyTemp.key_size);
+      std::pair<std::unordered_map<Key, void*>::iterator, bool> inserted =
+         part.insert(std::make_pair(key, (void*)NULL));
+      if (!inserted.second) {
+         merge_agg_functions(rec, inserted.first->second);
+         return;
+      }
+      void *copy = create_record(outputTemp.out_tmplt, 0);
+      if (copy == NULL) {
+         fprintf(stderr, "Error: Memory allocation problem (spilled record).\n");
+         part.erase(inserted.first);
+         return;
+      }
+      memcpy(copy, rec, rec_size);
+      inserted.first->second = copy;
+   };
+
+   auto send_partition = [&]() {
+      for (auto &item : part) {
+         Storage_shard &shard = get_shard(item.first);
+         // Lock the shard -- CRITICAL SECTION START
+         lock_shard(shard);
+         std::unordered_map<Key, void*>::iterator it = shard.map.find(item.first);
+         if (it != shard.map.end()) {
+            merge_agg_functions(it->second, item.second);
+            ur_free_record(it->second);
+            shard.map.erase(it);
+            count_groups(shard, -1);
+         }
+         // Unlock the shard -- CRITICAL SECTION END
+         unlock_shard(shard);
+         send_record_out(item.second);
+         ur_free_record(item.second);
+      }
+      part.clear();
+   };
+
+   if (file.read([&]() { part.clear(); }, add_entry, send_partition) != 0) {
+      fprintf(stderr, "Error: %lu spilled groups are lost.\n", (unsigned long) file.size());
+   }
+   file.clear();
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Register aggregator for checkpoints. Checkpoint thread reads storage, so shards are always locked.
+ * Stored records are written as they are, which is possible without pointer and variable length fields.
+ */
+void Agg::init_checkpoint()
+{
+   use_locks = true;
+   checkpointable = !config.is_variable() && outputTemp.used_fields_like_ptrs == 0 && !use_columns && !use_spill;
+   if (!checkpointable) {
+      fprintf(stderr, "Warning: aggregator with COUNT_DISTINCT, variable-length fields, columns or spilling "
+              "is not checkpointed.\n");
+   }
+
+   // Rules of restarted module may differ, state is restored only to aggregator with the same records
+   char *tmplt_def = config.return_template_def();
+   std::string identity = tmplt_def;
+   delete [] tmplt_def;
+   for (uint i = 0; i < keyTemp.used_fields; i++) {
+      identity += ",";
+      identity += ur_get_name(keyTemp.indexes_to_record[i]);
+   }
+   identity += "," + std::to_string(config.get_timeout_type());
+   state_signature = SuperFastHash(identity.c_str(), identity.size());
+
+   instances_mutex.lock();
+   instances.push_back(this);
+   instances_mutex.unlock();
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Lock storage of all checkpointed aggregators, so they can be copied by fork in consistent state.
+ * Successors are initialized (and registered) before their predecessors, aggregators are locked
+ * in reverse order, the same in which eval sending from locked shard reaches them.
+ */
+void Agg::lock_all()
+{
+   instances_mutex.lock();
+   for (auto agg = instances.rbegin(); agg != instances.rend(); ++agg) {
+      for (auto &shard : (*agg)->storage) {
+         shard.mutex.lock();
+      }
+   }
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Unlock storage locked by lock_all().
+ */
+void Agg::unlock_all()
+{
+   for (auto agg : instances) {
+      for (auto &shard : agg->storage) {
+         shard.mutex.unlock();
+      }
+   }
+   instances_mutex.unlock();
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Write number of aggregators and state of every one of them. Storage must be locked by lock_all()
+ * or copied by fork. Nothing is allocated, so it can run in forked child.
+ * @param [in] out output to checkpoint file.
+ * @return 0 on success, -1 on write error.
+ */
+int Agg::write_state_all(Checkpoint_writer &out)
+{
+   uint32_t count = instances.size();
+
+   if (out.write(&count, sizeof(count)) != 0) {
+      return -1;
+   }
+   for (auto agg : instances) {
+      if (agg->write_state(out) != 0) {
+         return -1;
+      }
+   }
+   return 0;
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Mark state of all aggregators as saved by the last checkpoint, their storage is not flushed at the end,
+ * so partial windows are not sent as complete ones. Aggregators which are not checkpointed flush as usual.
+ */
+void Agg::set_state_saved_all()
+{
+   instances_mutex.lock();
+   for (auto agg : instances) {
+      agg->state_saved = agg->checkpointable;
+   }
+   instances_mutex.unlock();
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Write header and all stored groups of this aggregator.
+ * @param [in] out output to checkpoint file.
+ * @return 0 on success, -1 on write error.
+ */
+int Agg::write_state(Checkpoint_writer &out)
+{
+   Agg_state_header header;
+   size_t rec_size = ur_rec_fixlen_size(outputTemp.out_tmplt);
+
+   memset(&header, 0, sizeof(header));
+   header.signature = state_signature;
+   header.key_size = keyTemp.key_size;
+   header.rec_size = rec_size;
+   header.time_initialized = time_initialized;
+   header.time_last_from_record = time_last_from_record;
+   header.watermark = watermark;
+   header.next_event_timeout = next_event_timeout;
+   if (checkpointable) {
+      for (auto &shard : storage) {
+         header.groups += shard.map.size();
+      }
+   }
+   if (out.write(&header, sizeof(header)) != 0) {
+      return -1;
+   }
+   if (!checkpointable) {
+      return 0;
+   }
+
+   for (auto &shard : storage) {
+      for (auto &item : shard.map) {
+         if (out.write(item.first.get_data(), keyTemp.key_size) != 0 ||
+             out.write(item.second, rec_size) != 0) {
+            return -1;
+         }
+      }
+   }
+   return 0;
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Restore state of aggregators from checkpoint. Every state goes to the first aggregator
+ * with the same signature which has not got any, states without such aggregator are skipped.
+ * @param [in] data checkpoint data after file header.
+ * @param [in] size bytes of data.
+ * @return number of restored aggregators, -1 if data are damaged.
+ */
+int Agg::restore_state_all(char const *data, size_t size)
+{
+   uint32_t count;
+   size_t pos = sizeof(count);
+   int restored = 0;
+
+   if (size < sizeof(count)) {
+      return -1;
+   }
+   memcpy(&count, data, sizeof(count));
+
+   std::lock_guard<std::mutex> guard(instances_mutex);
+   for (uint32_t i = 0; i < count; i++) {
+      Agg_state_header header;
+      if (size - pos < sizeof(header)) {
+         return -1;
+      }
+      memcpy(&header, data + pos, sizeof(header));
+      pos += sizeof(header);
+
+      uint64_t bytes = header.groups * (header.key_size + header.rec_size);
+      if (size - pos < bytes) {
+         return -1;
+      }
+      for (auto agg : instances) {
+         if (!agg->state_restored && agg->checkpointable && agg->state_signature == header.signature &&
+             agg->keyTemp.key_size == header.key_size &&
+             ur_rec_fixlen_size(agg->outputTemp.out_tmplt) == header.rec_size) {
+            agg->restore_state(header, data + pos);
+            restored++;
+            break;
+         }
+      }
+      pos += bytes;
+   }
+   return restored;
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Insert groups of checkpoint to storage and continue windows from saved time info.
+ * Called before records are received.
+ * @param [in] header header of saved state.
+ * @param [in] groups saved groups following the header.
+ */
+void Agg::restore_state(Agg_state_header const &header, char const *groups)
+{
+   size_t entry_size = header.key_size + header.rec_size;
+
+   state_restored = true;
+   if (header.time_initialized) {
+      time_last_from_record = header.time_last_from_record;
+      watermark = header.watermark;
+      next_event_timeout = header.next_event_timeout;
+      time_initialized = true;
+   }
+   for (auto &shard : storage) {
+      shard.map.reserve(header.groups / STORAGE_SHARDS);
+   }
+   for (uint64_t i = 0; i < header.groups; i++) {
+      char const *entry = groups + i * entry_size;
+      Key key(keyTemp.key_size);
+      key.add_field(entry, keyTemp.key_size);
+
+      void *rec = create_record(outputTemp.out_tmplt, 0);
+      if (rec == NULL) {
+         fprintf(stderr, "Error: Memory allocation problem (restored record).\n");
+         return;
+      }
+      memcpy(rec, entry + header.key_size, header.rec_size);
+      Storage_shard &shard = get_shard(key);
+      lock_shard(shard);
+      if (shard.map.insert(std::make_pair(key, rec)).second) {
+         count_groups(shard, 1);
+      }
+      else {
+         ur_free_record(rec);
+      }
+      unlock_shard(shard);
+   }
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Select shard of storage for the key.
+ * @param [in] key key of record.
+ * @return shard where record with the key is stored.
+ */
+Storage_shard& Agg::get_shard(Key const &key)
+{
+   // Upper bits of multiplied hash, lower bits are used by buckets of the map
+   uint32_t hash = std::hash<Key>()(key) * 2654435761U;
+   return storage[(hash >> 24) & (STORAGE_SHARDS - 1)];
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Merge partially aggregated record into stored record with the same agg functions as
+ * process_agg_functions. Both records are in output template.
+ * Only for functions which can be combined (no variable length and pointer fields).
+ * @param [in] src_rec pointer to partial record.
+ * @param [in, out] dst_rec pointer to stored record.
+ */
+void Agg::merge_agg_functions(void const* src_rec, void* dst_rec)
+{
+   ur_template_t *tmplt = outputTemp.out_tmplt;
+
+   ur_set(tmplt, dst_rec, F_COUNT, ur_get(tmplt, dst_rec, F_COUNT) + ur_get(tmplt, src_rec, F_COUNT));
+
+   // Modify time attributes TIME_FIRST:min
+   if (ur_get(tmplt, src_rec, F_TIME_FIRST) < ur_get(tmplt, dst_rec, F_TIME_FIRST))
+      ur_set(tmplt, dst_rec, F_TIME_FIRST, ur_get(tmplt, src_rec, F_TIME_FIRST));
+
+   // Modify time attributes TIME_LAST:max
+   if (ur_get(tmplt, src_rec, F_TIME_LAST) > ur_get(tmplt, dst_rec, F_TIME_LAST))
+      ur_set(tmplt, dst_rec, F_TIME_LAST, ur_get(tmplt, src_rec, F_TIME_LAST));
+
+   // Sum, min, max, or, and of partial values give the same result as of all records
+   for (int i = 0; i < outputTemp.used_fields; i++) {
+      void *ptr_dst = ur_get_ptr_by_id(tmplt, dst_rec, outputTemp.indexes_to_record[i]);
+      void *ptr_src = ur_get_ptr_by_id(tmplt, src_rec, outputTemp.indexes_to_record[i]);
+      outputTemp.process[i](ptr_src, ptr_dst, tmplt);
+   }
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Move partially aggregated record from combiner to storage.
+ * @param [in] key key of record.
+ * @param [in] partial pointer to partial record.
+ * @return True if storage took the partial record, false if it was merged and can be reused.
+ */
+bool Agg::merge_partial(Key const& key, void *partial)
+{
+   bool taken = false;
+   Storage_shard &shard = get_shard(key);
+   // Lock the shard -- CRITICAL SECTION START
+   lock_shard(shard);
+   std::pair<std::unordered_map<Key, void*>::iterator, bool> inserted =
+      shard.map.insert(std::make_pair(key, (void*)NULL));
+
+   if (inserted.second) {
+      inserted.first->second = partial;
+      taken = true;
+      count_groups(shard, 1);
+      if (use_quota)
+         make_room(shard, key);
+   }
+   else {
+      void *stored_rec = inserted.first->second;
+      bool new_time_window = false;
+      if ( (config.get_timeout_type() == TIMEOUT_ACTIVE) || (config.get_timeout_type() == TIMEOUT_ACTIVE_PASSIVE)) {
+         time_t stored_first = ur_time_get_sec(ur_get(outputTemp.out_tmplt, stored_rec, F_TIME_FIRST));
+         time_t partial_first = ur_time_get_sec(ur_get(outputTemp.out_tmplt, partial, F_TIME_FIRST));
+         new_time_window = stored_first + config.get_timeout(TIMEOUT_ACTIVE) < partial_first;
+      }
+      if (new_time_window) {
+         send_record_out(stored_rec);
+         ur_free_record(stored_rec);
+         inserted.first->second = partial;
+         taken = true;
+      }
+      else {
+         merge_agg_functions(partial, stored_rec);
+      }
+   }
+   // Unlock the shard -- CRITICAL SECTION END
+   unlock_shard(shard);
+   return taken;
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Absorb received record into combiner of current thread.
+ * Record with other key in the same slot is evicted to storage.
+ * @param [in] key key of received record.
+ * @param [in] in_tmplt UniRec template of received record.
+ * @param [in] in_rec pointer to received record.
+ * @param [in] record_first TIME_FIRST of received record in seconds.
+ * @return 0 on success, -1 on allocation error.
+ */
+int Agg::combine(Key const& key, ur_template_t const* in_tmplt, void const* in_rec, time_t record_first)
+{
+   Combiner &comb = *combiners[worker];
+   size_t slot = std::hash<Key>()(key) & combiner_mask;
+   int ret = 0;
+
+   // Lock the combiner -- CRITICAL SECTION START
+   comb.mutex.lock();
+   Key *&slot_key = comb.keys[slot];
+   void *&slot_rec = comb.records[slot];
+   bool init = true;
+
+   if (slot_key != NULL && *slot_key == key) {
+      init = false;
+      if ( (config.get_timeout_type() == TIMEOUT_ACTIVE) || (config.get_timeout_type() == TIMEOUT_ACTIVE_PASSIVE)) {
+         time_t partial_first = ur_time_get_sec(ur_get(outputTemp.out_tmplt, slot_rec, F_TIME_FIRST));
+         if (partial_first + config.get_timeout(TIMEOUT_ACTIVE) < record_first) {
+            // Partial record ends its time window, start new one
+            if (merge_partial(*slot_key, slot_rec))
+               slot_rec = NULL;
+            init = true;
+         }
+      }
+      if (!init)
+         process_agg_functions(in_tmplt, in_rec, slot_rec);
+   }
+   else if (slot_key != NULL) {
+      // Evict other key
+      if (merge_partial(*slot_key, slot_rec))
+         slot_rec = NULL;
+      delete slot_key;
+      slot_key = NULL;
+   }
+
+   if (init) {
+      if (slot_rec == NULL)
+         slot_rec = create_record(outputTemp.out_tmplt, 0);
+      if (slot_rec == NULL) {
+         fprintf(stderr, "Error: Memory allocation problem (combiner record).\n");
+         ret = -1;
+      }
+      else {
+         if (slot_key == NULL)
+            slot_key = new Key(key);
+         init_record_data(in_tmplt, in_rec, slot_rec);
+      }
+   }
+   // Unlock the combiner -- CRITICAL SECTION END
+   comb.mutex.unlock();
+   return ret;
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Merge all partial records of all threads into storage. Called at window boundary and at the end.
+ */
+void Agg::drain_combiners()
+{
+   for (auto &comb : combiners) {
+      // Lock the combiner -- CRITICAL SECTION START
+      comb->mutex.lock();
+      for (size_t slot = 0; slot < comb->keys.size(); slot++) {
+         if (comb->keys[slot] == NULL)
+            continue;
+         if (merge_partial(*comb->keys[slot], comb->records[slot]))
+            comb->records[slot] = NULL;
+         delete comb->keys[slot];
+         comb->keys[slot] = NULL;
+      }
+      // Unlock the combiner -- CRITICAL SECTION END
+      comb->mutex.unlock();
+   }
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Create combiner for every ingest thread if agg functions of this aggregator can be combined.
+ * Count distinct (pointer fields) and variable length fields are aggregated directly in storage.
+ */
+void Agg::init_combiners()
+{
+   int workers = config.get_combiner_workers();
+   if (workers <= 0 || config.is_variable() || outputTemp.used_fields_like_ptrs > 0 || config.is_event_time())
+      return;
+
+   // Round size up to power of two for masking
+   size_t size = 1;
+   while (size < (size_t) config.get_combiner_size())
+      size <<= 1;
+   combiner_mask = size - 1;
+
+   for (int i = 0; i < workers; i++) {
+      Combiner *comb = new Combiner;
+      comb->keys.assign(size, NULL);
+      comb->records.assign(size, NULL);
+      combiners.push_back(comb);
+   }
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Set index of ingest thread which calls eval, so it uses its own combiner.
+ * @param [in] index index of thread from 0, -1 disables combiner for the thread.
+ */
+void Agg::set_worker(int index)
+{
+   worker = index;
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Passive and global timeout control function.
+ * Called periodically by the shared Timer_service thread.
+ * @return seconds to the next check, negative value if no more checks are needed.
+ */
+int Agg::check_timeouts()
+{
+   int timeout_type = config.get_timeout_type();
+
+   if (stop) {
+      return -1;
+   }
+
+   // Window boundary, partial records of all threads belong to ending window
+   drain_combiners();
+
+   if (timeout_type == TIMEOUT_GLOBAL) {
+      flush_storage();
+      return config.get_timeout(TIMEOUT_GLOBAL);
+   }
+
+   if ((timeout_type == TIMEOUT_PASSIVE) || (timeout_type == TIMEOUT_ACTIVE_PASSIVE)) {
+      int timeout = config.get_timeout(TIMEOUT_PASSIVE);
+      time_t start = time(NULL);
+
+      /* Can happen that record accesed for timeout check is being processed by main thread,
+       * expire_passive_records locks shards one by one */
+      expire_passive_records(time_last_from_record - timeout);
+
+      time_t end = time(NULL);
+      int elapsed = difftime(end, start);
+      int sec_to_sleep = elapsed < timeout ? timeout - elapsed : 0;
+
+      time_last_from_record_mutex.lock();
+      // Update the last record time with elapsed time interval
+      time_last_from_record += (elapsed + sec_to_sleep);
+      time_last_from_record_mutex.unlock();
+
+      // Assume regularly timeout period
+      return timeout;
+   }
+
+   // Timeout is ACTIVE only, no checks needed.
+   return -1;
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Send out and remove all stored records with TIME_LAST older than given border.
+ * Shards are scanned and locked one by one.
+ * @param [in] border time in seconds, records last seen before it are expired.
+ */
+void Agg::expire_passive_records(time_t border)
+{
+   for (auto &shard : storage) {
+      // Lock the shard -- CRITICAL SECTION START
+      lock_shard(shard);
+      for (std::unordered_map<Key, void*>::iterator it = shard.map.begin(); it != shard.map.end(); ) {
+         if (ur_time_get_sec(ur_get(outputTemp.out_tmplt, it->second, F_TIME_LAST)) < border) {
+            // Send record out
+            send_record_out(it->second);
+            ur_free_record(it->second);
+            it = shard.map.erase(it);
+            count_groups(shard, -1);
+         }
+         else {
+            ++it;
+         }
+      }
+      // Unlock the shard -- CRITICAL SECTION END
+      unlock_shard(shard);
+   }
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Event time only. Set the watermark from the first record and align the first
+ * passive/global check to multiple of timeout, so windows do not depend on start of replay.
+ * @param [in] record_time TIME_LAST of the first record in seconds.
+ */
+void Agg::init_event_time(time_t record_time)
+{
+   int timeout_type = config.get_timeout_type();
+   int period = config.get_timeout(timeout_type == TIMEOUT_GLOBAL ? TIMEOUT_GLOBAL : TIMEOUT_PASSIVE);
+
+   watermark = record_time - config.get_lateness();
+   next_event_timeout = (watermark / period + 1) * period;
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Event time only. Check whether record would fire passive/global timeout in advance_event_time.
+ * @param [in] record_time TIME_LAST of received record in seconds.
+ * @return true if record closes the current window, so it belongs to the next one.
+ */
+bool Agg::closes_event_window(time_t record_time)
+{
+   if (!config.is_event_time() || !time_initialized || config.get_timeout_type() == TIMEOUT_ACTIVE) {
+      return false;
+   }
+   return record_time - config.get_lateness() > watermark &&
+          record_time - config.get_lateness() >= next_event_timeout;
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Event time only. Move the watermark with time of received record and fire
+ * passive/global timeouts inline when the watermark passes them.
+ * Called before the record is stored, so record which closes the window belongs to the next one.
+ * @param [in] record_time TIME_LAST of received record in seconds.
+ */
+void Agg::advance_event_time(time_t record_time)
+{
+   int timeout_type = config.get_timeout_type();
+   if (timeout_type == TIMEOUT_ACTIVE) {
+      // Active timeout is checked per record in eval()
+      return;
+   }
+   if (record_time - config.get_lateness() <= watermark) {
+      return;
+   }
+   watermark = record_time - config.get_lateness();
+   if (watermark < next_event_timeout) {
+      return;
+   }
+
+   int period;
+   if (timeout_type == TIMEOUT_GLOBAL) {
+      period = config.get_timeout(TIMEOUT_GLOBAL);
+      flush_storage();
+   }
+   else {
+      period = config.get_timeout(TIMEOUT_PASSIVE);
+      expire_passive_records(watermark - period);
+   }
+
+   // Skip empty windows when there is a gap in the data
+   next_event_timeout += ((watermark - next_event_timeout) / period + 1) * period;
+}
+/* ----------------------------------------------------------------- */
+
+
+void get_argc_argv(char* const input, int& argc, char*(&argv)[MAX_ARGS]){
+    argc = 0;
+    char *p2 = strtok(input, " ");
+    while (p2 && argc < MAX_ARGS-1)
+    {
+        argv[argc++] = p2;
+        p2 = strtok(0, " ");
+    }
+    argv[argc] = 0;
+}
+
+
+int Agg::init(char const* options, const std::vector<Stage_intf*> succ)
+{
+   int argc;
+   char* argv[MAX_ARGS];
+   char text[MAX_STRING];
+   strcpy(text, options);
+   get_argc_argv(text, argc, argv);
+
+   signed char opt;
+   //WARNING: getopt is not thread-safe
+   /*
+    * Parse program arguments defined by MODULE_PARAMS macro with getopt() function (getopt_long() if available)
+    * This macro is defined in config.h file generated by configure script
+    */
+   while ((opt = getopt(argc, argv, "k:t:s:a:m:M:f:l:o:n:c:r:e:w:Sq:Q:E:H:XD:K")) != -1) {
+      switch (opt) {
+      case 'k':
+         config.add_member(KEY, optarg);
+         break;
+      case 't':
+         config.set_timeout(optarg);
+         break;
+      case 's':
+         config.add_member(SUM, optarg);
+         break;
+      case 'a':
+         config.add_member(AVG, optarg);
+         break;
+      case 'm':
+         config.add_member(MIN, optarg);
+         break;
+      case 'M':
+         config.add_member(MAX, optarg);
+         break;
+      case 'f':
+         config.add_member(FIRST, optarg);
+         break;
+      case 'l':
+         config.add_member(LAST, optarg);
+         break;
+      case 'o':
+         config.add_member(BIT_OR, optarg);
+         break;
+      case 'n':
+         config.add_member(BIT_AND, optarg);
+         break;
+      case 'c':
+         config.add_ptr_member("COUNT_DISTINCT", optarg);
+         break;
+      case 'r':
+         config.add_member(RATE, optarg);
+         break;
+      case 'e':
+         config.set_event_time(optarg);
+         break;
+      case 'w':
+         config.set_combiners(optarg);
+         break;
+      case 'S':
+         config.set_columnar(true);
+         break;
+      case 'q':
+         config.set_quota(optarg);
+         break;
+      case 'Q':
+         config.set_global_quota(optarg);
+         break;
+      case 'E':
+         config.set_evict_policy(optarg);
+         break;
+      case 'H':
+         config.set_admission(optarg);
+         break;
+      case 'X':
+         config.set_other_aggregates_read(true);
+         break;
+      case 'D':
+         config.set_spill_dir(optarg);
+         break;
+      case 'K':
+         config.set_checkpointed(true);
+         break;
+      default:
+         fprintf(stderr, "Invalid argument %c, skipped...\n", opt);
+      }
+   }
+   // important for reuse getopt function more times
+   optind = 1;
+
+   int id;
+   for (int i = 0; i < config.get_used_fields(); i++) {
+       id = ur_get_id_by_name(config.get_name(i));
+
+       if (id == UR_E_INVALID_NAME) {
+           fprintf(stderr, "Requested field %s not in input records, cannot continue.\n", config.get_name(i));
+           clean_memory();
+           return 1;
+       }
+
+       if (ur_is_varlen(id) && !config.is_variable())
+           config.set_variable(true);
+
+       if (config.is_key(i)) {
+           keyTemp.add_field(id, ur_get_size(id));
+       }
+       else if (config.is_ptr(i)){
+           int assocId = config.get_associated_id(i);
+           outputTemp.add_ptr_field(id,
+                                    assocId,
+                                    config.get_alloc_ptr(i, ur_get_type(assocId)),
+                                    config.get_function_ptr(i, ur_get_type(assocId)),
+                                    config.get_final_make_ptr(i, ur_get_type(assocId)),
+                                    config.get_dealloc_ptr(i, ur_get_type(assocId))
+                                   );
+       }
+       else {
+           outputTemp.add_field(id, config.get_function_ptr(i, ur_get_type(id)), config.is_func(i, AVG), config.is_func(i, RATE), config.get_avg_ptr(i, ur_get_type(id)));
+       }
+   }
+   char *tmplt_def = config.return_template_def();
+   outputTemp.out_tmplt = ur_create_template(tmplt_def, NULL);
+   delete [] tmplt_def;
+
+   if (outputTemp.out_tmplt == NULL){
+       fprintf(stderr, "Error: Output template could not be created.\n");
+       clean_memory();
+       return -1;
+   }
+
+   // Estimated memory of one group for memory limits
+   group_bytes = keyTemp.key_size + ur_rec_fixlen_size(outputTemp.out_tmplt) + GROUP_OVERHEAD;
+   if (config.is_variable())
+      group_bytes += 2048;
+   quota_bytes = (size_t) config.get_quota() << 20;
+   if (config.get_global_quota() > 0)
+      all_quota_bytes = (size_t) config.get_global_quota() << 20;
+   use_quota = quota_bytes > 0 || all_quota_bytes > 0;
+
+   pipeline_successors = succ;
+   // Group filter follows the aggregator, it is evaluated on stored records before they are finished
+   if (succ.size() == 1 && (group_filter = dynamic_cast<Filter*>(succ.front())) != NULL) {
+      group_view.init(outputTemp);
+   }
+
 
-   pipeline_successors = succ;
-   storage.reserve(MAP_RESERVE);        // Reserve enough space for records without need of rehash()
-
-
 #ifdef DEBUG
    // DEBUG: print configuration
    config.print();
 #endif
 
+   init_combiners();
+   // More ingest threads share the storage
+   if (config.get_combiner_workers() > 0) {
+      use_locks = true;
+   }
+   // Plan is rebuilt when input template changes, which is safe only with one ingest thread
+   use_update_plan = config.get_combiner_workers() == 0 && !config.is_variable();
+   if (config.is_columnar()) {
+      use_columns = init_columns() == 0;
+      if (!use_columns) {
+         fprintf(stderr, "Warning: columnar state needs global timeout and fixed-length fields without "
+                 "COUNT_DISTINCT, aggregator stores records.\n");
+      }
+   }
+   if (config.get_admission_fraction() > 0) {
+      init_admission();
+   }
+   if (!config.get_spill_dir().empty()) {
+      init_spill();
+   }
+   if (config.is_checkpointed()) {
+      init_checkpoint();
+   }
+
    time_last_from_record = time(NULL);
-   timeout_thread = std::thread(&Agg::check_timeouts, this);
+   int timeout_type = config.get_timeout_type();
+   // In event-time mode the timeouts are checked by eval() itself, active timeout is checked per record
+   if (!config.is_event_time() && timeout_type != TIMEOUT_ACTIVE) {
+      if (timeout_type != TIMEOUT_GLOBAL) {
+         time_last_from_record += config.get_timeout(TIMEOUT_PASSIVE);
+      }
+      // Storage is shared with timer thread from now
+      use_locks = true;
+      timer_id = Timer_service::instance().add(0, std::bind(&Agg::check_timeouts, this));
+   }
 
    //print_template_fields(outputTemp.out_tmplt);
    //print_all_defined_ur_fields();
@@ -494,6 +1670,77 @@ int Agg::init(char const* options, const std::vector<Stage_intf*> succ)
 }
 
 
+/* ----------------------------------------------------------------- */
+/**
+ * Set time info from the first record, in event-time mode move the watermark.
+ * @param [in] record_last TIME_LAST of received record in seconds.
+ */
+void Agg::update_time(time_t record_last)
+{
+   if (!time_initialized) {
+      // Lock the time variable -- CRITICAL SECTION START
+      time_last_from_record_mutex.lock();
+      time_last_from_record = record_last;
+      // Unlock the time variable -- CRITICAL SECTION END
+      time_last_from_record_mutex.unlock();
+      if (config.is_event_time()) {
+         init_event_time(record_last);
+      }
+      time_initialized = true;
+   }
+   if (config.is_event_time()) {
+      advance_event_time(record_last);
+   }
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Aggregate received record into stored record of its key. Shard of the key must be locked by caller.
+ * @param [in, out] stored_rec stored record, NULL for new key (then it is created).
+ * @param [in] in_tmplt UniRec template of received record.
+ * @param [in] in_rec pointer to received record.
+ * @return 0 on success, -1 on allocation error.
+ */
+int Agg::update_stored_record(void *&stored_rec, ur_template_t const* in_tmplt, void const* in_rec)
+{
+   if (stored_rec != NULL) {
+      // Element already exists
+      bool new_time_window = false;
+      // Main thread checks time window only when active timeout set
+      if ( (config.get_timeout_type() == TIMEOUT_ACTIVE) || (config.get_timeout_type() == TIMEOUT_ACTIVE_PASSIVE)) {
+         time_t record_first = ur_time_get_sec(ur_get(in_tmplt, in_rec, F_TIME_FIRST));
+         // Check time window for active timeout
+         time_t stored_first = ur_time_get_sec(ur_get(outputTemp.out_tmplt, stored_rec, F_TIME_FIRST));
+         // Record is not in current time window
+         if (stored_first + config.get_timeout(TIMEOUT_ACTIVE) < record_first ) {
+            new_time_window = true;
+         }
+      }
+      if (new_time_window) {
+         if(!send_record_out(stored_rec)) {
+            return 0;
+         }
+
+         init_record_data(in_tmplt, in_rec, stored_rec);
+      }
+      else {
+         process_agg_functions(in_tmplt, in_rec, stored_rec);
+      }
+   }
+   else {
+      // New element
+      // If there should be place for variable length field in record reserve it
+      int var_length = config.is_variable() == false ? 0 : 2048;
+      void * out_rec = create_record(outputTemp.out_tmplt, var_length);
+      if (!out_rec) {
+         return -1;
+      }
+      init_record_data(in_tmplt, in_rec, out_rec);
+      stored_rec = out_rec;
+   }
+   return 0;
+}
+
 /* ================================================================= */
 /* ========================= M A I N =============================== */
 /* ================================================================= */
@@ -501,19 +1748,10 @@ int Agg::eval(void const* in_rec, ur_template_t const* in_tmplt)
 {
    /* **** Main processing loop **** */
 
-   // Warning: should be static thread_local?
-   static bool once = true;
-   if(once){
-      // Lock the time variable -- CRITICAL SECTION START
-      time_last_from_record_mutex.lock();
-      time_last_from_record = ur_time_get_sec(ur_get(in_tmplt, in_rec, F_TIME_LAST));
-      // Unlock the time variable -- CRITICAL SECTION END
-      time_last_from_record_mutex.unlock();
-      once = false;
-   }
+   update_time(ur_time_get_sec(ur_get(in_tmplt, in_rec, F_TIME_LAST)));
 
    // Read data from input, process them and write to output
-   if (!Agg::stop) {
+   if (!stop) {
 
       /* Start message processing */
       time_t record_first = ur_time_get_sec(ur_get(in_tmplt, in_rec, F_TIME_FIRST));
@@ -526,65 +1764,247 @@ int Agg::eval(void const* in_rec, ur_template_t const* in_tmplt)
                            ur_get_size(keyTemp.indexes_to_record[i]));
       }
 
+      if (!combiners.empty() && worker >= 0 && (size_t) worker < combiners.size()) {
+         return combine(rec_key, in_tmplt, in_rec, record_first);
+      }
+
+      if (use_columns) {
+         aggregate_to_columns(rec_key, in_tmplt, in_rec);
+         return 0;
+      }
+
+      if (use_admission) {
+         return eval_admission(rec_key, in_tmplt, in_rec);
+      }
+
       void *init_ptr = NULL;
       std::pair<std::unordered_map<Key, void*>::iterator, bool> inserted;
-      // Lock the storage -- CRITICAL SECTION START
-      storage_mutex.lock();
-      inserted = storage.insert(std::make_pair(rec_key, init_ptr));
-
-      if (inserted.second == false) {
-         // Element already exists
-         bool new_time_window = false;
-         void *stored_rec = inserted.first->second;
-         // Main thread checks time window only when active timeout set
-         if ( (config.get_timeout_type() == TIMEOUT_ACTIVE) || (config.get_timeout_type() == TIMEOUT_ACTIVE_PASSIVE)) {
-            // Check time window for active timeout
-            time_t stored_first = ur_time_get_sec(ur_get(outputTemp.out_tmplt, stored_rec, F_TIME_FIRST));
-            // Record is not in current time window
-            if (stored_first + config.get_timeout(TIMEOUT_ACTIVE) < record_first ) {
-               new_time_window = true;
-            }
+      Storage_shard &shard = get_shard(rec_key);
+      // Lock the shard -- CRITICAL SECTION START
+      lock_shard(shard);
+      inserted = shard.map.insert(std::make_pair(rec_key, init_ptr));
+
+      if (update_stored_record(inserted.first->second, in_tmplt, in_rec) != 0) {
+         shard.map.erase(inserted.first);
+         unlock_shard(shard);
+         clean_memory_with_ptrs();
+         fprintf(stderr, "Error: Memory allocation problem (output record).\n");
+         return -1;
+      }
+      if (inserted.second) {
+         count_groups(shard, 1);
+         if (use_quota)
+            make_room(shard, rec_key);
+      }
+      // Unlock the shard -- CRITICAL SECTION END
+      unlock_shard(shard);
+   }
+   return 0;
+}
+
+/* ----------------------------------------------------------------- */
+/**
+ * Aggregate selected records of batch. Time of every record is processed in order; in event-time
+ * mode the batch is split before record which closes window, so the window is flushed before
+ * that record is aggregated, same as record by record. Parts are aggregated by aggregate_batch.
+ * Pre-aggregation combiners and admission process records one by one.
+ * @param [in] batch records for processing.
+ * @param [in] sel indexes of selected records in batch.
+ * @param [in] n_sel number of selected records.
+ * @return 0 on success, otherwise a negative error value.
+ */
+int Agg::eval_batch(Record_batch const &batch, uint16_t const *sel, size_t n_sel)
+{
+   if (n_sel == 0 || !combiners.empty() || use_admission) {
+      return Stage_intf::eval_batch(batch, sel, n_sel);
+   }
+   ur_template_t const* in_tmplt = batch.get_template();
+   size_t start = 0;
+   int ret;
+
+   for (size_t j = 0; j < n_sel; j++) {
+      time_t record_last = ur_time_get_sec(ur_get(in_tmplt, batch.row(sel[j]), F_TIME_LAST));
+
+      if (j > start && closes_event_window(record_last)) {
+         if ((ret = aggregate_batch(batch, sel + start, j - start)) != 0) {
+            return ret;
          }
-         if (new_time_window) {
-            if(!send_record_out(stored_rec)) {
-               return 0;
-            }
+         start = j;
+      }
+      update_time(record_last);
+   }
+   return aggregate_batch(batch, sel + start, n_sel - start);
+}
 
-            init_record_data(in_tmplt, in_rec, stored_rec);
+/* ----------------------------------------------------------------- */
+/**
+ * Aggregate records of one window. Records are grouped by key in scratch table first,
+ * then storage is probed once per distinct key and records of the key are aggregated in order.
+ * @param [in] batch records for processing.
+ * @param [in] sel indexes of selected records in batch.
+ * @param [in] n_sel number of selected records, at least one.
+ * @return 0 on success, otherwise a negative error value.
+ */
+int Agg::aggregate_batch(Record_batch const &batch, uint16_t const *sel, size_t n_sel)
+{
+   ur_template_t const* in_tmplt = batch.get_template();
+
+   if (stop) {
+      return 0;
+   }
+
+   // Keys of all records next to each other, small enough to stay in L1 cache for usual batches
+   size_t key_size = keyTemp.key_size;
+   batch_keys.resize(n_sel * key_size + 1);
+   batch_hashes.resize(n_sel);
+   batch_next.assign(n_sel, -1);
+   batch_last.resize(n_sel);
+   batch_groups.clear();
+
+   for (size_t j = 0; j < n_sel; j++) {
+      void const *in_rec = batch.row(sel[j]);
+      char *key = &batch_keys[j * key_size];
+      size_t offset = 0;
+      for (uint i = 0; i < keyTemp.used_fields; i++) {
+         int size = ur_get_size(keyTemp.indexes_to_record[i]);
+         memcpy(key + offset, ur_get_ptr_by_id(in_tmplt, in_rec, keyTemp.indexes_to_record[i]), size);
+         offset += size;
+      }
+      batch_hashes[j] = SuperFastHash(key, key_size);
+   }
+
+   // Group records with the same key, open addressing with linear probing
+   size_t table_size = 1;
+   while (table_size < 2 * n_sel)
+      table_size <<= 1;
+   size_t mask = table_size - 1;
+   batch_table.assign(table_size, -1);
+
+   for (size_t j = 0; j < n_sel; j++) {
+      uint32_t hash = batch_hashes[j];
+      size_t pos = hash & mask;
+      while (true) {
+         int head = batch_table[pos];
+         if (head < 0) {
+            // First record of key
+            batch_table[pos] = j;
+            batch_last[j] = j;
+            batch_groups.push_back(j);
+            break;
          }
-         else {
-            process_agg_functions(in_tmplt, in_rec, stored_rec);
+         if (batch_hashes[head] == hash &&
+             memcmp(&batch_keys[head * key_size], &batch_keys[j * key_size], key_size) == 0) {
+            batch_next[batch_last[head]] = j;
+            batch_last[head] = j;
+            break;
          }
+         pos = (pos + 1) & mask;
       }
-      else {
-         // New element
-         // If there should be place for variable length field in record reserve it
-         int var_length = config.is_variable() == false ? 0 : 2048;
-         void * out_rec = create_record(outputTemp.out_tmplt, var_length);
-         if (!out_rec) {
+   }
+
+   // One probe of storage per distinct key
+   for (auto const &head : batch_groups) {
+      Key rec_key(key_size);
+      rec_key.add_field(&batch_keys[head * key_size], key_size);
+
+      if (use_columns) {
+         bool created;
+         if (use_locks)
+            column_mutex.lock();
+         uint32_t slot = column_state.find_or_insert(rec_key, in_tmplt, batch.row(sel[head]), created);
+         for (int j = created ? batch_next[head] : head; j >= 0; j = batch_next[j]) {
+            column_state.update(slot, in_tmplt, batch.row(sel[j]));
+         }
+         if (use_locks)
+            column_mutex.unlock();
+         continue;
+      }
+
+      Storage_shard &shard = get_shard(rec_key);
+      // Lock the shard -- CRITICAL SECTION START
+      lock_shard(shard);
+      std::pair<std::unordered_map<Key, void*>::iterator, bool> inserted =
+         shard.map.insert(std::make_pair(rec_key, (void*)NULL));
+      if (inserted.second)
+         count_groups(shard, 1);
+
+      for (int j = head; j >= 0; j = batch_next[j]) {
+         if (update_stored_record(inserted.first->second, in_tmplt, batch.row(sel[j])) != 0) {
+            if (inserted.first->second == NULL) {
+               shard.map.erase(inserted.first);
+               count_groups(shard, -1);
+            }
+            unlock_shard(shard);
             clean_memory_with_ptrs();
             fprintf(stderr, "Error: Memory allocation problem (output record).\n");
             return -1;
          }
-         init_record_data(in_tmplt, in_rec, out_rec);
-         inserted.first->second = out_rec;
       }
-      // Unlock the storage -- CRITICAL SECTION END
-      storage_mutex.unlock();
+      if (inserted.second && use_quota)
+         make_room(shard, rec_key);
+      // Unlock the shard -- CRITICAL SECTION END
+      unlock_shard(shard);
    }
+
+   batch_records += n_sel;
+   batch_distinct += batch_groups.size();
    return 0;
 }
 
 Agg::~Agg(){
-   DBG((stderr, "Module canceled, waiting for running threads.\n"));
-   Agg::stop = 1;
-   if(timeout_thread.joinable())
-      timeout_thread.join();
-   DBG((stderr, "Other threads ended, cleaning storage and exiting.\n"));
-   // All other threads not running now, no need to use mutexes there
-
-   flush_storage();
-   sleep(1);
+   if (batch_records > 0) {
+      fprintf(stderr, "Aggregator: %lu records in batches combined to %lu keys (ratio %.2f)\n",
+              (unsigned long) batch_records, (unsigned long) batch_distinct,
+              (double) batch_records / batch_distinct);
+   }
+   DBG((stderr, "Module canceled, cancelling timer.\n"));
+   stop = true;
+   // Waits only if the timeout check is running just now
+   Timer_service::instance().cancel(timer_id);
+   DBG((stderr, "Timer cancelled, cleaning storage and exiting.\n"));
+   // Timer is not running now, no need to use mutexes there
+
+   if (config.is_checkpointed()) {
+      instances_mutex.lock();
+      instances.erase(std::remove(instances.begin(), instances.end(), this), instances.end());
+      instances_mutex.unlock();
+   }
+   drain_combiners();
+   // Saved state continues after restart, partial windows are not sent as complete ones
+   if (!state_saved) {
+      flush_storage();
+   }
+   if (use_admission) {
+      fprintf(stderr, "Aggregator: %lu keys admitted to storage, %lu records counted only in sketch %zux%d; "
+              "sums of admitted keys exceed true sums by at most %.0f with probability %.3f; "
+              "%lu sent groups pass group filter only within this error (possible false positives)\n",
+              (unsigned long) admitted_keys, (unsigned long) sketched_records, sketch.get_width(), COUNT_MIN_DEPTH,
+              max_sketch_error, 1 - sketch.get_delta(), (unsigned long) uncertain_groups);
+   }
+   if (use_quota) {
+      fprintf(stderr, "Aggregator: %lu groups evicted because of memory limit\n",
+              (unsigned long) evicted_groups);
+   }
+   if (use_spill) {
+      fprintf(stderr, "Aggregator: %lu groups spilled to disk, the largest run file %.1f MiB\n",
+              (unsigned long) spilled_groups, max_spill_bytes / 1048576.0);
+   }
+   if (groups_checked > 0) {
+      fprintf(stderr, "Aggregator: %lu of %lu groups dropped by group filter before finishing\n",
+              (unsigned long) groups_dropped, (unsigned long) groups_checked);
+   }
+   for (auto &comb : combiners) {
+      for (auto &rec : comb->records) {
+         if (rec != NULL)
+            ur_free_record(rec);
+      }
+      delete comb;
+   }
+   combiners.clear();
+   if (column_rec != NULL) {
+      ur_free_record(column_rec);
+      column_rec = NULL;
+   }
 
    /* **** Cleanup **** */
    // Free unirec templates and stored records
@@ -1,63 +1,195 @@
 #include "../interface.hpp"
 #include "configuration.hpp"
 #include "key.h"
+#include "column_state.hpp"
+#include "count_min.hpp"
+#include "group_view.hpp"
+#include "spill_file.hpp"
+#include "copy_plan.hpp"
+#include "update_plan.hpp"
 #include <vector>
+#include <stdio.h>
 #include <time.h>
 #include <unordered_map>
-#include <thread>
 #include <mutex>
+#include <atomic>
 
+class Checkpoint_writer;
 
-/* ----------------------------------------------------------------- */
-#ifdef  AGGREGATOR_KEYWORD_H
-namespace std {
-   /**
-    * std::hash() specialization to use with class Key.
-    * Specialization needed by use class Key as key in std::unordered_map
-    */
-    template<>
-    struct hash<Key>
-    {
-        size_t operator()(const Key &k) const
-        {
-           return SuperFastHash(k.get_data(), k.get_size());
-        }
-    };
-}
-#endif
-/* ----------------------------------------------------------------- */
+/** Number of independently locked parts of Agg storage, must be power of two. */
+#define STORAGE_SHARDS 16
+
+/** Estimated bytes of map node and allocations of one stored group besides key and record, bucket arrays are counted separately. */
+#define GROUP_OVERHEAD 64
+/** Number of sampled buckets when group to evict is searched. */
+#define EVICT_SAMPLES 8
+
+/**
+ * Part of Agg storage with its own lock. Record belongs to shard by hash of its key.
+ */
+struct Storage_shard {
+    std::unordered_map<Key, void*> map;
+    std::mutex mutex;
+    size_t bucket_bytes = 0;        // Memory of bucket array of map counted in used_bytes
+};
+
+/**
+ * Small direct-mapped table of partially aggregated records of one ingest thread.
+ * Repeated keys are absorbed here without touching the shared storage.
+ */
+struct Combiner {
+    std::vector<Key*> keys;         // Key of every slot, NULL if slot is empty
+    std::vector<void*> records;     // Partial record of every slot in output template, NULL if not allocated
+    std::mutex mutex;               // Owner thread against merge at window boundary
+};
+
+/**
+ * Header of state of one Agg in checkpoint file, followed by groups (key and record each).
+ */
+struct Agg_state_header {
+    uint32_t signature;                 // Hash of output template and key fields, Agg with the same one takes the state
+    uint32_t key_size;                  // Bytes of key of group
+    uint32_t rec_size;                  // Bytes of record of group
+    uint32_t time_initialized;          // If time info below is valid
+    int64_t time_last_from_record;      // Passive timeout time info
+    int64_t watermark;                  // Event time: max TIME_LAST of records minus lateness
+    int64_t next_event_timeout;         // Event time: when to check passive/global timeout again
+    uint64_t groups;                    // Number of groups following the header
+};
 
 class Agg : public Stage_intf{
 
     public:
 
-    static int stop;
+    static std::atomic<size_t> all_used_bytes;   // Estimated memory of stored groups of all aggregators
+    static size_t all_quota_bytes;               // Memory limit of all aggregators, 0 if not set
+    static void set_worker(int index);
+    static void lock_all();
+    static void unlock_all();
+    static int write_state_all(Checkpoint_writer &out);
+    static void set_state_saved_all();
+    static int restore_state_all(char const *data, size_t size);
     int init(char const* options, const std::vector<Stage_intf*> succ);
     int eval(void const* rec, ur_template_t const* in_tmplt);
+    int eval_batch(Record_batch const &batch, uint16_t const *sel, size_t n_sel);
 
     private:
     Config config;
     OutputTemplate outputTemp;
     KeyTemplate keyTemp;
-    std::unordered_map<Key , void*> storage;
+    Storage_shard storage[STORAGE_SHARDS];    // Stored records split to shards by hash of key
     time_t time_last_from_record;             // Passive timeout time info set due to records time
+    bool time_initialized = false;            // If time info was set from the first record
+    time_t watermark = 0;                     // Event time: max TIME_LAST of records minus lateness
+    time_t next_event_timeout = 0;            // Event time: when to check passive/global timeout again
 
-    std::thread timeout_thread;
-    std::mutex storage_mutex;                 // For storage modifying sections
+    int timer_id = -1;                        // Timer of passive/global timeout in Timer_service, -1 if none
+    std::atomic<bool> stop{false};            // Set by destructor, other aggregators keep running on rules reload
+    bool use_locks = false;                   // If timer thread accesses storage, otherwise shards are not locked
+    std::mutex send_mutex;                    // For sending from eval and timer thread at once
+    std::vector<Combiner*> combiners;         // Pre-aggregation table of every ingest thread, empty if not used
+    size_t combiner_mask = 0;                 // Number of slots in table minus one
+    Update_plan update_plan;                  // Specialized process_agg_functions for current input template
+    bool use_update_plan = false;             // If plan can be used, only one thread aggregates records
+    Copy_plan copy_plan;                      // Specialized ur_copy_fields for current input template, see use_update_plan
+    static thread_local int worker;           // Index of ingest thread to select combiner, -1 if not set
+    std::vector<char> batch_keys;             // Batch: keys of selected records, key_size bytes each
+    std::vector<uint32_t> batch_hashes;       // Batch: hash of every key
+    std::vector<int> batch_table;             // Batch: open addressing table of first records of keys
+    std::vector<int> batch_next;              // Batch: next record with the same key, -1 at the end
+    std::vector<int> batch_last;              // Batch: last record of key, valid for first records
+    std::vector<int> batch_groups;            // Batch: first record of every distinct key
+    uint64_t batch_records = 0;               // Batch: records aggregated in batches
+    uint64_t batch_distinct = 0;              // Batch: distinct keys of batches, one storage probe each
+    Column_state column_state;                // Columnar storage used instead of shards, see use_columns
+    bool use_columns = false;                 // If aggregated fields are stored in columns (-S, global timeout)
+    std::mutex column_mutex;                  // For column_state when timer thread flushes it
+    Record_batch column_batch;                // Columnar flush: groups materialized for successors
+    std::vector<uint16_t> column_sel;         // Columnar flush: selection of all records of column_batch
+    void *column_rec = NULL;                  // Columnar flush: scratch record of one group
+    Filter *group_filter = NULL;              // Group filter of successor, evaluated before records are finished
+    Group_view group_view;                    // Final values of stored records for group_filter
+    std::atomic<uint64_t> groups_checked{0};  // Records checked by group_filter before sending
+    std::atomic<uint64_t> groups_dropped{0};  // Records dropped by group_filter without finishing
+    size_t group_bytes = 0;                   // Estimated memory of one stored group
+    size_t quota_bytes = 0;                   // Memory limit of this aggregator, 0 if not set
+    bool use_quota = false;                   // If memory limit of this or all aggregators is set
+    std::atomic<size_t> used_bytes{0};        // Estimated memory of stored groups
+    std::atomic<uint64_t> evicted_groups{0};  // Groups evicted because of memory limit
+    Count_min sketch;                         // Admission: estimated sums of keys which are not stored
+    std::mutex sketch_mutex;                  // For sketch when timer thread clears it
+    bool use_admission = false;               // If keys are stored only after their estimate reaches admission_level
+    int admission_field = -1;                 // Admission: UniRec ID of summed field compared by group filter
+    Update_plan::step_type admission_type;    // Admission: type of admission_field
+    uint64_t admission_level = 0;             // Admission: estimated sum which admits key to storage
+    uint64_t admission_bound = 0;             // Admission: group filter requires admission field greater than this
+    std::atomic<uint64_t> admission_error{0}; // Admission: error bound of sketch for groups being sent
+    std::atomic<uint64_t> admitted_keys{0};   // Admission: keys moved from sketch to storage
+    std::atomic<uint64_t> sketched_records{0};// Admission: records counted only in sketch
+    double max_sketch_error = 0;              // Admission: the highest error bound of finished windows
+    std::atomic<uint64_t> uncertain_groups{0};// Admission: sent groups which may pass only because of sketch error
+    Spill_file spills[2];                     // Run files of evicted groups, one is merged while other takes new groups
+    int spill_index = 0;                      // Index of run file which takes evicted groups
+    bool use_spill = false;                   // If groups evicted by memory limit are spilled to disk
+    std::mutex spill_mutex;                   // For spill_index and run file when more threads evict
+    std::atomic<uint64_t> spilled_groups{0};  // Groups written to run files
+    uint64_t max_spill_bytes = 0;             // The largest run file of finished windows
+    static std::vector<Agg*> instances;       // Initialized aggregators in order of creation, for checkpoints
+    static std::mutex instances_mutex;        // For instances
+    uint32_t state_signature = 0;             // Checkpoint: hash of output template and key fields
+    bool checkpointable = false;              // Checkpoint: if stored records can be written as they are
+    bool state_restored = false;              // Checkpoint: if state was restored to this aggregator
+    bool state_saved = false;                 // Checkpoint: if state was saved at the end, storage is not flushed
     std::mutex time_last_from_record_mutex;   // For modifying Passive timeout time info
 
     void clean_memory();
     void clean_memory_with_ptrs();
     void process_agg_functions(ur_template_t const* in_tmplt, void const* src_rec, void *dst_rec);
+    void process_ptr_functions(ur_template_t const* in_tmplt, void const* src_rec, void *dst_rec);
     void init_record_data(ur_template_t const* in_tmplt, void const* src_rec, void *dst_rec);
     void init_ptr_field(ur_template_t const* in_tmplt, void const* src_rec, void* dst_rec);
     void prepare_to_send(void *stored_rec);
+    void drop_record(void *stored_rec);
     bool send_record_out(void *out_rec);
-    void check_timeouts();
+    int check_timeouts();
+    void expire_passive_records(time_t border);
+    void init_event_time(time_t record_time);
+    void advance_event_time(time_t record_time);
+    bool closes_event_window(time_t record_time);
     void flush_storage();
+    int init_columns();
+    void aggregate_to_columns(Key const& key, ur_template_t const* in_tmplt, void const* in_rec);
+    void flush_columns();
+    void update_time(time_t record_last);
+    int aggregate_batch(Record_batch const &batch, uint16_t const *sel, size_t n_sel);
+    int update_stored_record(void *&stored_rec, ur_template_t const* in_tmplt, void const* in_rec);
+    void merge_agg_functions(void const* src_rec, void* dst_rec);
+    bool merge_partial(Key const& key, void *partial);
+    int combine(Key const& key, ur_template_t const* in_tmplt, void const* in_rec, time_t record_first);
+    void drain_combiners();
+    void init_combiners();
+    void lock_shard(Storage_shard &shard) { if (use_locks) shard.mutex.lock(); }
+    void unlock_shard(Storage_shard &shard) { if (use_locks) shard.mutex.unlock(); }
+    Storage_shard& get_shard(Key const &key);
+    void count_groups(Storage_shard &shard, long n);
+    bool over_quota() const;
+    void make_room(Storage_shard &shard, Key const &keep);
+    void init_admission();
+    uint64_t admission_value(ur_template_t const* in_tmplt, void const* in_rec) const;
+    void add_to_admission_field(void *stored_rec, uint64_t value);
+    uint64_t admission_field_value(void const *stored_rec) const;
+    void update_admission_error();
+    int eval_admission(Key const& key, ur_template_t const* in_tmplt, void const* in_rec);
+    void clear_sketch();
+    void init_spill();
+    int spill_group(Key const &key, void const *stored_rec);
+    void merge_spilled();
+    void init_checkpoint();
+    int write_state(Checkpoint_writer &out);
+    void restore_state(Agg_state_header const &header, char const *groups);
     
     public:
-    Agg() : timeout_thread(){};
+    Agg(){};
     ~Agg();
 };
 
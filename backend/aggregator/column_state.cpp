@@ -0,0 +1,214 @@
+/**
+ * \file column_state.cpp
+ * \brief Definition of Column_state class.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#include "column_state.hpp"
+#include "../fields.h"
+
+#include <string.h>
+
+int Column_state::init(OutputTemplate const &out, KeyTemplate const &key)
+{
+   if (out.used_fields_like_ptrs > 0) {
+      return -1;
+   }
+   key_tmplt = &key;
+   out_tmplt = out.out_tmplt;
+   columns.clear();
+
+   for (int i = 0; i < out.used_fields; i++) {
+      int id = out.indexes_to_record[i];
+
+      if (!ur_is_fixlen(id)) {
+         return -1;
+      }
+      Column col;
+
+      col.id = id;
+      col.size = ur_get_size(id);
+      col.dst_offset = out_tmplt->offset[id];
+      col.avg = out.avg_fields[i] != NULL;
+      col.rate = out.rate_fields[i] != NULL;
+      col.post = col.avg ? out.avg_fields[i] : out.rate_fields[i];
+      Update_plan::classify(out.process[i], col.step);
+      col.step.src_offset = 0;
+      col.step.dst_offset = 0;
+      columns.push_back(col);
+   }
+   in_tmplt = NULL;
+   return 0;
+}
+
+void Column_state::bind(ur_template_t const *tmplt)
+{
+   in_tmplt = tmplt;
+   generation = input_template_generation();
+   for (auto &col: columns) {
+      col.step.src_offset = tmplt->offset[col.id];
+   }
+   src_time_first = tmplt->offset[F_TIME_FIRST];
+   src_time_last = tmplt->offset[F_TIME_LAST];
+}
+
+uint32_t Column_state::find_or_insert(Key const &key, ur_template_t const *tmplt, void const *rec, bool &created)
+{
+   uint32_t slot = count.size();
+   std::pair<std::unordered_map<Key, uint32_t>::iterator, bool> inserted = slots.insert(std::make_pair(key, slot));
+
+   created = inserted.second;
+   if (!created) {
+      return inserted.first->second;
+   }
+   if (!is_bound(tmplt)) {
+      bind(tmplt);
+   }
+   char const *src = static_cast<char const*>(rec);
+
+   // Same initial values as Agg::init_record_data
+   keys.insert(keys.end(), key.get_data(), key.get_data() + key.get_size());
+   count.push_back(1);
+   time_first.push_back(*(F_TIME_FIRST_T const*) (src + src_time_first));
+   time_last.push_back(*(F_TIME_LAST_T const*) (src + src_time_last));
+   for (auto &col: columns) {
+      char const *value = src + col.step.src_offset;
+
+      col.data.insert(col.data.end(), value, value + col.size);
+   }
+   return slot;
+}
+
+void Column_state::update(uint32_t slot, ur_template_t const *tmplt, void const *rec)
+{
+   if (!is_bound(tmplt)) {
+      bind(tmplt);
+   }
+   char const *src = static_cast<char const*>(rec);
+
+   count[slot]++;
+   F_TIME_FIRST_T first = *(F_TIME_FIRST_T const*) (src + src_time_first);
+   if (first < time_first[slot])
+      time_first[slot] = first;
+   F_TIME_LAST_T last = *(F_TIME_LAST_T const*) (src + src_time_last);
+   if (last > time_last[slot])
+      time_last[slot] = last;
+
+   for (auto &col: columns) {
+      Update_plan::apply_step(col.step, src + col.step.src_offset, &col.data[slot * col.size], out_tmplt);
+   }
+}
+
+/**
+ * \brief Divide whole column, same as make_avg and make_rate for every value.
+ * \param[in,out] *data values of column.
+ * \param[in] *div divider of every value, zero sets value to zero.
+ * \param[in] n number of values.
+ */
+template <typename T>
+static void divide_column(char *data, uint32_t const *div, size_t n)
+{
+   T *values = reinterpret_cast<T*>(data);
+
+   for (size_t i = 0; i < n; i++) {
+      values[i] = div[i] != 0 ? values[i] / div[i] : 0;
+   }
+}
+
+void Column_state::finish(void)
+{
+   size_t n = size();
+   bool need_duration = false;
+
+   for (auto const &col: columns) {
+      need_duration = need_duration || col.rate;
+   }
+   if (need_duration) {
+      duration.resize(n);
+      for (size_t i = 0; i < n; i++) {
+         duration[i] = ur_timediff(time_last[i], time_first[i]) / 1000;
+      }
+   }
+
+   for (auto &col: columns) {
+      if (!col.avg && !col.rate) {
+         continue;
+      }
+      uint32_t const *div = col.avg ? count.data() : duration.data();
+      char *data = col.data.data();
+
+      switch (col.step.type) {
+      case Update_plan::TYPE_I8:
+         divide_column<int8_t>(data, div, n);
+         break;
+      case Update_plan::TYPE_I16:
+         divide_column<int16_t>(data, div, n);
+         break;
+      case Update_plan::TYPE_I32:
+         divide_column<int32_t>(data, div, n);
+         break;
+      case Update_plan::TYPE_I64:
+         divide_column<int64_t>(data, div, n);
+         break;
+      case Update_plan::TYPE_U8:
+         divide_column<uint8_t>(data, div, n);
+         break;
+      case Update_plan::TYPE_U16:
+         divide_column<uint16_t>(data, div, n);
+         break;
+      case Update_plan::TYPE_U32:
+         divide_column<uint32_t>(data, div, n);
+         break;
+      case Update_plan::TYPE_U64:
+         divide_column<uint64_t>(data, div, n);
+         break;
+      case Update_plan::TYPE_FLOAT:
+         divide_column<float>(data, div, n);
+         break;
+      case Update_plan::TYPE_DOUBLE:
+         divide_column<double>(data, div, n);
+         break;
+      case Update_plan::TYPE_CHAR:
+         divide_column<char>(data, div, n);
+         break;
+      case Update_plan::TYPE_OTHER:
+         for (size_t i = 0; i < n; i++) {
+            col.post(data + i * col.size, div[i]);
+         }
+         break;
+      }
+   }
+}
+
+void Column_state::materialize(uint32_t slot, void *out_rec) const
+{
+   char *dst = static_cast<char*>(out_rec);
+   char const *key = &keys[slot * key_tmplt->key_size];
+
+   for (uint i = 0; i < key_tmplt->used_fields; i++) {
+      int id = key_tmplt->indexes_to_record[i];
+      int size = ur_get_size(id);
+
+      memcpy(ur_get_ptr_by_id(out_tmplt, out_rec, id), key, size);
+      key += size;
+   }
+   ur_set(out_tmplt, out_rec, F_COUNT, count[slot]);
+   ur_set(out_tmplt, out_rec, F_TIME_FIRST, time_first[slot]);
+   ur_set(out_tmplt, out_rec, F_TIME_LAST, time_last[slot]);
+   for (auto const &col: columns) {
+      memcpy(dst + col.dst_offset, &col.data[slot * col.size], col.size);
+   }
+}
+
+void Column_state::clear(void)
+{
+   slots.clear();
+   keys.clear();
+   count.clear();
+   time_first.clear();
+   time_last.clear();
+   for (auto &col: columns) {
+      col.data.clear();
+   }
+}
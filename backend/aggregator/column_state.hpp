@@ -0,0 +1,126 @@
+/**
+ * \file column_state.hpp
+ * \brief Aggregated records of Agg stored by columns.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#if !defined(COLUMN_STATE_H)
+#define COLUMN_STATE_H
+
+#include "key.h"
+#include "output.hpp"
+#include "update_plan.hpp"
+#include "../template_generation.hpp"
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include <unirec/unirec.h>
+
+/**
+ * \brief Storage of Agg where every aggregated field has its own typed array indexed by slot of group.
+ * \details Slot of group is found by key once, aggregation then writes only to columns,
+ *    so post-processing of average and rate runs as plain loops over whole columns.
+ *    Records in output template are created only when groups are sent.
+ *    Only fixed-length fields without COUNT_DISTINCT are supported.
+ */
+class Column_state
+{
+   /**
+    * \brief Values of one aggregated field for all groups.
+    */
+   struct Column {
+      int id;                       ///< UniRec ID of field.
+      int size;                     ///< Size of one value in bytes.
+      uint16_t dst_offset;          ///< Offset of field in output template.
+      bool avg;                     ///< If field is average.
+      bool rate;                    ///< If field is rate.
+      final_avg post;               ///< Post-processing function of average or rate.
+      Update_plan::Step step;       ///< Aggregation of values, src_offset for current input template.
+      std::vector<char> data;       ///< Values, size bytes per slot.
+   };
+
+   std::unordered_map<Key, uint32_t> slots; ///< Slot of every group.
+   std::vector<Column> columns;             ///< Aggregated fields.
+   std::vector<char> keys;                  ///< Key of every slot, key_size bytes each.
+   std::vector<uint32_t> count;             ///< COUNT of every slot.
+   std::vector<uint64_t> time_first;        ///< TIME_FIRST of every slot.
+   std::vector<uint64_t> time_last;         ///< TIME_LAST of every slot.
+   std::vector<uint32_t> duration;          ///< Scratch of finish(): TIME_LAST - TIME_FIRST in seconds.
+   KeyTemplate const *key_tmplt = NULL;     ///< Fields of key.
+   ur_template_t *out_tmplt = NULL;         ///< Template of output records.
+   ur_template_t const *in_tmplt = NULL;    ///< Template which src_offset of columns is set for.
+   uint32_t generation = 0;                 ///< Generation of input template which src_offset is set for.
+   uint16_t src_time_first = 0;             ///< Offset of TIME_FIRST in received record.
+   uint16_t src_time_last = 0;              ///< Offset of TIME_LAST in received record.
+
+   /**
+    * \brief Set offsets of received records when their template changes.
+    */
+   void bind(ur_template_t const *tmplt);
+
+   /**
+    * \return true if offsets are set for template, also after its change at the same address.
+    */
+   bool is_bound(ur_template_t const *tmplt) const
+   {
+      return tmplt == in_tmplt && generation == input_template_generation().load(std::memory_order_relaxed);
+   }
+
+public:
+
+   /**
+    * \brief Prepare columns for fields of output template.
+    * \param[in] &out output template with agg functions.
+    * \param[in] &key fields of key.
+    * \return 0 on success, -1 if some field cannot be stored in column.
+    */
+   int init(OutputTemplate const &out, KeyTemplate const &key);
+
+   /**
+    * \brief Find slot of group, new slot is initialized from received record.
+    * \param[in] &key key of received record.
+    * \param[in] *tmplt template of received record.
+    * \param[in] *rec received record.
+    * \param[out] &created true if group is new, record is already stored then.
+    * \return slot of group.
+    */
+   uint32_t find_or_insert(Key const &key, ur_template_t const *tmplt, void const *rec, bool &created);
+
+   /**
+    * \brief Aggregate received record into slot.
+    * \param[in] slot slot of group.
+    * \param[in] *tmplt template of received record.
+    * \param[in] *rec received record.
+    */
+   void update(uint32_t slot, ur_template_t const *tmplt, void const *rec);
+
+   /**
+    * \brief Finish average and rate of all groups. Call once before groups are materialized.
+    */
+   void finish(void);
+
+   /**
+    * \brief Write group into record of output template.
+    * \param[in] slot slot of group.
+    * \param[out] *out_rec record of output template.
+    */
+   void materialize(uint32_t slot, void *out_rec) const;
+
+   /**
+    * \return number of groups.
+    */
+   size_t size(void) const
+   {
+      return count.size();
+   }
+
+   /**
+    * \brief Remove all groups, memory of columns is kept for next window.
+    */
+   void clear(void);
+};
+
+#endif /* column_state_h */
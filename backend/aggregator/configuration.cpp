@@ -44,7 +44,11 @@
 #include "configuration.hpp"
 #include "../unirec_template.hpp"
 
-Config::Config() : used_fields(0), timeout_type(TIMEOUT_ACTIVE), variable_flag(false)
+Config::Config() : used_fields(0), timeout_type(TIMEOUT_ACTIVE), variable_flag(false),
+   event_time_flag(false), lateness(0), combiner_workers(0), combiner_size(0),
+   columnar_flag(false), quota(0), global_quota(0), evict_policy(EVICT_OLDEST),
+   admission_fraction(0), sketch_width(DEFAULT_SKETCH_WIDTH), other_aggregates_read(false),
+   checkpointed_flag(false)
 {
    for (int i = 0; i < TIMEOUT_TYPES_COUNT; i++) {
       timeout[i] = DEFAULT_TIMEOUT;
@@ -938,6 +942,163 @@ void Config::set_timeout(const char *input)
    delete [] definition;
 }
 
+void Config::set_event_time(const char *input)
+{
+   int value = atoi(input);
+   if (value < 0) {
+      fprintf(stderr, "Lateness %d is not >= 0, using 0.\n", value);
+      value = 0;
+   }
+   lateness = value;
+   event_time_flag = true;
+}
+
+bool Config::is_event_time()
+{
+   return event_time_flag;
+}
+
+int Config::get_lateness()
+{
+   return lateness;
+}
+
+void Config::set_combiners(const char *input)
+{
+   int workers = 0;
+   int size = 0;
+   if (sscanf(input, "%d:%d", &workers, &size) != 2 || workers <= 0 || size <= 0) {
+      fprintf(stderr, "Pre-aggregation %s is not in format threads:slots, skipped.\n", input);
+      return;
+   }
+   combiner_workers = workers;
+   combiner_size = size;
+}
+
+int Config::get_combiner_workers()
+{
+   return combiner_workers;
+}
+
+int Config::get_combiner_size()
+{
+   return combiner_size;
+}
+
+void Config::set_columnar(bool flag)
+{
+   columnar_flag = flag;
+}
+
+bool Config::is_columnar()
+{
+   return columnar_flag;
+}
+
+void Config::set_quota(const char *input)
+{
+   int value = atoi(input);
+   if (value <= 0) {
+      fprintf(stderr, "Memory limit %s is not > 0, skipped.\n", input);
+      return;
+   }
+   quota = value;
+}
+
+void Config::set_global_quota(const char *input)
+{
+   int value = atoi(input);
+   if (value <= 0) {
+      fprintf(stderr, "Memory limit %s is not > 0, skipped.\n", input);
+      return;
+   }
+   global_quota = value;
+}
+
+int Config::get_quota()
+{
+   return quota;
+}
+
+int Config::get_global_quota()
+{
+   return global_quota;
+}
+
+void Config::set_evict_policy(const char *input)
+{
+   if (strcmp(input, "oldest") == 0) {
+      evict_policy = EVICT_OLDEST;
+   }
+   else if (strcmp(input, "lru") == 0) {
+      evict_policy = EVICT_LRU;
+   }
+   else if (strcmp(input, "smallest") == 0) {
+      evict_policy = EVICT_SMALLEST;
+   }
+   else {
+      fprintf(stderr, "Eviction policy %s is not oldest, lru or smallest, using oldest.\n", input);
+      evict_policy = EVICT_OLDEST;
+   }
+}
+
+int Config::get_evict_policy()
+{
+   return evict_policy;
+}
+
+void Config::set_admission(const char *input)
+{
+   double fraction = 0;
+   int width = DEFAULT_SKETCH_WIDTH;
+   if (sscanf(input, "%lf:%d", &fraction, &width) < 1 || fraction <= 0 || fraction > 1 || width <= 0) {
+      fprintf(stderr, "Admission %s is not in format fraction[:width] with fraction from (0, 1], skipped.\n", input);
+      return;
+   }
+   admission_fraction = fraction;
+   sketch_width = width;
+}
+
+double Config::get_admission_fraction()
+{
+   return admission_fraction;
+}
+
+int Config::get_sketch_width()
+{
+   return sketch_width;
+}
+
+void Config::set_other_aggregates_read(bool flag)
+{
+   other_aggregates_read = flag;
+}
+
+bool Config::is_other_aggregates_read()
+{
+   return other_aggregates_read;
+}
+
+void Config::set_spill_dir(const char *input)
+{
+   spill_dir = input;
+}
+
+std::string const& Config::get_spill_dir()
+{
+   return spill_dir;
+}
+
+void Config::set_checkpointed(bool flag)
+{
+   checkpointed_flag = flag;
+}
+
+bool Config::is_checkpointed()
+{
+   return checkpointed_flag;
+}
+
 /**
  *
  * @return string which defines ur_template from user input, has to be freed manually
@@ -973,6 +1134,27 @@ void Config::print()
    else {
       printf("Timeout: %d\n", timeout[timeout_type]);
    }
+   if (event_time_flag) {
+      printf("Event time, lateness: %d\n", lateness);
+   }
+   if (combiner_workers > 0) {
+      printf("Pre-aggregation: %d threads, %d slots\n", combiner_workers, combiner_size);
+   }
+   if (columnar_flag) {
+      printf("Columnar state\n");
+   }
+   if (quota > 0 || global_quota > 0) {
+      printf("Memory limit: %d MiB, all aggregators: %d MiB, eviction policy: %d\n", quota, global_quota, evict_policy);
+   }
+   if (admission_fraction > 0) {
+      printf("Admission: %g of group filter threshold, sketch width %d\n", admission_fraction, sketch_width);
+   }
+   if (!spill_dir.empty()) {
+      printf("Spill directory: %s\n", spill_dir.c_str());
+   }
+   if (checkpointed_flag) {
+      printf("Checkpointed\n");
+   }
 
    printf("Fields:\n");
    for (int i = 0; i < used_fields; i++) {
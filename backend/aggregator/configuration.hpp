@@ -82,11 +82,22 @@
 /** Different timeout types count value definition.*/
 #define TIMEOUT_TYPES_COUNT      3        // Count of different timeout types (active_passive dont use new type)
 
+/** Eviction policy value defining early emit of group with the oldest TIME_FIRST.*/
+#define EVICT_OLDEST             0
+/** Eviction policy value defining early emit of least recently updated group (the oldest TIME_LAST).*/
+#define EVICT_LRU                1
+/** Eviction policy value defining drop of group with the smallest COUNT.*/
+#define EVICT_SMALLEST           2
+
+/** Default number of counters in one row of admission sketch.*/
+#define DEFAULT_SKETCH_WIDTH     65536
+
 /** Static fields used by modules definitions.*/
 #define STATIC_FIELDS "TIME_FIRST,TIME_LAST,COUNT"
 
 #include "key.h"
 #include "output.hpp"
+#include <string>
 /**
  * Simply class to create/hold configuration from user input.
  */
@@ -99,6 +110,19 @@ private:
    int timeout[TIMEOUT_TYPES_COUNT];     /*!< Lengths of various timeouts. */
    int timeout_type;                     /*!< Currently active timeout type to use. */
    bool variable_flag;                   /*!< Flag if variable length field presented to proccess. */
+   bool event_time_flag;                 /*!< Flag if timeouts are driven by time of records. */
+   int lateness;                         /*!< Allowed lateness of records in event-time mode. */
+   int combiner_workers;                 /*!< Number of ingest threads with own pre-aggregation table. */
+   int combiner_size;                    /*!< Number of slots in pre-aggregation table of one thread. */
+   bool columnar_flag;                   /*!< Flag if aggregated fields are stored in columns. */
+   int quota;                            /*!< Memory limit of stored groups of this aggregator in MiB, 0 if not set. */
+   int global_quota;                     /*!< Memory limit of stored groups of all aggregators in MiB, 0 if not set. */
+   int evict_policy;                     /*!< Which group is evicted when memory limit is reached. */
+   double admission_fraction;            /*!< Part of group filter threshold which admits key to storage, 0 if not set. */
+   int sketch_width;                     /*!< Number of counters in one row of admission sketch. */
+   bool other_aggregates_read;           /*!< Flag if successors read more aggregated fields than one COUNT or sum. */
+   std::string spill_dir;                /*!< Directory of run files of groups evicted to disk, empty if not set. */
+   bool checkpointed_flag;               /*!< Flag if state is saved to checkpoints. */
    /**
     * Compare new field with fields already set in cofiguration.
     * @param [in] field_name to compare with others
@@ -204,6 +228,120 @@ public:
      * @param [in] input string defining module timeout configuration.
      */
    void set_timeout(const char *input);
+    /**
+     * Switch timeouts to event time with given allowed lateness from user input.
+     * @param [in] input string with lateness of records in seconds.
+     */
+   void set_event_time(const char *input);
+    /**
+     * Get information whether timeouts are driven by time of records instead of wall clock.
+     * @return True if event-time mode is set, False otherwise.
+     */
+   bool is_event_time();
+    /**
+     * Get allowed lateness of records in event-time mode.
+     * @return Lateness in seconds.
+     */
+   int get_lateness();
+    /**
+     * Set per-thread pre-aggregation from user input.
+     * @param [in] input string "threads:slots" with number of ingest threads and size of their tables.
+     */
+   void set_combiners(const char *input);
+    /**
+     * Get number of ingest threads with own pre-aggregation table.
+     * @return Number of threads, 0 if pre-aggregation is not set.
+     */
+   int get_combiner_workers();
+    /**
+     * Get number of slots in pre-aggregation table of one thread.
+     * @return Number of slots.
+     */
+   int get_combiner_size();
+    /**
+     * Set value of columnar_flag to true or false.
+     * @param [in] flag value of true or false to be set to class variable.
+     */
+   void set_columnar(bool flag);
+    /**
+     * Get information whether aggregated fields should be stored in typed columns instead of records.
+     * @return True if columnar state is requested, False otherwise.
+     */
+   bool is_columnar();
+    /**
+     * Set memory limit of this aggregator from user input.
+     * @param [in] input string with limit in MiB.
+     */
+   void set_quota(const char *input);
+    /**
+     * Set memory limit shared by all aggregators from user input.
+     * @param [in] input string with limit in MiB.
+     */
+   void set_global_quota(const char *input);
+    /**
+     * Get memory limit of this aggregator.
+     * @return Limit in MiB, 0 if not set.
+     */
+   int get_quota();
+    /**
+     * Get memory limit shared by all aggregators.
+     * @return Limit in MiB, 0 if not set.
+     */
+   int get_global_quota();
+    /**
+     * Set eviction policy from user input.
+     * @param [in] input string "oldest", "lru" or "smallest".
+     */
+   void set_evict_policy(const char *input);
+    /**
+     * Get eviction policy used when memory limit is reached.
+     * @return EVICT_OLDEST, EVICT_LRU or EVICT_SMALLEST.
+     */
+   int get_evict_policy();
+    /**
+     * Set admission of keys through sketch from user input.
+     * @param [in] input string "fraction" or "fraction:width", fraction of group filter threshold from (0, 1].
+     */
+   void set_admission(const char *input);
+    /**
+     * Get part of group filter threshold which estimated sum of key must reach to be stored.
+     * @return Fraction from (0, 1], 0 if admission is not set.
+     */
+   double get_admission_fraction();
+    /**
+     * Get number of counters in one row of admission sketch.
+     * @return Width of sketch.
+     */
+   int get_sketch_width();
+    /**
+     * Set that successors read more aggregated fields than one COUNT or sum, admission cannot be used then.
+     * @param [in] flag true if they do.
+     */
+   void set_other_aggregates_read(bool flag);
+    /**
+     * @return True if successors read more aggregated fields than one COUNT or sum.
+     */
+   bool is_other_aggregates_read();
+    /**
+     * Set directory where groups evicted by memory limit are spilled instead of sent or dropped.
+     * @param [in] input path to directory.
+     */
+   void set_spill_dir(const char *input);
+    /**
+     * Get directory of spilled groups.
+     * @return Path to directory, empty if groups are not spilled.
+     */
+   std::string const& get_spill_dir();
+    /**
+     * Set if state of aggregator is saved to checkpoints.
+     * @param [in] flag true to save the state.
+     */
+   void set_checkpointed(bool flag);
+    /**
+     * Check if state of aggregator is saved to checkpoints.
+     * @return True if state is saved.
+     */
+   bool is_checkpointed();
     /**
      * Create UniRec output template field definition string from actual module configuration.
      * Received pointer needs to be freed.
@@ -0,0 +1,53 @@
+/**
+ * \file copy_plan.cpp
+ * \brief Definition of Copy_plan class.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#include "copy_plan.hpp"
+#include "../fields.h"
+
+#include <algorithm>
+
+int Copy_plan::build(OutputTemplate const &out, ur_template_t const *tmplt)
+{
+   ur_template_t const *out_tmplt = out.out_tmplt;
+
+   in_tmplt = tmplt;
+   generation = input_template_generation();
+   ready = false;
+   runs.clear();
+
+   for (int i = 0; i < out_tmplt->count; i++) {
+      int id = out_tmplt->ids[i];
+
+      if (!ur_is_present(tmplt, id)) {
+         continue;
+      }
+      if (!ur_is_fixlen(id)) {
+         return -1;
+      }
+      // Set by init_record_data after copy
+      if (id == F_COUNT ||
+          std::find(out.fields_like_ptr, out.fields_like_ptr + out.used_fields_like_ptrs, id) !=
+          out.fields_like_ptr + out.used_fields_like_ptrs) {
+         continue;
+      }
+      runs.push_back({tmplt->offset[id], out_tmplt->offset[id], (uint16_t) ur_get_size(id)});
+   }
+
+   std::sort(runs.begin(), runs.end(), [](Run const &a, Run const &b) { return a.dst_offset < b.dst_offset; });
+   std::vector<Run> joined;
+   for (auto const &run: runs) {
+      if (!joined.empty() && joined.back().dst_offset + joined.back().len == run.dst_offset &&
+          joined.back().src_offset + joined.back().len == run.src_offset) {
+         joined.back().len += run.len;
+      } else {
+         joined.push_back(run);
+      }
+   }
+   runs = joined;
+   ready = true;
+   return 0;
+}
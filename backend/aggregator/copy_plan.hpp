@@ -0,0 +1,83 @@
+/**
+ * \file copy_plan.hpp
+ * \brief Initialization of new stored record with precomputed runs of bytes.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#if !defined(COPY_PLAN_H)
+#define COPY_PLAN_H
+
+#include "output.hpp"
+#include "../template_generation.hpp"
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include <unirec/unirec.h>
+
+/**
+ * \brief Replacement of ur_copy_fields in Agg::init_record_data.
+ * \details ur_copy_fields walks all fields of output template and looks each of them up
+ *    in input template for every new group. The plan does it once per input template:
+ *    fields present in both templates are turned to runs of bytes, neighbouring fields
+ *    which are neighbours in both records are joined to one run. Fields which are
+ *    overwritten after copy (COUNT, pointers of COUNT_DISTINCT) are left out.
+ */
+class Copy_plan
+{
+   /**
+    * \brief Bytes copied by one memcpy.
+    */
+   struct Run {
+      uint16_t src_offset; ///< Offset in received record.
+      uint16_t dst_offset; ///< Offset in stored record.
+      uint16_t len;        ///< Number of bytes.
+   };
+
+   std::vector<Run> runs;                ///< Runs in order of offsets in stored record.
+   ur_template_t const *in_tmplt = NULL; ///< Input template which the plan was built for.
+   uint32_t generation = 0;              ///< Generation of input template which the plan was built for.
+   bool ready = false;                   ///< If plan is built and can be applied.
+
+public:
+
+   /**
+    * \brief Build plan for output template and template of received records.
+    * \param[in] &out output template.
+    * \param[in] *tmplt template of received records.
+    * \return 0 on success, -1 if plan cannot be used (variable-length fields), ur_copy_fields is needed.
+    */
+   int build(OutputTemplate const &out, ur_template_t const *tmplt);
+
+   /**
+    * \return true if the plan was built for template of received records, also after its change.
+    */
+   bool is_built_for(ur_template_t const *tmplt) const
+   {
+      return tmplt == in_tmplt && generation == input_template_generation().load(std::memory_order_relaxed);
+   }
+
+   /**
+    * \return true if plan is built and can be applied.
+    */
+   bool is_ready(void) const
+   {
+      return ready;
+   }
+
+   /**
+    * \brief Copy fields of received record to new stored record.
+    * \param[in] *src received record in template of build().
+    * \param[out] *dst stored record.
+    */
+   void apply(void const *src, void *dst) const
+   {
+      for (auto const &run: runs) {
+         memcpy((char*) dst + run.dst_offset, (char const*) src + run.src_offset, run.len);
+      }
+   }
+};
+
+#endif /* copy_plan_h */
@@ -0,0 +1,50 @@
+/**
+ * \file count_min.cpp
+ * \brief Definition of Count_min class.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#include "count_min.hpp"
+
+#include <algorithm>
+#include <math.h>
+
+void Count_min::init(size_t w)
+{
+   width = w;
+   counters.assign(COUNT_MIN_DEPTH * width, 0);
+   total = 0;
+}
+
+uint64_t Count_min::add(uint32_t hash, uint64_t value)
+{
+   // Second hash for double hashing, odd so rows differ
+   uint32_t step = ((hash >> 16) | (hash << 16)) * 2654435761U | 1;
+   uint64_t estimate = UINT64_MAX;
+
+   total += value;
+   for (int row = 0; row < COUNT_MIN_DEPTH; row++) {
+      uint64_t &counter = counters[row * width + (hash + row * step) % width];
+
+      counter += value;
+      estimate = std::min(estimate, counter);
+   }
+   return estimate;
+}
+
+double Count_min::get_epsilon(void) const
+{
+   return M_E / width;
+}
+
+double Count_min::get_delta(void) const
+{
+   return exp(-COUNT_MIN_DEPTH);
+}
+
+void Count_min::clear(void)
+{
+   std::fill(counters.begin(), counters.end(), 0);
+   total = 0;
+}
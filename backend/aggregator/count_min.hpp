@@ -0,0 +1,80 @@
+/**
+ * \file count_min.hpp
+ * \brief Count-min sketch for admission of keys to Agg storage.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#if !defined(COUNT_MIN_H)
+#define COUNT_MIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/** Number of rows (hash functions) of sketch. */
+#define COUNT_MIN_DEPTH 4
+
+/**
+ * \brief Approximate sums per key in fixed memory.
+ * \details Every key updates one counter in each of COUNT_MIN_DEPTH rows, estimate is
+ *    the minimum of them, so it never underestimates. With width w and depth d
+ *    the estimate exceeds the true sum by more than e / w * total
+ *    with probability at most e^-d, where total is the sum of all added values.
+ *    Row positions are derived from one 32 bit hash of key by double hashing.
+ */
+class Count_min
+{
+   std::vector<uint64_t> counters;   ///< COUNT_MIN_DEPTH rows of width counters.
+   size_t width = 0;                 ///< Counters in one row.
+   uint64_t total = 0;               ///< Sum of all added values since last clear.
+
+public:
+
+   /**
+    * \brief Allocate sketch.
+    * \param[in] w number of counters in one row.
+    */
+   void init(size_t w);
+
+   /**
+    * \brief Add value to key and estimate sum of key.
+    * \param[in] hash hash of key.
+    * \param[in] value value to add.
+    * \return estimated sum of key including value.
+    */
+   uint64_t add(uint32_t hash, uint64_t value);
+
+   /**
+    * \return sum of all added values since last clear.
+    */
+   uint64_t get_total(void) const
+   {
+      return total;
+   }
+
+   /**
+    * \return relative error e / width of estimates.
+    */
+   double get_epsilon(void) const;
+
+   /**
+    * \return probability e^-depth that estimate exceeds the error.
+    */
+   double get_delta(void) const;
+
+   /**
+    * \return number of counters in one row.
+    */
+   size_t get_width(void) const
+   {
+      return width;
+   }
+
+   /**
+    * \brief Set all counters to zero, at the end of window.
+    */
+   void clear(void);
+};
+
+#endif /* count_min_h */
@@ -0,0 +1,73 @@
+/**
+ * \file group_view.cpp
+ * \brief Definition of Group_view class.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#include "group_view.hpp"
+#include "../fields.h"
+
+#include <string.h>
+
+/**
+ * \brief Dealloc function which keeps the set, make function then only counts its size.
+ */
+static void keep_container(void * /* container */ )
+{
+}
+
+void Group_view::init(OutputTemplate const &out_tmplt)
+{
+   out = &out_tmplt;
+   fields.clear();
+
+   auto set = [this](int id, field_kind kind, int index) {
+      if ((size_t) id >= fields.size()) {
+         fields.resize(id + 1, Field{KIND_RECORD, -1});
+      }
+      fields[id] = Field{kind, index};
+   };
+
+   for (int i = 0; i < out->used_fields; i++) {
+      if (out->avg_fields[i] != NULL) {
+         set(out->indexes_to_record[i], KIND_AVG, i);
+      } else if (out->rate_fields[i] != NULL) {
+         set(out->indexes_to_record[i], KIND_RATE, i);
+      }
+   }
+   for (int i = 0; i < out->used_fields_like_ptrs; i++) {
+      set(out->fields_like_ptr[i], KIND_DISTINCT, i);
+   }
+}
+
+char const* Group_view::value(void const *rec, int id, uint64_t *buf) const
+{
+   if (id < 0 || (size_t) id >= fields.size() || fields[id].kind == KIND_RECORD) {
+      return NULL;
+   }
+   Field const &field = fields[id];
+   ur_template_t *tmplt = out->out_tmplt;
+   void const *stored = ur_get_ptr_by_id(tmplt, rec, id);
+
+   switch (field.kind) {
+   case KIND_AVG:
+      memcpy(buf, stored, ur_get_size(id));
+      out->avg_fields[field.index](buf, ur_get(tmplt, rec, F_COUNT));
+      break;
+   case KIND_RATE: {
+      ur_time_t first = ur_get(tmplt, rec, F_TIME_FIRST);
+      ur_time_t last = ur_get(tmplt, rec, F_TIME_LAST);
+
+      memcpy(buf, stored, ur_get_size(id));
+      out->rate_fields[field.index](buf, ur_timediff(last, first) / 1000);
+      break;
+   }
+   case KIND_DISTINCT:
+      out->make_fields[field.index]((void*) (*(uint64_t const*) stored), buf, keep_container);
+      break;
+   case KIND_RECORD:
+      return NULL;
+   }
+   return (char const*) buf;
+}
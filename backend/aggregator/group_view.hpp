@@ -0,0 +1,62 @@
+/**
+ * \file group_view.hpp
+ * \brief Final values of stored records of Agg for group filter.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#if !defined(GROUP_VIEW_H)
+#define GROUP_VIEW_H
+
+#include "output.hpp"
+#include "../filter/filter.hpp"
+
+#include <stdint.h>
+#include <vector>
+
+/**
+ * \brief Computes average, rate and count distinct of stored record without modifying it.
+ * \details Group filter evaluated through this view sees the same values as in sent record,
+ *    so groups which do not pass are dropped before Agg::prepare_to_send.
+ *    Other fields are read from stored record directly.
+ */
+class Group_view: public Field_source
+{
+   /** How value of field is obtained. */
+   enum field_kind {
+      KIND_RECORD,   ///< Value is stored in record.
+      KIND_AVG,      ///< Sum divided by COUNT.
+      KIND_RATE,     ///< Sum divided by duration in seconds.
+      KIND_DISTINCT  ///< Size of set of values.
+   };
+
+   /**
+    * \brief Access to one field.
+    */
+   struct Field {
+      field_kind kind;  ///< How value is obtained.
+      int index;        ///< Index of field in OutputTemplate arrays.
+   };
+
+   std::vector<Field> fields;            ///< Access to field by its UniRec ID.
+   OutputTemplate const *out = NULL;     ///< Template of stored records.
+
+public:
+
+   /**
+    * \brief Prepare access to fields of stored records.
+    * \param[in] &out_tmplt output template of Agg with final functions.
+    */
+   void init(OutputTemplate const &out_tmplt);
+
+   /**
+    * \brief Compute final value of field of stored record.
+    * \param[in] *rec stored record.
+    * \param[in] id UniRec ID of field.
+    * \param[out] *buf buffer for computed value.
+    * \return pointer to value, NULL if value is read from record.
+    */
+   char const* value(void const *rec, int id, uint64_t *buf) const;
+};
+
+#endif /* group_view_h */
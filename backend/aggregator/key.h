@@ -44,6 +44,7 @@
 #include <nemea-common/super_fast_hash.h>
 
 #include <unirec/unirec.h>
+#include <functional>
 
 #ifndef AGGREGATOR_KEYWORD_H
 #define AGGREGATOR_KEYWORD_H
@@ -126,4 +127,21 @@ public:
    friend bool operator== (const Key &a, const Key &b);  // Key needs to be comparable for the unordered_map
 };
 
+/* ----------------------------------------------------------------- */
+namespace std {
+   /**
+    * std::hash() specialization to use with class Key.
+    * Specialization needed by use class Key as key in std::unordered_map
+    */
+    template<>
+    struct hash<Key>
+    {
+        size_t operator()(const Key &k) const
+        {
+           return SuperFastHash(k.get_data(), k.get_size());
+        }
+    };
+}
+/* ----------------------------------------------------------------- */
+
 #endif //AGGREGATOR_KEYWORD_H
@@ -0,0 +1,132 @@
+/**
+ * \file spill_file.cpp
+ * \brief Definition of Spill_file class.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#include "spill_file.hpp"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+Spill_file::~Spill_file()
+{
+   if (fd >= 0) {
+      close(fd);
+   }
+}
+
+int Spill_file::open(std::string const &dir, size_t key_bytes, size_t rec_bytes)
+{
+   std::string path = dir + "/policer_spill_XXXXXX";
+   std::vector<char> name(path.begin(), path.end());
+   name.push_back('\0');
+
+   fd = mkstemp(name.data());
+   if (fd < 0) {
+      fprintf(stderr, "Error: cannot create spill file in %s: %s\n", dir.c_str(), strerror(errno));
+      return -1;
+   }
+   // Nobody else needs the name, space is released when descriptor is closed
+   unlink(name.data());
+
+   key_size = key_bytes;
+   entry_size = key_bytes + rec_bytes;
+   partitions.resize(SPILL_PARTITIONS);
+   for (auto &part : partitions) {
+      part.buffer.reserve(SPILL_BUFFER);
+   }
+   return 0;
+}
+
+int Spill_file::write_buffer(Partition &part)
+{
+   size_t done = 0;
+
+   while (done < part.buffer.size()) {
+      ssize_t ret = pwrite(fd, part.buffer.data() + done, part.buffer.size() - done, file_size + done);
+      if (ret < 0) {
+         if (errno == EINTR)
+            continue;
+         fprintf(stderr, "Error: cannot write spill file: %s\n", strerror(errno));
+         return -1;
+      }
+      done += ret;
+   }
+   part.runs.push_back(Run{file_size, done});
+   file_size += done;
+   part.buffer.clear();
+   return 0;
+}
+
+int Spill_file::append(uint32_t hash, char const *key, void const *rec)
+{
+   Partition &part = partitions[hash % SPILL_PARTITIONS];
+
+   if (part.buffer.size() + entry_size > SPILL_BUFFER && !part.buffer.empty()) {
+      if (write_buffer(part) != 0)
+         return -1;
+   }
+   part.buffer.insert(part.buffer.end(), key, key + key_size);
+   part.buffer.insert(part.buffer.end(), (char const*) rec, (char const*) rec + entry_size - key_size);
+   entries++;
+   return 0;
+}
+
+int Spill_file::read(std::function<void(void)> begin, std::function<void(char const*, void const*)> entry,
+                     std::function<void(void)> end)
+{
+   if (entries == 0) {
+      return 0;
+   }
+
+   char *mapped = NULL;
+   if (file_size > 0) {
+      mapped = (char*) mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapped == MAP_FAILED) {
+         fprintf(stderr, "Error: cannot map spill file: %s\n", strerror(errno));
+         return -1;
+      }
+      madvise(mapped, file_size, MADV_SEQUENTIAL);
+   }
+
+   for (auto &part : partitions) {
+      if (part.runs.empty() && part.buffer.empty())
+         continue;
+      begin();
+      for (auto &run : part.runs) {
+         for (size_t pos = 0; pos + entry_size <= run.size; pos += entry_size) {
+            char const *ptr = mapped + run.offset + pos;
+            entry(ptr, ptr + key_size);
+         }
+      }
+      for (size_t pos = 0; pos + entry_size <= part.buffer.size(); pos += entry_size) {
+         char const *ptr = part.buffer.data() + pos;
+         entry(ptr, ptr + key_size);
+      }
+      end();
+   }
+
+   if (mapped != NULL) {
+      munmap(mapped, file_size);
+   }
+   return 0;
+}
+
+void Spill_file::clear(void)
+{
+   for (auto &part : partitions) {
+      part.buffer.clear();
+      part.runs.clear();
+   }
+   if (file_size > 0 && ftruncate(fd, 0) != 0) {
+      fprintf(stderr, "Warning: cannot truncate spill file: %s\n", strerror(errno));
+   }
+   file_size = 0;
+   entries = 0;
+}
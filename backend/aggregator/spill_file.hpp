@@ -0,0 +1,107 @@
+/**
+ * \file spill_file.hpp
+ * \brief Run file of groups evicted from Agg storage to disk.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#if !defined(SPILL_FILE_H)
+#define SPILL_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+/** Number of partitions of run file, groups with the same key are always in the same one. */
+#define SPILL_PARTITIONS 64
+/** Bytes buffered for every partition before they are appended to run file. */
+#define SPILL_BUFFER (64 * 1024)
+
+/**
+ * \brief Append-only file of fixed-size entries (key followed by record) split to partitions by hash of key.
+ * \details Every partition buffers its entries and appends them to the file as one run,
+ *    so writes are sequential. Reading maps the whole file to memory and walks runs of one
+ *    partition after another, so only groups of one partition need to be merged in memory at once.
+ *    File is unlinked right after it is created, it disappears when module ends.
+ */
+class Spill_file
+{
+   /** Position of one run of partition in file. */
+   struct Run {
+      off_t offset;   ///< Offset of the first entry.
+      size_t size;    ///< Bytes of entries.
+   };
+
+   /** Entries of one partition. */
+   struct Partition {
+      std::vector<char> buffer;   ///< Entries not written to file yet.
+      std::vector<Run> runs;      ///< Entries already written.
+   };
+
+   int fd = -1;                   ///< Descriptor of run file, -1 if not opened.
+   size_t key_size = 0;           ///< Bytes of key of entry.
+   size_t entry_size = 0;         ///< Bytes of key and record of entry.
+   off_t file_size = 0;           ///< Bytes written to file.
+   uint64_t entries = 0;          ///< Entries since last clear.
+   std::vector<Partition> partitions;
+
+   int write_buffer(Partition &part);
+
+public:
+
+   ~Spill_file();
+
+   /**
+    * \brief Create run file.
+    * \param[in] dir directory of file.
+    * \param[in] key_bytes size of key.
+    * \param[in] rec_bytes size of fixed-length record.
+    * \return 0 on success, -1 if file cannot be created.
+    */
+   int open(std::string const &dir, size_t key_bytes, size_t rec_bytes);
+
+   /**
+    * \brief Append group to its partition.
+    * \param[in] hash hash of key.
+    * \param[in] key key data of key_bytes.
+    * \param[in] rec record data of rec_bytes.
+    * \return 0 on success, -1 on write error.
+    */
+   int append(uint32_t hash, char const *key, void const *rec);
+
+   /**
+    * \brief Pass all entries to function, one partition after another.
+    * \param[in] begin called before entries of every non-empty partition.
+    * \param[in] entry called with key and record of every entry.
+    * \param[in] end called after entries of every non-empty partition.
+    * \return 0 on success, -1 if file cannot be read.
+    */
+   int read(std::function<void(void)> begin, std::function<void(char const*, void const*)> entry,
+            std::function<void(void)> end);
+
+   /**
+    * \brief Forget all entries and truncate file, at the end of window.
+    */
+   void clear(void);
+
+   /**
+    * \return number of entries since last clear.
+    */
+   uint64_t size(void) const
+   {
+      return entries;
+   }
+
+   /**
+    * \return bytes of entries since last clear.
+    */
+   uint64_t bytes(void) const
+   {
+      return entries * entry_size;
+   }
+};
+
+#endif /* spill_file_h */
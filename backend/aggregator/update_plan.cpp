@@ -0,0 +1,256 @@
+/**
+ * \file update_plan.cpp
+ * \brief Definition of Update_plan class.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#include "update_plan.hpp"
+#include "agg_functions.hpp"
+#include "../fields.h"
+
+/**
+ * \brief Recognize agg function of integer type T.
+ * \return true if function is sum, average, rate, min, max, or, and of type T.
+ */
+template <typename T>
+static bool classify_int(agg_func process, Update_plan::step_type type, Update_plan::step_func &func,
+                         Update_plan::step_type &out_type)
+{
+   if (process == &sum<T> || process == &avg<T> || process == &rate<T>) {
+      func = Update_plan::STEP_SUM;
+   } else if (process == &min<T>) {
+      func = Update_plan::STEP_MIN;
+   } else if (process == &max<T>) {
+      func = Update_plan::STEP_MAX;
+   } else if (process == &bitwise_or<T>) {
+      func = Update_plan::STEP_OR;
+   } else if (process == &bitwise_and<T>) {
+      func = Update_plan::STEP_AND;
+   } else {
+      return false;
+   }
+   out_type = type;
+   return true;
+}
+
+/**
+ * \brief Recognize agg function of floating point type T.
+ * \return true if function is sum, average, rate, min, max of type T.
+ */
+template <typename T>
+static bool classify_float(agg_func process, Update_plan::step_type type, Update_plan::step_func &func,
+                           Update_plan::step_type &out_type)
+{
+   if (process == &sum<T> || process == &avg<T> || process == &rate<T>) {
+      func = Update_plan::STEP_SUM;
+   } else if (process == &min<T>) {
+      func = Update_plan::STEP_MIN;
+   } else if (process == &max<T>) {
+      func = Update_plan::STEP_MAX;
+   } else {
+      return false;
+   }
+   out_type = type;
+   return true;
+}
+
+void Update_plan::classify(agg_func process, Step &step)
+{
+   step.process = process;
+
+   bool known =
+      classify_int<int8_t>(process, TYPE_I8, step.func, step.type) ||
+      classify_int<int16_t>(process, TYPE_I16, step.func, step.type) ||
+      classify_int<int32_t>(process, TYPE_I32, step.func, step.type) ||
+      classify_int<int64_t>(process, TYPE_I64, step.func, step.type) ||
+      classify_int<uint8_t>(process, TYPE_U8, step.func, step.type) ||
+      classify_int<uint16_t>(process, TYPE_U16, step.func, step.type) ||
+      classify_int<uint32_t>(process, TYPE_U32, step.func, step.type) ||
+      classify_int<uint64_t>(process, TYPE_U64, step.func, step.type) ||
+      classify_float<float>(process, TYPE_FLOAT, step.func, step.type) ||
+      classify_float<double>(process, TYPE_DOUBLE, step.func, step.type) ||
+      classify_float<char>(process, TYPE_CHAR, step.func, step.type);
+
+   if (!known) {
+      step.func = STEP_CALL;
+      step.type = TYPE_OTHER;
+   }
+}
+
+int Update_plan::build(OutputTemplate const &out, ur_template_t const *tmplt)
+{
+   in_tmplt = tmplt;
+   generation = input_template_generation();
+   out_tmplt = out.out_tmplt;
+   shape = SHAPE_NONE;
+   steps.clear();
+
+   for (int i = 0; i < out.used_fields; i++) {
+      int id = out.indexes_to_record[i];
+
+      if (!ur_is_fixlen(id)) {
+         return -1;
+      }
+      Step step;
+
+      classify(out.process[i], step);
+      step.src_offset = tmplt->offset[id];
+      step.dst_offset = out_tmplt->offset[id];
+      steps.push_back(step);
+   }
+   src_time_first = tmplt->offset[F_TIME_FIRST];
+   src_time_last = tmplt->offset[F_TIME_LAST];
+   dst_count = out_tmplt->offset[F_COUNT];
+   dst_time_first = out_tmplt->offset[F_TIME_FIRST];
+   dst_time_last = out_tmplt->offset[F_TIME_LAST];
+
+   shape = SHAPE_STEPS;
+   for (step_type type: {TYPE_U32, TYPE_U64}) {
+      bool all = !steps.empty();
+
+      for (auto const &step: steps) {
+         all = all && step.func == STEP_SUM && step.type == type;
+      }
+      if (all) {
+         shape = type == TYPE_U32 ? SHAPE_SUM_U32 : SHAPE_SUM_U64;
+      }
+   }
+   return 0;
+}
+
+/**
+ * \brief Apply integer step.
+ */
+template <typename T>
+static inline void apply_int(Update_plan::step_func func, char const *src, char *dst)
+{
+   T const value = *(T const*) src;
+   T *stored = (T*) dst;
+
+   switch (func) {
+   case Update_plan::STEP_SUM:
+      *stored += value;
+      break;
+   case Update_plan::STEP_MIN:
+      if (value < *stored)
+         *stored = value;
+      break;
+   case Update_plan::STEP_MAX:
+      if (value > *stored)
+         *stored = value;
+      break;
+   case Update_plan::STEP_OR:
+      *stored |= value;
+      break;
+   case Update_plan::STEP_AND:
+      *stored &= value;
+      break;
+   default:
+      break;
+   }
+}
+
+/**
+ * \brief Apply floating point step.
+ */
+template <typename T>
+static inline void apply_float(Update_plan::step_func func, char const *src, char *dst)
+{
+   T const value = *(T const*) src;
+   T *stored = (T*) dst;
+
+   switch (func) {
+   case Update_plan::STEP_SUM:
+      *stored += value;
+      break;
+   case Update_plan::STEP_MIN:
+      if (value < *stored)
+         *stored = value;
+      break;
+   case Update_plan::STEP_MAX:
+      if (value > *stored)
+         *stored = value;
+      break;
+   default:
+      break;
+   }
+}
+
+void Update_plan::apply_step(Step const &step, char const *src, char *dst, ur_template_t *out_tmplt)
+{
+   switch (step.type) {
+   case TYPE_I8:
+      apply_int<int8_t>(step.func, src, dst);
+      break;
+   case TYPE_I16:
+      apply_int<int16_t>(step.func, src, dst);
+      break;
+   case TYPE_I32:
+      apply_int<int32_t>(step.func, src, dst);
+      break;
+   case TYPE_I64:
+      apply_int<int64_t>(step.func, src, dst);
+      break;
+   case TYPE_U8:
+      apply_int<uint8_t>(step.func, src, dst);
+      break;
+   case TYPE_U16:
+      apply_int<uint16_t>(step.func, src, dst);
+      break;
+   case TYPE_U32:
+      apply_int<uint32_t>(step.func, src, dst);
+      break;
+   case TYPE_U64:
+      apply_int<uint64_t>(step.func, src, dst);
+      break;
+   case TYPE_FLOAT:
+      apply_float<float>(step.func, src, dst);
+      break;
+   case TYPE_DOUBLE:
+      apply_float<double>(step.func, src, dst);
+      break;
+   case TYPE_CHAR:
+      apply_float<char>(step.func, src, dst);
+      break;
+   case TYPE_OTHER:
+      step.process(src, dst, out_tmplt);
+      break;
+   }
+}
+
+void Update_plan::apply_steps(char const *src, char *dst) const
+{
+   for (auto const &step: steps) {
+      apply_step(step, src + step.src_offset, dst + step.dst_offset, out_tmplt);
+   }
+}
+
+void Update_plan::apply(void const *src_rec, void *dst_rec) const
+{
+   char const *src = static_cast<char const*>(src_rec);
+   char *dst = static_cast<char*>(dst_rec);
+
+   // Always increase count, TIME_FIRST:min, TIME_LAST:max
+   (*(F_COUNT_T*) (dst + dst_count))++;
+   F_TIME_FIRST_T first = *(F_TIME_FIRST_T const*) (src + src_time_first);
+   if (first < *(F_TIME_FIRST_T*) (dst + dst_time_first))
+      *(F_TIME_FIRST_T*) (dst + dst_time_first) = first;
+   F_TIME_LAST_T last = *(F_TIME_LAST_T const*) (src + src_time_last);
+   if (last > *(F_TIME_LAST_T*) (dst + dst_time_last))
+      *(F_TIME_LAST_T*) (dst + dst_time_last) = last;
+
+   switch (shape) {
+   case SHAPE_SUM_U32:
+      apply_sums<uint32_t>(src, dst);
+      break;
+   case SHAPE_SUM_U64:
+      apply_sums<uint64_t>(src, dst);
+      break;
+   case SHAPE_STEPS:
+      apply_steps(src, dst);
+      break;
+   case SHAPE_NONE:
+      break;
+   }
+}
@@ -0,0 +1,148 @@
+/**
+ * \file update_plan.hpp
+ * \brief Aggregation of record into stored record with precomputed offsets.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#if !defined(UPDATE_PLAN_H)
+#define UPDATE_PLAN_H
+
+#include "output.hpp"
+#include "../template_generation.hpp"
+
+#include <stdint.h>
+#include <vector>
+
+#include <unirec/unirec.h>
+
+/**
+ * \brief Specialized replacement of the loop over agg functions in Agg::process_agg_functions.
+ * \details Functions, types and offsets of aggregated fields are fixed after Agg::init
+ *    (offsets in received records also depend on input template). The plan recognizes
+ *    agg functions by their pointers and applies them inline by type, without calls
+ *    through pointer and without lookup of fields. Common shape where all fields are sums
+ *    of the same type has its own loop. Other fixed-length functions (first, last, IP)
+ *    are called through pointer with precomputed offsets.
+ *    COUNT, TIME_FIRST and TIME_LAST are updated in the same pass.
+ */
+class Update_plan
+{
+public:
+
+   /** Aggregation of one step. */
+   enum step_func {
+      STEP_SUM,     ///< Also average and rate, which sum until record is sent.
+      STEP_MIN,
+      STEP_MAX,
+      STEP_OR,
+      STEP_AND,
+      STEP_CALL     ///< Other function, called through pointer.
+   };
+
+   /** Type of values of one step. */
+   enum step_type {
+      TYPE_I8, TYPE_I16, TYPE_I32, TYPE_I64,
+      TYPE_U8, TYPE_U16, TYPE_U32, TYPE_U64,
+      TYPE_FLOAT, TYPE_DOUBLE, TYPE_CHAR,
+      TYPE_OTHER
+   };
+
+   /**
+    * \brief Precomputed aggregation of one field.
+    */
+   struct Step {
+      step_func func;
+      step_type type;
+      uint16_t src_offset; ///< Offset of field in received record.
+      uint16_t dst_offset; ///< Offset of field in stored record.
+      agg_func process;    ///< STEP_CALL: agg function.
+   };
+
+   /**
+    * \brief Recognize agg function.
+    * \param[in] process agg function of field.
+    * \param[out] &step filled func and type.
+    */
+   static void classify(agg_func process, Step &step);
+
+   /**
+    * \brief Aggregate one value by step, offsets of step are not used.
+    * \param[in] &step function and type of value.
+    * \param[in] *src received value.
+    * \param[in,out] *dst stored value.
+    * \param[in] *out_tmplt template passed to agg function of STEP_CALL.
+    */
+   static void apply_step(Step const &step, char const *src, char *dst, ur_template_t *out_tmplt);
+
+private:
+
+   /** Shape of whole plan. */
+   enum plan_shape {
+      SHAPE_NONE,     ///< Plan is not built, use generic loop.
+      SHAPE_STEPS,    ///< Steps dispatched one by one by function and type.
+      SHAPE_SUM_U32,  ///< All steps are sums of uint32_t.
+      SHAPE_SUM_U64   ///< All steps are sums of uint64_t.
+   };
+
+   std::vector<Step> steps;                ///< Steps in order of output fields.
+   plan_shape shape = SHAPE_NONE;          ///< Shape of plan.
+   ur_template_t const *in_tmplt = NULL;   ///< Input template which the plan was built for.
+   uint32_t generation = 0;                ///< Generation of input template which the plan was built for.
+   ur_template_t *out_tmplt = NULL;        ///< Template of stored records.
+   uint16_t src_time_first = 0;            ///< Offset of TIME_FIRST in received record.
+   uint16_t src_time_last = 0;             ///< Offset of TIME_LAST in received record.
+   uint16_t dst_count = 0;                 ///< Offset of COUNT in stored record.
+   uint16_t dst_time_first = 0;            ///< Offset of TIME_FIRST in stored record.
+   uint16_t dst_time_last = 0;             ///< Offset of TIME_LAST in stored record.
+
+   /**
+    * \brief Apply steps where all of them are sums of type T.
+    */
+   template <typename T> void apply_sums(char const *src, char *dst) const
+   {
+      for (auto const &step: steps) {
+         *(T*) (dst + step.dst_offset) += *(T const*) (src + step.src_offset);
+      }
+   }
+
+   /**
+    * \brief Apply steps one by one.
+    */
+   void apply_steps(char const *src, char *dst) const;
+
+public:
+
+   /**
+    * \brief Build plan for output template and template of received records.
+    * \param[in] &out output template with agg functions of fields.
+    * \param[in] *tmplt template of received records.
+    * \return 0 on success, -1 if plan cannot be used (variable-length fields), generic loop is needed.
+    */
+   int build(OutputTemplate const &out, ur_template_t const *tmplt);
+
+   /**
+    * \return true if the plan was built for template of received records, also after its change.
+    */
+   bool is_built_for(ur_template_t const *tmplt) const
+   {
+      return tmplt == in_tmplt && generation == input_template_generation().load(std::memory_order_relaxed);
+   }
+
+   /**
+    * \return true if plan is built and can be applied.
+    */
+   bool is_ready(void) const
+   {
+      return shape != SHAPE_NONE;
+   }
+
+   /**
+    * \brief Aggregate received record into stored record, same as generic loop of agg functions.
+    * \param[in] *src received record in template of build().
+    * \param[in,out] *dst stored record.
+    */
+   void apply(void const *src, void *dst) const;
+};
+
+#endif /* update_plan_h */
@@ -0,0 +1,149 @@
+/**
+ * \file aot.cpp
+ * \brief Generator of rules compiled ahead of time and access to them.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#include "aot.hpp"
+#include "filter/filter.hpp"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+/* Generated source defines this symbol again and overrides the empty one. */
+Aot_rules const *aot_rules __attribute__((weak)) = NULL;
+
+aot_filter_func aot_find_filter(char const *expression)
+{
+   static std::unordered_map<std::string, aot_filter_func> const filters = []() {
+      std::unordered_map<std::string, aot_filter_func> map;
+
+      if (aot_rules != NULL) {
+         for (size_t i = 0; i < aot_rules->n_filters; i++) {
+            map.emplace(aot_rules->filters[i].expression, aot_rules->filters[i].match);
+         }
+      }
+      return map;
+   }();
+
+   auto it = filters.find(expression);
+   return it == filters.end() ? NULL : it->second;
+}
+
+int aot_load_rules(Rule_cache &cache)
+{
+   if (aot_rules == NULL) {
+      return -1;
+   }
+
+   std::vector<Rule_cache_node> &nodes = cache.get_nodes();
+   nodes.clear();
+   for (size_t i = 0; i < aot_rules->n_nodes; i++) {
+      Rule_cache_node node;
+
+      node.kind = aot_rules->nodes[i].kind;
+      node.options = aot_rules->nodes[i].options;
+      node.children = aot_rules->nodes[i].children;
+      nodes.push_back(node);
+   }
+   cache.set_input_fields(aot_rules->input_fields);
+   cache.set_number_of_output_interfaces(aot_rules->interfaces);
+   cache.set_loaded();
+   return 0;
+}
+
+/**
+ * \return text as C string literal.
+ */
+static std::string c_literal(std::string const &text)
+{
+   std::string out = "\"";
+   char buf[8];
+
+   for (unsigned char c: text) {
+      if (c == '"' || c == '\\') {
+         out.push_back('\\');
+         out.push_back(c);
+      } else if (c < 0x20 || c >= 0x7f) {
+         /* Octal escape does not swallow following digits unlike hexadecimal one. */
+         snprintf(buf, sizeof(buf), "\\%03o", c);
+         out.append(buf);
+      } else {
+         out.push_back(c);
+      }
+   }
+   out.push_back('"');
+   return out;
+}
+
+int aot_generate(std::string const &path, std::string const &source, Rule_cache &cache)
+{
+   std::vector<Rule_cache_node> const &nodes = cache.get_nodes();
+   std::unordered_map<std::string, size_t> compiled;
+   std::vector<std::string> expressions;
+   std::string functions;
+
+   for (auto const &node: nodes) {
+      if (node.kind != RULE_CACHE_FILTER || compiled.count(node.options)) {
+         continue;
+      }
+      Filter filter;
+      std::string body;
+
+      if (filter.init(node.options.c_str(), std::vector<Stage_intf*>()) != 0) {
+         return -1;
+      }
+      if (filter.generate(body, true) != 0) {
+         continue;
+      }
+
+      size_t index = expressions.size();
+      functions += "static int aot_filter_" + std::to_string(index) +
+                   "(void const *rec, ur_template_t const *tmplt)\n{\n" + body + "}\n\n";
+      compiled[node.options] = index;
+      expressions.push_back(node.options);
+   }
+
+   std::string tmp = path + ".tmp";
+   FILE *file = fopen(tmp.c_str(), "w");
+   if (file == NULL) {
+      fprintf(stderr, "Error: cannot create %s: %s\n", tmp.c_str(), strerror(errno));
+      return -1;
+   }
+
+   fprintf(file, "/* Generated by policer -A from %s, do not edit. */\n\n", source.c_str());
+   fprintf(file, "#include \"aot.hpp\"\n#include \"fields.h\"\n\n#include <unirec/unirec.h>\n\n");
+   fputs(functions.c_str(), file);
+
+   fprintf(file, "static Aot_filter const filters[] = {\n");
+   for (size_t i = 0; i < expressions.size(); i++) {
+      fprintf(file, "   {%s, aot_filter_%zu},\n", c_literal(expressions[i]).c_str(), i);
+   }
+   fprintf(file, "   {\"\", NULL}\n};\n\n");
+
+   fprintf(file, "static Aot_node const nodes[] = {\n");
+   for (auto const &node: nodes) {
+      fprintf(file, "   {'%c', %s, %u},\n", node.kind, c_literal(node.options).c_str(), node.children);
+   }
+   fprintf(file, "   {0, \"\", 0}\n};\n\n");
+
+   fprintf(file, "static Aot_rules const rules = {\n   %s,\n   %d,\n   %s,\n   %s,\n   nodes, %zu,\n   filters, %zu\n};\n\n",
+           c_literal(source).c_str(), cache.get_number_of_output_interfaces(),
+           c_literal(cache.get_input_fields()).c_str(), c_literal(cache.get_variant()).c_str(),
+           nodes.size(), expressions.size());
+   fprintf(file, "Aot_rules const *aot_rules = &rules;\n");
+
+   if (fclose(file) != 0 || rename(tmp.c_str(), path.c_str()) != 0) {
+      fprintf(stderr, "Error: cannot write %s: %s\n", path.c_str(), strerror(errno));
+      unlink(tmp.c_str());
+      return -1;
+   }
+   fprintf(stderr, "Generated %s: %zu stages, %zu compiled filter expressions\n", path.c_str(),
+           nodes.size(), expressions.size());
+   return 0;
+}
@@ -0,0 +1,86 @@
+/**
+ * \file aot.hpp
+ * \brief Rules compiled ahead of time into C++ and linked into dedicated binary.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#if !defined(AOT_H)
+#define AOT_H
+
+#include "rule_cache.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include <unirec/unirec.h>
+
+/**
+ * \brief Filter expression compiled to C++ function.
+ * \return 1 if record passes, 0 if not, -1 if record misses some field (ffilter decides then).
+ */
+typedef int (*aot_filter_func)(void const *rec, ur_template_t const *tmplt);
+
+/**
+ * \brief Stage of embedded rules, same as Rule_cache_node.
+ */
+struct Aot_node {
+   char kind;            ///< RULE_CACHE_FILTER, RULE_CACHE_AGG or RULE_CACHE_SELECTOR.
+   char const *options;  ///< Options of stage derived from rules.
+   uint32_t children;    ///< Number of successors, they follow the node.
+};
+
+/**
+ * \brief Compiled filter expression.
+ */
+struct Aot_filter {
+   char const *expression; ///< Filter body as passed to Filter stage.
+   aot_filter_func match;  ///< Compiled expression.
+};
+
+/**
+ * \brief Rules embedded in binary built by policer-aot target.
+ */
+struct Aot_rules {
+   char const *source;        ///< Name of rules file.
+   int interfaces;            ///< Number of output interfaces.
+   char const *input_fields;  ///< Input template fields separated by comma.
+   char const *variant;       ///< Options which changed built stages, Program_arguments::get_build_variant().
+   Aot_node const *nodes;     ///< Stages of all branches in pre-order.
+   size_t n_nodes;            ///< Number of stages.
+   Aot_filter const *filters; ///< Compiled filter expressions.
+   size_t n_filters;          ///< Number of compiled filter expressions.
+};
+
+/**
+ * \brief Rules of generated source, NULL in binary without them (weak symbol).
+ */
+extern Aot_rules const *aot_rules;
+
+/**
+ * \brief Find compiled filter expression.
+ * \param[in] expression filter body.
+ * \return compiled expression, NULL if binary does not contain it.
+ */
+aot_filter_func aot_find_filter(char const *expression);
+
+/**
+ * \brief Fill rule cache by embedded rules, so they are built without parsing.
+ * \param[out] &cache rule cache.
+ * \return 0 on success, -1 if binary has no embedded rules.
+ */
+int aot_load_rules(Rule_cache &cache);
+
+/**
+ * \brief Write C++ source with stages of rules and filter expressions compiled to functions.
+ * \details Filter expression which contains comparison not supported by Filter_kernels
+ *    or field without static UniRec ID stays interpreted by ffilter.
+ * \param[in] &path generated file.
+ * \param[in] &source name of rules file.
+ * \param[in] &cache stages of rules with input fields and number of output interfaces.
+ * \return 0 on success, -1 on error.
+ */
+int aot_generate(std::string const &path, std::string const &source, Rule_cache &cache);
+
+#endif /* aot_h */
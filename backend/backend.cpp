@@ -8,15 +8,25 @@
 
 #include "aggregator/aggregator.hpp"
 #include "backend.hpp"
+#include "../parsing/exception.hpp"
+#include "../parsing/parser.hpp"
 #include "csv_unirec.hpp"
 #include "fields.h"
 #include "filter/filter.hpp"
+#include "filter/filter_jit.hpp"
 #include "interface.hpp"
 #include "selector/selector.hpp"
+#include "string_functions.hpp"
+#include "template_generation.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <csignal>
 #include <fstream>
+#include <inttypes.h>
+#include <iterator>
 #include <stdio.h>
+#include <thread>
 #include <vector>
 
 #include <unirec/unirec.h>
@@ -28,9 +38,11 @@
 void my_signal_handler(int signal);
 
 sig_atomic_t Backend::stopFlag = 0;
+sig_atomic_t Backend::reloadFlag = 0;
 
 /**
- * Function to handle SIGTERM and SIGINT signals used to stop the module.
+ * Function to handle SIGTERM and SIGINT signals used to stop the module
+ * and SIGHUP used to reload rules.
  * @param [in] signal caught signal value.
  */
 void my_signal_handler(int signal)
@@ -39,15 +51,42 @@ void my_signal_handler(int signal)
       fprintf(stderr, "Signal caught, exiting module\n");
       Backend::stopFlag = 1;
    }
+   else if (signal == SIGHUP) {
+      Backend::reloadFlag = 1;
+   }
 }
 
-int Backend::build_backend(void)
+int Backend::build_backend(Rule_cache *cache)
 {
    int retVal = 0;
+   /* Every file of parallel replay is processed by its own pipelines, unless they are shared (-C). */
+   bool own_pipelines = config->is_parallel_replay() && config->get_combiner_size() == 0;
+   size_t n_sets = own_pipelines ? config->get_replay_filenames().size() : 1;
+   bool cached = cache != NULL && cache->is_loaded();
+
+   input_fields = cached ? cache->get_input_fields() : templater.get_input_template_fields();
+   if (!config->get_jit_dir().empty() && Filter_jit::instance().set_dir(config->get_jit_dir()) != 0) {
+      return -1;
+   }
+   for (size_t i = 0; i < n_sets; i++) {
+      client::ast::Builder *builder = new client::ast::Builder(inter_repr, config);
+      builders.push_back(builder);
+      retVal |= cached ? builder->build(*cache) : builder->build();
+      pipeline_sets.push_back(builder->get_pipelineVec());
+   }
+   if (retVal == 0 && cache != NULL && !cached) {
+      builders.front()->store(*cache);
+      cache->set_input_fields(input_fields);
+      cache->save();
+   }
 
-   builder = new client::ast::Builder(inter_repr, config);
-   retVal |= builder->build();
-   pipelines = builder->get_pipelineVec();
+   /* State of the previous run continues before the first record. */
+   if (retVal == 0 && !config->get_checkpoint().empty()) {
+      if (checkpoint.init(config->get_checkpoint()) != 0 || checkpoint.restore() != 0) {
+         return -1;
+      }
+      checkpoint.start();
+   }
 
    signal(SIGTERM, my_signal_handler);
    signal(SIGINT, my_signal_handler);
@@ -57,20 +96,70 @@ int Backend::build_backend(void)
 
 int Backend::start_processing(void)
 {
+   if (config->is_replay()) {
+      return process_replay();
+   }
+   return process_trap_input();
+}
+
+/**
+ * Update input template to the format announced by TRAP_E_FORMAT_CHANGED,
+ * like TRAP_RECEIVE does after receiving.
+ * @param [in,out] tmplt template of received records, it can be reallocated, it is kept on error.
+ * @return 0 on success, otherwise -1.
+ */
+static int update_input_template(ur_template_t **tmplt)
+{
+   const char *spec = NULL;
+   uint8_t data_fmt;
 
-   std::string fields = templater.get_input_template_fields();
+   if (trap_get_data_fmt(TRAPIFC_INPUT, 0, &data_fmt, &spec) != TRAP_E_OK) {
+      fprintf(stderr, "Error: data format was not loaded\n");
+      return -1;
+   }
+   ur_template_t *updated = ur_define_fields_and_update_template(spec, *tmplt);
+   if (updated == NULL) {
+      fprintf(stderr, "Error: template could not be updated\n");
+      return -1;
+   }
+   *tmplt = updated;
+   /* Caches of offsets are rebuilt, also if the new template has the address of the old one. */
+   input_template_generation()++;
+   return 0;
+}
+
+int Backend::process_trap_input(void)
+{
+
+   std::string fields = input_fields;
    ur_template_t *tmplt = ur_create_input_template(0, fields.c_str(), NULL);
 
    if (tmplt == NULL) {
       fprintf(stderr, "ur_create_template error\n");
       return 1;
    }
+   pipelineVec const &pipelines = pipeline_sets.front();
+
+   /* Received record is valid only until next receive, batch must copy it. */
+   Record_batch batch;
+   bool batching = config->get_batch_size() > 0;
+
+   if (batching && (batch.init(fields, config->get_batch_size(), true) != 0 || batch.reset(tmplt) != 0)) {
+      ur_free_template(tmplt);
+      return 1;
+   }
 
-   /* Set signal handling for termination. */
+   /* Set signal handling for termination and reload. */
    signal(SIGTERM, my_signal_handler);
    signal(SIGINT, my_signal_handler);
+   signal(SIGHUP, my_signal_handler);
    int ret = 0;
 
+   /* Receive returns on idle input too, so reload does not wait for the next record. */
+   if (config->has_srcIn()) {
+      trap_ifcctl(TRAPIFC_INPUT, 0, TRAPCTL_SETTIMEOUT, RELOAD_CHECK_TIMEOUT);
+   }
+
 #ifdef MEASURE
    clock_t begin = clock();
 #endif
@@ -79,13 +168,33 @@ int Backend::start_processing(void)
       const void *in_rec;
       uint16_t in_rec_size;
 
+      if (Backend::reloadFlag) {
+         /* Pipelines are replaced between batches, records of a batch go to the same rules. */
+         Backend::reloadFlag = 0;
+         if (batching) {
+            flush_batch(&batch, &pipelines);
+         }
+         reload();
+      }
+
       /*
        * Receive data from input interface 0.
        * Block if data are not available immediately (unless a timeout is set using trap_ifcctl).
        */
-      ret = TRAP_RECEIVE(0, in_rec, in_rec_size, tmplt);
+      bool format_changed = false;
+      ret = trap_recv(0, &in_rec, &in_rec_size);
+      if (ret == TRAP_E_FORMAT_CHANGED) {
+         /* Buffered records are in the old template, it is freed or reallocated by the update. */
+         if (batching) {
+            flush_batch(&batch, &pipelines);
+         }
+         if ((ret = update_input_template(&tmplt)) != 0) {
+            break;
+         }
+         format_changed = true;
+      }
 
-      /* Handle possible errors. */
+      /* Handle possible errors, timeout goes back to check of reload. */
       TRAP_DEFAULT_RECV_ERROR_HANDLING(ret, continue, break);
 
       /* Check size of received data. */
@@ -102,13 +211,28 @@ int Backend::start_processing(void)
          }
       }
 
-      for (auto const &pipeline: pipelines) {
-         pipeline->eval(in_rec, tmplt);
+      if (batching) {
+         if (format_changed) {
+            /* Batch was flushed before the template was updated. */
+            if ((ret = batch.reset(tmplt)) != 0) {
+               break;
+            }
+         }
+         if (batch.add(in_rec, in_rec_size)) {
+            flush_batch(&batch, &pipelines);
+         }
+      } else {
+         for (auto const &pipeline: pipelines) {
+            pipeline->eval(in_rec, tmplt);
+         }
       }
       if (Backend::stopFlag) {
          break;
       }
    }
+   if (batching) {
+      flush_batch(&batch, &pipelines);
+   }
 
 #ifdef MEASURE
    clock_t end = clock();
@@ -119,9 +243,266 @@ int Backend::start_processing(void)
    return ret;
 }
 
+int Backend::check_replay_template(Replay_file &file)
+{
+   std::vector<std::string> names = divide_str(input_fields, ",");
+
+   for (auto const &name: names) {
+      int id = ur_get_id_by_name(name.c_str());
+
+      if (id < 0 || !ur_is_present(file.get_template(), id)) {
+         fprintf(stderr, "Error: field %s is not in replay file %s\n", name.c_str(),
+                 file.get_filename().c_str());
+         return -1;
+      }
+   }
+   return 0;
+}
+
+/**
+ * \return indexes of all records in batch.
+ */
+static uint16_t const* all_records_selection(void)
+{
+   /* Initialization of static variable is thread-safe, replay threads can call it at once. */
+   static std::vector<uint16_t> const sel = []() {
+      std::vector<uint16_t> ret(BATCH_MAX_SIZE);
+
+      for (int i = 0; i < BATCH_MAX_SIZE; i++) {
+         ret[i] = i;
+      }
+      return ret;
+   }();
+   return sel.data();
+}
+
+void Backend::flush_batch(Record_batch *batch, pipelineVec const *pipelines)
+{
+   if (batch->size() == 0) {
+      return;
+   }
+   batch->seal();
+   for (auto const &pipeline: *pipelines) {
+      pipeline->eval_batch(*batch, all_records_selection(), batch->size());
+   }
+   batch->reset(batch->get_template());
+}
+
+int Backend::replay_file(Replay_file *file, pipelineVec const *pipelines, Record_batch *batch,
+                         uint64_t *count)
+{
+   ur_template_t const *tmplt = file->get_template();
+   uint16_t fixlen_size = ur_rec_fixlen_size(tmplt);
+   uint16_t in_rec_size;
+   const void *in_rec;
+
+   if (batch != NULL && batch->get_template() != tmplt) {
+      /* Records of previous file. */
+      flush_batch(batch, pipelines);
+      if (batch->reset(tmplt) != 0) {
+         return -1;
+      }
+   }
+
+   while (Backend::stopFlag == 0 && (in_rec = file->next(in_rec_size)) != NULL) {
+      /* Check size of read data. */
+      if (in_rec_size < fixlen_size) {
+         if (in_rec_size <= 1) {
+            /* End of data. */
+            break;
+         }
+         fprintf(stderr, "Error: data with wrong size in %s (expected size: >= %hu, size: %hu)\n",
+                 file->get_filename().c_str(), fixlen_size, in_rec_size);
+         return -1;
+      }
+
+      if (batch != NULL) {
+         /* Records stay in mapped file, no copy needed. */
+         if (batch->add(in_rec, in_rec_size)) {
+            flush_batch(batch, pipelines);
+         }
+      } else {
+         for (auto const &pipeline: *pipelines) {
+            pipeline->eval(in_rec, tmplt);
+         }
+      }
+      (*count)++;
+   }
+   return 0;
+}
+
+int Backend::process_replay(void)
+{
+   std::vector<std::string> const &filenames = config->get_replay_filenames();
+   std::vector<Replay_file> files(filenames.size());
+
+   /* Files are opened before processing because fields are defined globally. */
+   for (size_t i = 0; i < filenames.size(); i++) {
+      if (files[i].open(filenames[i]) != 0 || check_replay_template(files[i]) != 0) {
+         return -1;
+      }
+   }
+
+   std::vector<uint64_t> counts(files.size(), 0);
+   std::vector<int> rets(files.size(), 0);
+   int batch_size = config->get_batch_size();
+   /* One batch per replay thread, also when threads share pipelines. */
+   size_t n_threads = config->is_parallel_replay() ? files.size() : 1;
+   std::vector<Record_batch> batches(batch_size > 0 ? n_threads : 0);
+
+   for (auto &batch: batches) {
+      if (batch.init(input_fields, batch_size, false) != 0) {
+         return -1;
+      }
+   }
+   auto begin = std::chrono::steady_clock::now();
+
+   if (config->is_parallel_replay()) {
+      std::vector<std::thread> threads;
+
+      for (size_t i = 0; i < files.size(); i++) {
+         /* Shared pipelines, Aggregators pre-aggregate records of every thread in its own table. */
+         pipelineVec *pipelines = &pipeline_sets[pipeline_sets.size() == 1 ? 0 : i];
+
+         threads.push_back(std::thread([&files, &counts, &rets, &batches, pipelines, i]() {
+            Record_batch *batch = batches.empty() ? NULL : &batches[i];
+
+            Agg::set_worker(i);
+            rets[i] = replay_file(&files[i], pipelines, batch, &counts[i]);
+            if (batch != NULL) {
+               flush_batch(batch, pipelines);
+            }
+         }));
+      }
+      for (auto &thread: threads) {
+         thread.join();
+      }
+   } else {
+      Record_batch *batch = batches.empty() ? NULL : &batches.front();
+
+      /* Files are processed one by one like one continuous stream. */
+      for (size_t i = 0; i < files.size() && Backend::stopFlag == 0; i++) {
+         if ((rets[i] = replay_file(&files[i], &pipeline_sets.front(), batch, &counts[i])) != 0) {
+            break;
+         }
+      }
+      if (batch != NULL) {
+         flush_batch(batch, &pipeline_sets.front());
+      }
+   }
+
+   std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+   uint64_t total = 0;
+   int ret = 0;
+
+   for (size_t i = 0; i < files.size(); i++) {
+      total += counts[i];
+      ret |= rets[i];
+   }
+   fprintf(stderr, "Replay: %" PRIu64 " records in %.3f s (%.0f records/s", total, elapsed.count(),
+           elapsed.count() > 0 ? total / elapsed.count() : 0.0);
+   if (batch_size > 0) {
+      fprintf(stderr, ", batches of %d records", batch_size);
+   } else {
+      fprintf(stderr, ", record by record");
+   }
+   fprintf(stderr, ", %s)\n", config->is_object_graph() ? "object graph" : "compiled pipeline");
+   return ret;
+}
+
+int Backend::reload(void)
+{
+   if (!config->has_srcIn()) {
+      fprintf(stderr, "Error: rules are compiled into binary, there is no file to reload\n");
+      return -1;
+   }
+
+   std::ifstream in(config->get_srcIn_filename(), std::ios_base::in);
+   std::string rules;
+   in.unsetf(std::ios::skipws);
+   std::copy(std::istream_iterator < char >(in),
+             std::istream_iterator < char >(), std::back_inserter(rules));
+
+   Parser parser(rules);
+   try {
+      parser.run();
+   }
+   catch(ProgramError::Error & e) {
+      std::cerr << e.msg_body << std::endl;
+      fprintf(stderr, "Error: reloaded rules are invalid, running rules are kept\n");
+      return -1;
+   }
+   /* Output interfaces of TRAP are fixed when module starts. */
+   if (parser.get_number_of_output_interfaces() != config->get_number_of_output_interfaces()) {
+      fprintf(stderr, "Error: reloaded rules need %d output interfaces instead of %d, running rules are kept\n",
+              parser.get_number_of_output_interfaces(), config->get_number_of_output_interfaces());
+      return -1;
+   }
+
+   Inter_repr *repr = new Inter_repr(std::move(parser.get_data()));
+   if (check_inter_repr(*repr)) {
+      delete repr;
+      return -1;
+   }
+   /* Input template is created when processing starts, new rules can use only its fields. */
+   std::vector<std::string> running = divide_str(input_fields, ",");
+   for (auto const &name: divide_str(client::ast::Unirec_input_template_fields(repr).get_input_template_fields(), ",")) {
+      if (std::find(running.begin(), running.end(), name) == running.end()) {
+         fprintf(stderr, "Error: reloaded rules use field %s which is not in input template, running rules are kept\n",
+                 name.c_str());
+         delete repr;
+         return -1;
+      }
+   }
+
+   client::ast::Builder *builder = new client::ast::Builder(repr, config);
+   int kept = 0;
+   if (builder->rebuild(*builders.front(), kept) != 0) {
+      fprintf(stderr, "Error: cannot build reloaded rules, running rules are kept\n");
+      delete builder;
+      delete repr;
+      return -1;
+   }
+
+   client::ast::Builder *old = builders.front();
+   builders.front() = builder;
+   pipeline_sets.front() = builder->get_pipelineVec();
+   /* Only changed branches are left, their aggregators flush windows through their own successors. */
+   delete old;
+   delete reloaded_repr;
+   reloaded_repr = repr;
+
+   fprintf(stderr, "Rules reloaded: %d branches kept, %zu rebuilt\n", kept,
+           builder->get_number_of_branches() - kept);
+   return 0;
+}
+
 Backend::~Backend(void)
 {
-   delete builder;
+   /* Stopped module saves partial windows for restart, finished data are flushed. */
+   if (!config->get_checkpoint().empty()) {
+      if (Backend::stopFlag) {
+         checkpoint.finish();
+      } else {
+         checkpoint.stop();
+      }
+   }
+
+   for (auto const &builder: builders) {
+      delete builder;
+   }
+   delete reloaded_repr;
+   /* UniRec fields defined by stages are released once all stages are destroyed. */
+   ur_finalize();
+
+   /* All Aggregators are flushed now, tell the receivers that there are no more data. */
+   char eof = 0;
+   for (int i = 0; i < config->get_number_of_output_interfaces(); i++) {
+      if (trap_send(i, &eof, 1) != TRAP_E_OK) {
+         fprintf(stderr, "ERROR while sending message of module ending to interface %d\n", i);
+         fprintf(stderr, "Receiving side probably did not notice shutdown of module\n");
+      }
+   }
 }
 
 //int Backend::processing_csv_input_file()
@@ -9,15 +9,23 @@
 #if !defined(BACKEND_H)
 #define BACKEND_H
 
+#include "batch.hpp"
 #include "builder.hpp"
+#include "checkpoint.hpp"
 #include "interface.hpp"
 #include "../parsing/inter_repr.hpp"
 #include "program_arguments.hpp"
+#include "replay.hpp"
+#include "rule_cache.hpp"
 #include "unirec_template.hpp"
 
 #include <csignal>
+#include <stdint.h>
 #include <vector>
 
+/** Microseconds to wait for input record before reload (SIGHUP) is checked again. */
+#define RELOAD_CHECK_TIMEOUT 500000
+
 
 /**
  * \brief Process run control.
@@ -27,15 +35,65 @@ class Backend {
    Inter_repr *inter_repr;                              ///< Information obtained during parsing.
    client::ast::Unirec_input_template_fields templater; ///< Input Unirec template.
    Program_arguments *config;                           ///< Arguments from command line.
-   client::ast::Builder *builder = NULL;                ///< Processing pipeline builder.
-   pipelineVec pipelines;                               ///< Processing pipelines
+   std::vector<client::ast::Builder*> builders;         ///< Processing pipeline builders, one per parallel replay.
+   std::vector<pipelineVec> pipeline_sets;              ///< Processing pipelines of every builder.
+   Checkpoint checkpoint;                               ///< Snapshots of aggregator state (-K option).
+   Inter_repr *reloaded_repr = NULL;                    ///< Rules of the last reload, NULL if rules were not reloaded.
+   std::string input_fields;                            ///< Fields of input template separated by comma.
 
    // function is not used
    //int processing_csv_input_file();
 
+   /**
+    * \brief Process records received from TRAP input interface.
+    * \return 0 on success.
+    */
+   int process_trap_input(void);
+
+   /**
+    * \brief Process records read directly from TRAP files (-R option).
+    * \return 0 on success.
+    */
+   int process_replay(void);
+
+   /**
+    * \brief Check if template of replay file contains all fields used by rules.
+    * \param[in] file opened replay file.
+    * \return 0 on success, otherwise a negative error value.
+    */
+   int check_replay_template(Replay_file &file);
+
+   /**
+    * \brief Pass all records from file to pipelines.
+    * \param[in] file opened replay file.
+    * \param[in] pipelines processing pipelines.
+    * \param[in] batch batch for records or NULL if records are passed one by one.
+    * \param[out] count number of processed records.
+    * \return 0 on success, otherwise a negative error value.
+    */
+   static int replay_file(Replay_file *file, pipelineVec const *pipelines, Record_batch *batch,
+                          uint64_t *count);
+
+   /**
+    * \brief Pass records collected in batch to pipelines and empty the batch.
+    * \param[in] batch filled batch.
+    * \param[in] pipelines processing pipelines.
+    */
+   static void flush_batch(Record_batch *batch, pipelineVec const *pipelines);
+
+   /**
+    * \brief Parse rules file again and replace changed branches of running pipelines.
+    * \details Unchanged branches keep their stages with aggregated state and output interfaces,
+    *    stages of changed or removed branches are destroyed, aggregators flush their windows.
+    *    Running pipelines stay untouched if new rules are invalid.
+    * \return 0 on success, otherwise a negative error value.
+    */
+   int reload(void);
+
 public:
 
    static sig_atomic_t stopFlag; ///< Interrupt the entire processing.
+   static sig_atomic_t reloadFlag; ///< Reload rules before the next record (SIGHUP).
 
    /**
     * \param[in] ir information obtained during parsing.
@@ -45,9 +103,12 @@ public:
 
    /**
     * \brief Prepare processing. Call this method after class constructor.
+    * \details Pipelines are created from loaded rule cache instead of parsed rules,
+    *    cache which is not loaded is filled and saved.
+    * \param[in,out] *cache rule cache (-c option), NULL if not used.
     * \return 0 on success.
     */
-   int build_backend(void);
+   int build_backend(Rule_cache *cache = NULL);
 
    /**
     * \brief Prepare processing. Call this method after build_backend() method.
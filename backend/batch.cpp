@@ -0,0 +1,169 @@
+/**
+ * \file batch.cpp
+ * \brief Definition of Record_batch class.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#include "batch.hpp"
+#include "string_functions.hpp"
+#include "template_generation.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utility>
+
+void* Record_batch::alloc_column(size_t bytes)
+{
+   void *ptr = NULL;
+   /* Size rounded up, so kernels can load whole vector at the end of column. */
+   bytes = (bytes + BATCH_ALIGN - 1) / BATCH_ALIGN * BATCH_ALIGN;
+
+   if (posix_memalign(&ptr, BATCH_ALIGN, bytes) != 0) {
+      return NULL;
+   }
+   memset(ptr, 0, bytes);
+   return ptr;
+}
+
+int Record_batch::init(std::string const &names, size_t cap, bool copy)
+{
+   if (cap == 0 || cap > BATCH_MAX_SIZE) {
+      fprintf(stderr, "Error: size of batch must be from 1 to %d\n", BATCH_MAX_SIZE);
+      return -1;
+   }
+   capacity = cap;
+   copy_rows = copy;
+   size_t padded = (capacity + BATCH_GROUP - 1) / BATCH_GROUP * BATCH_GROUP;
+   rows.resize(capacity);
+   if (copy_rows) {
+      row_offsets.resize(capacity);
+      arena.reserve(capacity * 128);
+   }
+
+   for (auto const &name: divide_str(names, ",")) {
+      int id = ur_get_id_by_name(name.c_str());
+
+      if (id < 0) {
+         fprintf(stderr, "Error: field %s is not defined, cannot create batch\n", name.c_str());
+         return -1;
+      }
+      if (ur_is_varlen(id)) {
+         /* Variable-length fields are read from rows. */
+         continue;
+      }
+      Column col = {};
+      col.id = id;
+      col.elem_size = ur_get_size(id);
+      col.is_ip = ur_get_type(id) == UR_TYPE_IP;
+      col.data = static_cast<uint8_t*>(alloc_column(col.elem_size * padded));
+      if (col.is_ip) {
+         col.is_ip4 = static_cast<uint8_t*>(alloc_column(padded));
+         col.ip4 = static_cast<uint32_t*>(alloc_column(sizeof(uint32_t) * padded));
+      }
+      if (col.data == NULL || (col.is_ip && (col.is_ip4 == NULL || col.ip4 == NULL))) {
+         fprintf(stderr, "Error: Memory allocation problem (batch column).\n");
+         return -1;
+      }
+      if ((size_t) id >= column_index.size()) {
+         column_index.resize(id + 1, -1);
+      }
+      column_index[id] = columns.size();
+      columns.push_back(col);
+   }
+   return 0;
+}
+
+int Record_batch::reset(ur_template_t const *in_tmplt)
+{
+   n = 0;
+   arena.clear();
+   /* Changed template can have the address of the previous one. */
+   if (tmplt == in_tmplt && generation == input_template_generation()) {
+      return 0;
+   }
+   tmplt = in_tmplt;
+   generation = input_template_generation();
+   for (auto &col: columns) {
+      if (!ur_is_present(tmplt, col.id)) {
+         fprintf(stderr, "Error: field %s is not in input template\n", ur_get_name(col.id));
+         return -1;
+      }
+      col.src_offset = tmplt->offset[col.id];
+   }
+   return 0;
+}
+
+bool Record_batch::add(void const *rec, uint16_t rec_size)
+{
+   char const *src = static_cast<char const*>(rec);
+
+   for (auto &col: columns) {
+      char const *value = src + col.src_offset;
+
+      memcpy(col.data + n * col.elem_size, value, col.elem_size);
+      if (col.is_ip) {
+         ip_addr_t const *addr = reinterpret_cast<ip_addr_t const*>(value);
+         bool v4 = ip_is4(addr);
+         /* ffilter compares IPv4 constant also with IPv6 address whose first 96 bits are zero (::a.b.c.d). */
+         bool compatible = !v4 && addr->ui64[0] == 0 && addr->ui32[2] == 0;
+
+         col.is_ip4[n] = v4 || compatible;
+         col.ip4[n] = v4 ? addr->ui32[2] : compatible ? addr->ui32[3] : 0;
+      }
+   }
+
+   if (copy_rows) {
+      /* Pointers are set in seal(), arena can be reallocated meanwhile. */
+      row_offsets[n] = arena.size();
+      arena.insert(arena.end(), src, src + rec_size);
+   } else {
+      rows[n] = rec;
+   }
+   return ++n == capacity;
+}
+
+void Record_batch::seal(void)
+{
+   if (copy_rows) {
+      for (size_t i = 0; i < n; i++) {
+         rows[i] = arena.data() + row_offsets[i];
+      }
+   }
+}
+
+Record_batch::Record_batch(Record_batch &&other) noexcept: columns(std::move(other.columns)),
+   column_index(std::move(other.column_index)), rows(std::move(other.rows)),
+   row_offsets(std::move(other.row_offsets)), arena(std::move(other.arena)), copy_rows(other.copy_rows),
+   tmplt(other.tmplt), generation(other.generation), n(other.n), capacity(other.capacity)
+{
+   other.columns.clear();
+   other.tmplt = NULL;
+   other.n = 0;
+   other.capacity = 0;
+}
+
+Record_batch& Record_batch::operator=(Record_batch &&other) noexcept
+{
+   std::swap(columns, other.columns);
+   std::swap(column_index, other.column_index);
+   std::swap(rows, other.rows);
+   std::swap(row_offsets, other.row_offsets);
+   std::swap(arena, other.arena);
+   std::swap(copy_rows, other.copy_rows);
+   std::swap(tmplt, other.tmplt);
+   std::swap(generation, other.generation);
+   std::swap(n, other.n);
+   std::swap(capacity, other.capacity);
+   return *this;
+}
+
+Record_batch::~Record_batch(void)
+{
+   for (auto const &col: columns) {
+      free(col.data);
+      free(col.is_ip4);
+      free(col.ip4);
+   }
+}
@@ -0,0 +1,167 @@
+/**
+ * \file batch.hpp
+ * \brief Batch of records transposed to columns.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#if !defined(BATCH_H)
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <unirec/unirec.h>
+
+/** Alignment of columns in bytes, enough for AVX2 loads. */
+#define BATCH_ALIGN 32
+/** Maximal number of records in one batch. */
+#define BATCH_MAX_SIZE 8192
+/** Columns are allocated for multiple of this number of records, kernels read whole groups. */
+#define BATCH_GROUP 32
+
+/**
+ * \brief Records stored row by row and fields used by rules transposed to typed columns.
+ * \details Only fixed-length fields are transposed. Column of IP addresses is also normalized:
+ *    there is a flag if address is IPv4 and column with IPv4 address (as 32 bit number
+ *    in UniRec order), so comparisons of IPv4 addresses work over 32 bit lanes.
+ *    Original records stay accessible through row() for stages without columnar implementation.
+ */
+class Record_batch
+{
+public:
+
+   /**
+    * \brief One transposed field.
+    */
+   struct Column {
+      ur_field_id_t id;       ///< UniRec ID of the field.
+      int elem_size;          ///< Size of one value in bytes.
+      bool is_ip;             ///< If the field is IP address.
+      uint16_t src_offset;    ///< Offset of the field in records of current template.
+      uint8_t *data;          ///< Values, elem_size * capacity bytes (rounded up to BATCH_GROUP records).
+      uint8_t *is_ip4;        ///< IP only: 1 if address is IPv4 or IPv4-compatible IPv6 (::a.b.c.d), otherwise 0.
+      uint32_t *ip4;          ///< IP only: IPv4 address of is_ip4 address, 0 for other IPv6.
+   };
+
+private:
+
+   std::vector<Column> columns;       ///< Transposed fields.
+   std::vector<int> column_index;     ///< Index to columns for every UniRec ID, -1 if not transposed.
+   std::vector<void const*> rows;     ///< Pointers to records.
+   std::vector<size_t> row_offsets;   ///< Offsets of copied records in arena.
+   std::vector<char> arena;           ///< Copies of records when records are not persistent.
+   bool copy_rows = false;            ///< If records are copied to arena.
+   ur_template_t const *tmplt = NULL; ///< Template of all records in batch.
+   uint32_t generation = 0;           ///< Generation of input template which offsets of columns are set for.
+   size_t n = 0;                      ///< Number of records in batch.
+   size_t capacity = 0;               ///< Maximal number of records in batch.
+
+   /**
+    * \brief Allocate aligned memory for column.
+    * \param[in] bytes size of column.
+    * \return pointer to memory or NULL.
+    */
+   static void* alloc_column(size_t bytes);
+
+public:
+
+   Record_batch(void) {}
+
+   /**
+    * \brief Take columns and records of other, which is left empty.
+    */
+   Record_batch(Record_batch &&other) noexcept;
+
+   /**
+    * \brief Exchange content with other, columns of this one are released with other.
+    */
+   Record_batch& operator=(Record_batch &&other) noexcept;
+
+   /** Columns are owned, batch cannot be copied. */
+   Record_batch(Record_batch const &) = delete;
+   Record_batch& operator=(Record_batch const &) = delete;
+
+   /**
+    * \brief Prepare columns. Call after fields in names are defined.
+    * \param[in] names UniRec names separated by comma (from Unirec_input_template_fields).
+    * \param[in] cap maximal number of records in batch.
+    * \param[in] copy true if records must be copied because source buffer is reused.
+    * \return 0 on success, otherwise a negative error value.
+    */
+   int init(std::string const &names, size_t cap, bool copy);
+
+   /**
+    * \brief Empty the batch and set template of next records.
+    * \param[in] in_tmplt UniRec template of next records.
+    * \return 0 on success, otherwise a negative error value if some column is not in template.
+    */
+   int reset(ur_template_t const *in_tmplt);
+
+   /**
+    * \brief Add record to batch and transpose its fields.
+    * \param[in] rec record in template set by reset().
+    * \param[in] rec_size size of record.
+    * \return true if batch is full.
+    */
+   bool add(void const *rec, uint16_t rec_size);
+
+   /**
+    * \brief Finish filling of batch. Call before batch is passed to stages.
+    */
+   void seal(void);
+
+   /**
+    * \return number of records in batch.
+    */
+   size_t size(void) const
+   {
+      return n;
+   }
+
+   /**
+    * \param[in] i index of record.
+    * \return record in row format.
+    */
+   void const* row(size_t i) const
+   {
+      return rows[i];
+   }
+
+   /**
+    * \return UniRec template of records.
+    */
+   ur_template_t const* get_template(void) const
+   {
+      return tmplt;
+   }
+
+   /**
+    * \param[in] id UniRec ID of field.
+    * \return column of field or NULL if field is not transposed.
+    */
+   Column const* column(ur_field_id_t id) const
+   {
+      if (id < 0 || (size_t) id >= column_index.size() || column_index[id] < 0) {
+         return NULL;
+      }
+      return &columns[column_index[id]];
+   }
+
+   /**
+    * \brief Typed access to values of column.
+    * \param[in] id UniRec ID of field.
+    * \return array of values or NULL if field is not transposed.
+    */
+   template <class T> T const* values(ur_field_id_t id) const
+   {
+      Column const *col = column(id);
+      return col == NULL ? NULL : reinterpret_cast<T const*>(col->data);
+   }
+
+   ~Record_batch(void);
+};
+
+#endif /* batch_h */
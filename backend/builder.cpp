@@ -11,10 +11,15 @@
 #include "filter/filter.hpp"
 #include "selector/selector.hpp"
 #include "string_functions.hpp"
+#include "../parsing/ast/ast_alias4variables.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <limits>
 #include <stdio.h>
+#include <typeinfo>
+#include <unordered_map>
+#include <unordered_set>
 
 #define SELECTOR_BODY 1
 #define GROUP_FILTER_BODY 2
@@ -40,6 +45,58 @@ Stage_intf* Builder_stage_base::get_my_stage(void)
    return my_stage;
 }
 
+builderVec const& Builder_stage_base::get_next_builders(void)
+{
+   return next_builders;
+}
+
+std::string const& Builder_stage_base::get_options(void)
+{
+   return options;
+}
+
+void Builder_stage_base::set_options(std::string const &opt)
+{
+   options = opt;
+}
+
+std::string Builder_stage_base::signature(void) const
+{
+   std::string sig = typeid(*my_stage).name();
+
+   sig.append("(");
+   if (dynamic_cast<Selector*>(my_stage) != NULL) {
+      /* Index of output interface changes with branches inserted before, it is rebound by take_interfaces(). */
+      sig.append(options.substr(options.find(':') + 1));
+   } else {
+      sig.append(options);
+   }
+   sig.append(")[");
+   for (auto const &next_builder: next_builders) {
+      sig.append(next_builder->signature());
+      sig.append(";");
+   }
+   sig.append("]");
+   return sig;
+}
+
+int Builder_stage_base::take_interfaces(Builder_stage_base const *other)
+{
+   int ret = 0;
+   Selector *selector = dynamic_cast<Selector*>(my_stage);
+
+   if (selector != NULL && options != other->options) {
+      ret = selector->set_interface(std::stoi(other->options));
+      if (ret == 0) {
+         options = other->options;
+      }
+   }
+   for (size_t i = 0; i < next_builders.size() && i < other->next_builders.size(); i++) {
+      ret |= next_builders[i]->take_interfaces(other->next_builders[i]);
+   }
+   return ret;
+}
+
 Builder_stage_base::~Builder_stage_base(void)
 {
    delete my_stage;
@@ -60,30 +117,189 @@ std::string Builder::apply_aliases(std::string stage_body, varsT *aliases, int b
    if (aliases == NULL) {
       return stage_body;
    }
+   aliasMapT map;
    for (auto const &item: *aliases) {
       if (!item.alias.empty()) {
-         if (body_id == SELECTOR_BODY) {
-            stage_body = replace_aliases_in_selector_body(stage_body, item.name, item.alias);
-         }
-         else if (body_id == GROUP_FILTER_BODY) {
-            stage_body = replace_aliases_in_group_filter_body(stage_body, item.name, item.alias);
-         }
+         map[item.name] = item.alias;
       }
    }
+   if (map.empty()) {
+      return stage_body;
+   }
+   if (body_id == SELECTOR_BODY) {
+      return replace_aliases_in_selector_body(stage_body, map);
+   }
+   else if (body_id == GROUP_FILTER_BODY) {
+      return replace_aliases_in_group_filter_body(stage_body, map);
+   }
    return stage_body;
 }
 
 int Builder::build(void)
 {
    (*this) (inter_repr->ast);
+   return init_root();
+}
+
+int Builder::build(Rule_cache &cache)
+{
+   std::vector<Rule_cache_node> const &nodes = cache.get_nodes();
+   size_t pos = 0;
+
+   /* Stages are the same as when cache was stored, so are the warnings. */
+   std::cerr << cache.get_warnings();
+
+   while (pos < nodes.size()) {
+      Builder_stage_base *item = create_cached(nodes, pos);
+      if (item == NULL) {
+         std::cerr << "Error: rule cache is damaged" << std::endl;
+         return -1;
+      }
+      root.push_back(item);
+   }
+   return init_root();
+}
+
+Builder_stage_base* Builder::create_cached(std::vector<Rule_cache_node> const &nodes, size_t &pos)
+{
+   if (pos >= nodes.size()) {
+      return NULL;
+   }
+   Rule_cache_node const &node = nodes[pos++];
+   builderVec next;
+
+   for (uint32_t i = 0; i < node.children; i++) {
+      Builder_stage_base *item = create_cached(nodes, pos);
+      if (item == NULL) {
+         for (auto const &done: next) {
+            delete done;
+         }
+         return NULL;
+      }
+      next.push_back(item);
+   }
+
+   switch (node.kind) {
+   case RULE_CACHE_FILTER:
+      return new Builder_stage<Filter> (node.options, next);
+   case RULE_CACHE_AGG:
+      return new Builder_stage<Agg> (node.options + aggregator_config_options(), next);
+   case RULE_CACHE_SELECTOR:
+      return new Builder_stage<Selector> (node.options, next);
+   default:
+      for (auto const &done: next) {
+         delete done;
+      }
+      return NULL;
+   }
+}
+
+void Builder::store(Rule_cache &cache)
+{
+   cache.get_nodes().clear();
+   for (auto const &item: root) {
+      store_cached(item, cache.get_nodes());
+   }
+   cache.set_number_of_output_interfaces(interface_counter);
+   cache.set_warnings(warnings);
+}
+
+void Builder::warn(std::string const &text)
+{
+   std::cerr << text << std::endl;
+   warnings.append(text + "\n");
+}
+
+void Builder::describe(Rule_cache &cache)
+{
+   (*this) (inter_repr->ast);
+   store(cache);
+}
+
+void Builder::store_cached(Builder_stage_base *builder, std::vector<Rule_cache_node> &nodes)
+{
+   Stage_intf *stage = builder->get_my_stage();
+   Rule_cache_node node;
+
+   node.options = builder->get_options();
+   node.children = builder->get_next_builders().size();
+   if (dynamic_cast<Agg*>(stage) != NULL) {
+      /* Options of command line are appended again when cache is loaded. */
+      node.kind = RULE_CACHE_AGG;
+      node.options.resize(node.options.size() - aggregator_config_options().size());
+   } else if (dynamic_cast<Selector*>(stage) != NULL) {
+      node.kind = RULE_CACHE_SELECTOR;
+   } else {
+      node.kind = RULE_CACHE_FILTER;
+   }
+   nodes.push_back(node);
+   for (auto const &next_builder: builder->get_next_builders()) {
+      store_cached(next_builder, nodes);
+   }
+}
+
+int Builder::init_root(void)
+{
    int retVal = 0;
 
    for (auto const &item: root) {
       retVal |= item->init();
    }
+   if (retVal == 0) {
+      retVal |= compiled.compile(root);
+   }
    return retVal;
 }
 
+int Builder::rebuild(Builder &old, int &kept)
+{
+   (*this) (inter_repr->ast);
+   int retVal = 0;
+   /* Index of old branch for every new one, -1 if the branch is new or changed. */
+   std::vector<int> same(root.size(), -1);
+   /* Old branches by signature, each one can be reused once. */
+   std::unordered_multimap<std::string, int> old_sigs;
+
+   old_sigs.reserve(old.root.size());
+   for (size_t j = 0; j < old.root.size(); j++) {
+      old_sigs.emplace(old.root[j]->signature(), j);
+   }
+   for (size_t i = 0; i < root.size(); i++) {
+      auto it = old_sigs.find(root[i]->signature());
+      if (it != old_sigs.end()) {
+         same[i] = it->second;
+         old_sigs.erase(it);
+      }
+      if (same[i] < 0) {
+         retVal |= root[i]->init();
+      }
+   }
+   if (retVal != 0) {
+      return retVal;
+   }
+
+   kept = 0;
+   for (size_t i = 0; i < root.size(); i++) {
+      if (same[i] < 0)
+         continue;
+      /* Stages of new branch were not initialized, running ones send to its interfaces. */
+      if (old.root[same[i]]->take_interfaces(root[i]) != 0) {
+         std::cerr << "Warning: reused branch keeps its previous output interface" << std::endl;
+      }
+      delete root[i];
+      root[i] = old.root[same[i]];
+      old.root[same[i]] = NULL;
+      kept++;
+   }
+   old.root.erase(std::remove(old.root.begin(), old.root.end(), (Builder_stage_base*) NULL), old.root.end());
+   return compiled.compile(root);
+}
+
+size_t Builder::get_number_of_branches(void)
+{
+   return root.size();
+}
+
 builderVec Builder::get_build_root(void)
 {
    return root;
@@ -93,7 +309,11 @@ pipelineVec Builder::get_pipelineVec(void)
 {
    pipelineVec ret;
 
-for (auto const &item: root) {
+   if (!config->is_object_graph()) {
+      ret.push_back(&compiled);
+      return ret;
+   }
+   for (auto const &item: root) {
       ret.push_back(item->get_my_stage());
    }
    return ret;
@@ -135,6 +355,7 @@ void Builder::operator() (grouper_stage const &gs) {
    groDive = false;
    boost::apply_visitor((*this), gs.succ);
    gro_opt = "";
+   gro_keys.clear();
 }
 
 void Builder::operator() (window_stage const &ws) {
@@ -161,17 +382,190 @@ void Builder::operator() (aggregator_stage const &as) {
       options.append(get_max_window());
    else
       options.append(win_opt);
-   options.append(agg_opt);
+   options.append(live_aggregates(*my_vec));
+   if (!admission_compatible(*my_vec)) {
+      /* Part of rules, so it is cached with them unlike -H. */
+      options.append(" -X ");
+   }
+   options.append(aggregator_config_options());
+   std::string pushed = push_down_group_filter(*my_vec);
    Builder_stage<Agg> *my_builder = new Builder_stage<Agg> (options, *my_vec);
-   b_stack.back()->push_back(my_builder);
+   if (pushed.empty()) {
+      b_stack.back()->push_back(my_builder);
+   } else {
+      b_stack.back()->push_back(new Builder_stage<Filter> (pushed, builderVec {my_builder}));
+   }
    delete my_vec;
 
-   agg_opt = "";
+   agg_items.clear();
+}
+
+/**
+ * \brief Collect identifiers of options of builders and all their successors.
+ * \param[in] &succ builders.
+ * \param[out] &used found identifiers.
+ */
+static void collect_successor_identifiers(builderVec const &succ, std::unordered_set<std::string> &used)
+{
+   builderVec stack = succ;
+
+   while (!stack.empty()) {
+      Builder_stage_base *item = stack.back();
+      stack.pop_back();
+      collect_identifiers(item->get_options(), used);
+      stack.insert(stack.end(), item->get_next_builders().begin(), item->get_next_builders().end());
+   }
+}
+
+std::string Builder::live_aggregates(builderVec const &succ)
+{
+   std::unordered_set<std::string> used;
+   collect_successor_identifiers(succ, used);
+
+   std::string options;
+   std::string removed;
+   for (auto const &item: agg_items) {
+      if (used.count(item.field) || used.count(item.variable)) {
+         options.append(item.option);
+      } else {
+         removed.append(removed.empty() ? "" : ", ");
+         removed.append(item.variable + " (" + item.field + ")");
+      }
+   }
+   if (!removed.empty()) {
+      warn("Warning: " + get_branchPath("aggregator") + ": unused aggregates removed: " + removed);
+   }
+   return options;
+}
+
+std::string Builder::push_down_group_filter(builderVec const &succ)
+{
+   /* In event time every received record moves watermark of Aggregator, filtered ones would not. */
+   if (gro_keys.empty() || succ.size() != 1 || dynamic_cast<Filter*>(succ.front()->get_my_stage()) == NULL ||
+       config->is_event_time()) {
+      return std::string();
+   }
+   std::unordered_set<std::string> keys(gro_keys.begin(), gro_keys.end());
+   std::string pushed;
+   std::string kept;
+
+   for (auto const &operand: split_conjuncts(succ.front()->get_options())) {
+      std::unordered_set<std::string> identifiers;
+      bool has_field = false;
+      bool only_keys = true;
+
+      collect_identifiers(operand, identifiers);
+      for (auto const &item: identifiers) {
+         if (ur_get_id_by_name(item.c_str()) >= 0) {
+            has_field = true;
+            only_keys = only_keys && keys.count(item);
+         }
+      }
+      std::string &dst = has_field && only_keys ? pushed : kept;
+      dst.append(dst.empty() ? "(" : " and (");
+      dst.append(operand + ")");
+   }
+   if (pushed.empty()) {
+      return pushed;
+   }
+   warn("Warning: " + get_branchPath("aggregator") + ": group-filter operands " + pushed +
+        " are evaluated before aggregation");
+   succ.front()->set_options(kept.empty() ? "any" : kept);
+   return pushed;
+}
+
+bool Builder::admission_compatible(builderVec const &succ)
+{
+   std::unordered_set<std::string> used;
+   std::unordered_set<std::string> keys(gro_keys.begin(), gro_keys.end());
+   std::unordered_set<std::string> aggregated;
+   int n_aggregated = 0;
+   bool only_sums = true;
+
+   collect_successor_identifiers(succ, used);
+   for (auto const &item: agg_items) {
+      if (used.count(item.variable)) {
+         used.insert(item.field);
+      }
+   }
+   for (auto const &name: used) {
+      if (ur_get_id_by_name(name.c_str()) < 0 || keys.count(name)) {
+         continue;
+      }
+      bool is_sum = false;
+      for (auto const &item: agg_items) {
+         is_sum = is_sum || (item.field == name && item.option == option_aggrWithParamEnum(ap_sum) + name);
+      }
+      n_aggregated++;
+      only_sums = only_sums && (name == "COUNT" || is_sum);
+   }
+   return n_aggregated == 1 && only_sums;
+}
+
+std::string Builder::aggregator_config_options(void)
+{
+   std::string options;
+
+   if (config->is_event_time()) {
+      options.append(" -e ");
+      options.append(std::to_string(config->get_event_time_lateness()));
+      options.append(" ");
+   }
+   if (config->is_columnar()) {
+      options.append(" -S ");
+   }
+   if (config->get_quota() > 0) {
+      options.append(" -q ");
+      options.append(std::to_string(config->get_quota()));
+      options.append(" ");
+   }
+   if (config->get_global_quota() > 0) {
+      options.append(" -Q ");
+      options.append(std::to_string(config->get_global_quota()));
+      options.append(" ");
+   }
+   if (!config->get_evict_policy().empty()) {
+      options.append(" -E ");
+      options.append(config->get_evict_policy());
+      options.append(" ");
+   }
+   if (!config->get_admission().empty()) {
+      options.append(" -H ");
+      options.append(config->get_admission());
+      options.append(" ");
+   }
+   if (!config->get_spill_dir().empty()) {
+      options.append(" -D ");
+      options.append(config->get_spill_dir());
+      options.append(" ");
+   }
+   if (!config->get_checkpoint().empty()) {
+      options.append(" -K ");
+   }
+   if (config->get_combiner_size() > 0) {
+      /* One pre-aggregation table per replay thread. */
+      options.append(" -w ");
+      options.append(std::to_string(config->get_replay_filenames().size()));
+      options.append(":");
+      options.append(std::to_string(config->get_combiner_size()));
+      options.append(" ");
+   }
+   return options;
+}
+
+void Builder::operator() (aggr_assignment const &aa) {
+   agg_var = aa.variable_name;
+   boost::apply_visitor((*this), aa.func_type);
 }
 
 void Builder::operator() (aggr_func_with_param_s const &agf) {
-   agg_opt.append(option_aggrWithParamEnum(agf.func_name));
-   agg_opt.append(string_unirecEnum(agf.param));
+   Agg_item item;
+
+   item.variable = agg_var;
+   item.field = agf.func_name == ap_countDistinct ? put_together_function_alias(agf.func_name, agf.param) :
+                string_unirecEnum(agf.param);
+   item.option = option_aggrWithParamEnum(agf.func_name) + string_unirecEnum(agf.param);
+   agg_items.push_back(item);
 }
 
 void Builder::operator() (aggr_func_without_param const & /* agf */ ) {
@@ -198,7 +592,6 @@ void Builder::operator() (selector_stage const &ss) {
    selDive = false;
 
    std::string options;
-   static int interface_counter = 0;
 
    options.append(std::to_string(interface_counter));
    options.append(":");
@@ -244,6 +637,7 @@ void Builder::operator() (unirec const &un) {
       gro_opt.append(" -k ");
       gro_opt.append(string_unirecEnum(un));
       gro_opt.append(" ");
+      gro_keys.push_back(string_unirecEnum(un));
    }
 }
 
@@ -6,10 +6,12 @@
  * \date 2020
  */
 
+#include "compiled_pipeline.hpp"
 #include "interface.hpp"
 #include "../parsing/ast/ast_variables.hpp"
 #include "../parsing/inter_repr.hpp"
 #include "program_arguments.hpp"
+#include "rule_cache.hpp"
 
 #include <iostream>
 #include <string>
@@ -56,6 +58,39 @@ public:
     */
    Stage_intf* get_my_stage(void);
 
+   /**
+    * \return next immediate builders (next_builders).
+    */
+   builderVec const& get_next_builders(void);
+
+   /**
+    * \return parameters for managed stage (options).
+    */
+   std::string const& get_options(void);
+
+   /**
+    * \brief Change parameters for managed stage before its initialization.
+    * \param[in] opt new parameters.
+    */
+   void set_options(std::string const &opt);
+
+   /**
+    * \brief Describe this stage and its whole subtree by stage types and options.
+    * \details Subtrees with the same signature process records the same way (except index
+    *    of output interface), so running subtree can replace the new one when rules are reloaded.
+    * \return signature of subtree.
+    */
+   std::string signature(void) const;
+
+   /**
+    * \brief Move Selectors of this subtree to output interfaces of subtree with the same signature.
+    * \details Signature does not contain index of output interface, which changes when branch
+    *    is inserted or removed before. Running subtree takes indexes of the reloaded one.
+    * \param[in] *other subtree built from reloaded rules.
+    * \return 0 on success, otherwise a negative error value.
+    */
+   int take_interfaces(Builder_stage_base const *other);
+
    virtual ~Builder_stage_base(void);
 };
 
@@ -92,11 +127,24 @@ class Builder: public Variables
    builderStackT b_stack;     ///< For storage successors.
    builderVec root;           ///< For storing main branches.
    std::string gro_opt;       ///< Current option for Grouper stage.
+   std::vector<std::string> gro_keys; ///< Key fields of current Grouper stage.
    bool groDive = false;      ///< If Grouper stage is present in current branch.
    std::string win_opt;       ///< Current option for Window stage.
-   std::string agg_opt;       ///< Current option for Aggregator stage.
+   /**
+    * \brief Aggregate function of current Aggregator.
+    */
+   struct Agg_item {
+      std::string variable;   ///< User variable.
+      std::string field;      ///< UniRec field computed by the function.
+      std::string option;     ///< Option for Aggregator stage.
+   };
+   std::vector<Agg_item> agg_items; ///< Aggregate functions of current Aggregator.
+   std::string agg_var;       ///< Variable of currently visited aggregate function.
    std::string sel_opt;       ///< Current option for Selector stage.
    bool selDive = false;      ///< If Selector stage is present in current branch.
+   int interface_counter = 0; ///< Index of output interface for next Selector stage.
+   Compiled_pipeline compiled; ///< Main branches compiled to flat program.
+   std::string warnings;      ///< Warnings printed while stages were created, stored to rule cache.
 
    /**
     * \brief Auxiliary function for proper nesting to the branch.
@@ -118,6 +166,67 @@ class Builder: public Variables
     */
    std::string apply_aliases(std::string stage_body, varsT *aliases, int body_id);
 
+   /**
+    * \brief Options of aggregate functions whose result is used by successors of Aggregator.
+    * \details Successors are built before, their bodies have variables replaced by UniRec fields.
+    *    Unused aggregate functions are reported and left out, so Aggregator does not compute them.
+    * \param[in] &succ builders of Aggregator successors.
+    * \return options of used aggregate functions.
+    */
+   std::string live_aggregates(builderVec const &succ);
+
+   /**
+    * \brief Move operands of group-filter which depend only on key fields in front of Aggregator.
+    * \details Key fields are the same in all records of a group, so record whose keys do not pass
+    *    such operand belongs to group which never passes the group-filter. Only group-filter
+    *    which is the only successor of Aggregator is changed, it keeps the other operands.
+    * \param[in] &succ builders of Aggregator successors.
+    * \return filter expression for records entering Aggregator, empty if nothing is moved.
+    */
+   std::string push_down_group_filter(builderVec const &succ);
+
+   /**
+    * \brief Check if admission (-H) keeps records sent by Aggregator consistent.
+    * \details Admitted group has estimated sum of records before admission only in its admission
+    *    field, other fields contain records since admission. So successors may read only key
+    *    fields and one COUNT or sum, which becomes the admission field.
+    * \param[in] &succ builders of Aggregator successors.
+    * \return true if admission can be used, otherwise Aggregator gets -X option.
+    */
+   bool admission_compatible(builderVec const &succ);
+
+   /**
+    * \return Aggregator options given by command line, appended to options from rules.
+    */
+   std::string aggregator_config_options(void);
+
+   /**
+    * \brief Initialize main branches and compile them.
+    * \return 0 on success, otherwise a negative error value.
+    */
+   int init_root(void);
+
+   /**
+    * \brief Create builder of cached stage and its successors.
+    * \param[in] &nodes cached stages in pre-order.
+    * \param[in,out] &pos index of the stage, moved behind its successors.
+    * \return new builder, NULL if cache is damaged.
+    */
+   Builder_stage_base* create_cached(std::vector<Rule_cache_node> const &nodes, size_t &pos);
+
+   /**
+    * \brief Add stage and its successors to cache.
+    * \param[in] *builder builder of the stage.
+    * \param[in,out] &nodes cached stages in pre-order.
+    */
+   void store_cached(Builder_stage_base *builder, std::vector<Rule_cache_node> &nodes);
+
+   /**
+    * \brief Print warning about created stages and keep it for rule cache.
+    * \param[in] &text warning without new line.
+    */
+   void warn(std::string const &text);
+
 public:
 
    /**
@@ -132,8 +241,45 @@ public:
     */
    int build(void);
 
+   /**
+    * \brief Create processing pipeline from cached stages instead of syntax tree.
+    * \param[in] &cache loaded rule cache.
+    * \return 0 on success, otherwise a negative error value.
+    */
+   int build(Rule_cache &cache);
+
+   /**
+    * \brief Store stages created by build(void) to cache.
+    * \param[out] &cache rule cache.
+    */
+   void store(Rule_cache &cache);
+
+   /**
+    * \brief Store stages of rules to cache without their initialization.
+    * \details Used when rules are only translated to source code (-A option).
+    * \param[out] &cache rule cache.
+    */
+   void describe(Rule_cache &cache);
+
+   /**
+    * \brief Create processing pipeline from reloaded rules, reuse unchanged branches of running one.
+    * \details Branch whose signature equals a branch of old builder is moved from the old builder
+    *    with its initialized stages and their state, other branches are initialized. Old builder
+    *    keeps only changed branches then. Nothing is moved if initialization fails.
+    * \param[in,out] &old builder of running pipeline.
+    * \param[out] &kept number of reused branches.
+    * \return 0 on success, otherwise a negative error value.
+    */
+   int rebuild(Builder &old, int &kept);
+
+   /**
+    * \return number of main branches.
+    */
+   size_t get_number_of_branches(void);
+
    /**
     * \brief This function call after build(void) method.
+    * \details Returns compiled pipeline unless graph of stage objects is requested (-G option).
     * \return main branches ready to processing records.
     */
    pipelineVec get_pipelineVec(void);
@@ -148,6 +294,7 @@ public:
    void operator() (grouper_stage const &gs) override;
    void operator() (window_stage const &ws) override;
    void operator() (aggregator_stage const &as) override;
+   void operator() (aggr_assignment const &aa) override;
    void operator() (aggr_func_with_param_s const &agf) override;
    void operator() (aggr_func_without_param const &agf) override;
    void operator() (group_filter_stage const &gfs) override;
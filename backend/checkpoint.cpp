@@ -0,0 +1,277 @@
+/**
+ * \file checkpoint.cpp
+ * \brief Definition of Checkpoint class.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#include "checkpoint.hpp"
+#include "aggregator/aggregator.hpp"
+#include "timer_service.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/** Description of failed step of Checkpoint::write_file() by its return value. */
+static char const *const write_errors[] = {
+   "",
+   "cannot create",
+   "cannot write",
+   "cannot rename",
+};
+
+int Checkpoint_writer::alloc(size_t size)
+{
+   buffer = (char*) malloc(size);
+   if (buffer == NULL) {
+      return -1;
+   }
+   capacity = size;
+   return 0;
+}
+
+int Checkpoint_writer::write(void const *data, size_t size)
+{
+   char const *src = (char const*) data;
+
+   while (size > 0) {
+      if (used == capacity && flush() != 0) {
+         return -1;
+      }
+      size_t part = size < capacity - used ? size : capacity - used;
+      memcpy(buffer + used, src, part);
+      used += part;
+      src += part;
+      size -= part;
+   }
+   return 0;
+}
+
+int Checkpoint_writer::flush(void)
+{
+   size_t done = 0;
+
+   while (done < used) {
+      ssize_t ret = ::write(fd, buffer + done, used - done);
+      if (ret < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         return -1;
+      }
+      done += ret;
+   }
+   used = 0;
+   return 0;
+}
+
+Checkpoint_writer::~Checkpoint_writer(void)
+{
+   free(buffer);
+}
+
+int Checkpoint::init(std::string const &spec)
+{
+   size_t colon = spec.rfind(':');
+
+   path = spec;
+   if (colon != std::string::npos && colon + 1 < spec.size() &&
+       spec.find_first_not_of("0123456789", colon + 1) == std::string::npos) {
+      path = spec.substr(0, colon);
+      interval = atoi(spec.c_str() + colon + 1);
+   }
+   if (path.empty() || interval <= 0) {
+      fprintf(stderr, "Error: checkpoint must be file optionally followed by :seconds > 0\n");
+      return -1;
+   }
+   // Forked child cannot allocate
+   tmp_path = path + ".tmp";
+   if (writer.alloc(CHECKPOINT_BUFFER_SIZE) != 0) {
+      fprintf(stderr, "Error: cannot allocate buffer of checkpoint\n");
+      return -1;
+   }
+   return 0;
+}
+
+int Checkpoint::write_file(void)
+{
+   int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+   if (fd < 0) {
+      return 1;
+   }
+
+   Checkpoint_header header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+   header.version = CHECKPOINT_VERSION;
+
+   int ret = 0;
+   writer.open(fd);
+   if (writer.write(&header, sizeof(header)) != 0 || Agg::write_state_all(writer) != 0 ||
+       writer.flush() != 0 || fsync(fd) != 0) {
+      ret = 2;
+   }
+   if (close(fd) != 0 && ret == 0) {
+      ret = 2;
+   }
+   if (ret == 0 && rename(tmp_path.c_str(), path.c_str()) != 0) {
+      ret = 3;
+   }
+   if (ret != 0) {
+      unlink(tmp_path.c_str());
+   }
+   return ret;
+}
+
+bool Checkpoint::reap_child(bool block)
+{
+   if (child < 0) {
+      return true;
+   }
+
+   int status;
+   pid_t ret;
+   while ((ret = waitpid(child, &status, WNOHANG)) == 0) {
+      if (time(NULL) - child_started >= CHECKPOINT_CHILD_TIMEOUT) {
+         fprintf(stderr, "Warning: checkpoint was not written in %d seconds, writing process is killed.\n",
+                 CHECKPOINT_CHILD_TIMEOUT);
+         kill(child, SIGKILL);
+         waitpid(child, &status, 0);
+         unlink(tmp_path.c_str());
+         child = -1;
+         return true;
+      }
+      if (!block) {
+         return false;
+      }
+      usleep(100000);
+   }
+   if (ret == child && WIFEXITED(status) && WEXITSTATUS(status) != 0 &&
+       WEXITSTATUS(status) < (int) (sizeof(write_errors) / sizeof(write_errors[0]))) {
+      fprintf(stderr, "Warning: checkpoint was not written (%s %s), the previous one is kept.\n",
+              write_errors[WEXITSTATUS(status)], tmp_path.c_str());
+   }
+   else if (ret == child && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+      fprintf(stderr, "Warning: checkpoint was not written, the previous one is kept.\n");
+   }
+   child = -1;
+   return true;
+}
+
+int Checkpoint::snapshot(void)
+{
+   time_t now = time(NULL);
+
+   // Previous checkpoint is still being written, watch it
+   if (!reap_child(false)) {
+      return 1;
+   }
+   if (now < next_snapshot) {
+      return next_snapshot - now;
+   }
+   next_snapshot = now + interval;
+
+   // Storage is consistent while forking, child gets copy-on-write image of it
+   Agg::lock_all();
+   pid_t pid = fork();
+   if (pid == 0) {
+      // Only this thread exists in child, locks held by it are enough.
+      // Locks of other threads (stdio, malloc) stay locked, only write() and friends are safe.
+      _exit(write_file());
+   }
+   Agg::unlock_all();
+
+   if (pid < 0) {
+      fprintf(stderr, "Warning: cannot fork for checkpoint: %s\n", strerror(errno));
+      return interval;
+   }
+   child = pid;
+   child_started = now;
+   return 1;
+}
+
+int Checkpoint::restore(void)
+{
+   int fd = open(path.c_str(), O_RDONLY);
+   if (fd < 0) {
+      // The first start, nothing to restore
+      return 0;
+   }
+
+   struct stat st;
+   if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(Checkpoint_header)) {
+      close(fd);
+      fprintf(stderr, "Error: checkpoint %s is damaged\n", path.c_str());
+      return -1;
+   }
+
+   char *data = (char*) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (data == MAP_FAILED) {
+      fprintf(stderr, "Error: cannot map checkpoint %s: %s\n", path.c_str(), strerror(errno));
+      return -1;
+   }
+   madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+   int ret = 0;
+   Checkpoint_header header;
+   memcpy(&header, data, sizeof(header));
+   if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 || header.version != CHECKPOINT_VERSION) {
+      fprintf(stderr, "Warning: checkpoint %s has unknown format, state is not restored\n", path.c_str());
+   }
+   else {
+      int restored = Agg::restore_state_all(data + sizeof(header), st.st_size - sizeof(header));
+      if (restored < 0) {
+         fprintf(stderr, "Error: checkpoint %s is damaged\n", path.c_str());
+         ret = -1;
+      }
+      else {
+         fprintf(stderr, "Restored state of %d aggregators from %s\n", restored, path.c_str());
+      }
+   }
+   munmap(data, st.st_size);
+   return ret;
+}
+
+void Checkpoint::start(void)
+{
+   next_snapshot = time(NULL) + interval;
+   timer_id = Timer_service::instance().add(interval, std::bind(&Checkpoint::snapshot, this));
+}
+
+int Checkpoint::finish(void)
+{
+   stop();
+
+   Agg::lock_all();
+   int ret = write_file();
+   int err = errno;
+   Agg::unlock_all();
+   if (ret != 0) {
+      fprintf(stderr, "Error: checkpoint was not written (%s %s): %s\n", write_errors[ret], tmp_path.c_str(),
+              strerror(err));
+      return -1;
+   }
+   Agg::set_state_saved_all();
+   return 0;
+}
+
+void Checkpoint::stop(void)
+{
+   Timer_service::instance().cancel(timer_id);
+   timer_id = -1;
+   reap_child(true);
+}
+
+Checkpoint::~Checkpoint(void)
+{
+   stop();
+}
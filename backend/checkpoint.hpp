@@ -0,0 +1,159 @@
+/**
+ * \file checkpoint.hpp
+ * \brief Periodic snapshots of aggregator state and its restore after restart.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#if !defined(CHECKPOINT_H)
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <time.h>
+
+/** Identifies checkpoint file. */
+#define CHECKPOINT_MAGIC "PLCRCKPT"
+/** Version of checkpoint format, file of other version is not restored. */
+#define CHECKPOINT_VERSION 1
+/** Seconds between checkpoints if not given. */
+#define CHECKPOINT_DEFAULT_INTERVAL 60
+/** Bytes of buffer through which checkpoint is written. */
+#define CHECKPOINT_BUFFER_SIZE (1 << 20)
+/** Seconds after which process writing checkpoint is considered hung and killed. */
+#define CHECKPOINT_CHILD_TIMEOUT 300
+
+/**
+ * \brief Header of checkpoint file, followed by state of aggregators (see Agg::write_state_all).
+ */
+struct Checkpoint_header {
+   char magic[8];      ///< CHECKPOINT_MAGIC without terminating zero.
+   uint32_t version;   ///< CHECKPOINT_VERSION.
+   uint32_t reserved;  ///< Zero.
+};
+
+/**
+ * \brief Buffered output to file descriptor.
+ * \details Uses only memcpy() and write(), buffer is allocated before fork(),
+ *    so it can be used by forked child of multithreaded process.
+ */
+class Checkpoint_writer
+{
+   int fd = -1;          ///< Output file.
+   char *buffer = NULL;  ///< Data not written yet.
+   size_t capacity = 0;  ///< Bytes of buffer.
+   size_t used = 0;      ///< Bytes of data in buffer.
+
+public:
+
+   /**
+    * \brief Allocate buffer.
+    * \param[in] size bytes of buffer.
+    * \return 0 on success, -1 if memory cannot be allocated.
+    */
+   int alloc(size_t size);
+
+   /**
+    * \brief Start writing to file.
+    * \param[in] file opened file descriptor.
+    */
+   void open(int file)
+   {
+      fd = file;
+      used = 0;
+   }
+
+   /**
+    * \brief Append data, full buffer is written to file.
+    * \return 0 on success, -1 on write error.
+    */
+   int write(void const *data, size_t size);
+
+   /**
+    * \brief Write buffered data to file.
+    * \return 0 on success, -1 on write error.
+    */
+   int flush(void);
+
+   ~Checkpoint_writer(void);
+};
+
+/**
+ * \brief Saves state of all aggregators to file and restores it on start.
+ * \details Periodic checkpoint locks storage of all aggregators only for fork(), child process
+ *    writes its copy-on-write image of storage to temporary file and renames it over
+ *    the checkpoint, so the file is always complete. Processing continues meanwhile.
+ *    Other threads may hold locks of stdio or malloc at fork(), so the child uses only
+ *    async-signal-safe calls and buffer and file names prepared before. Child which does not
+ *    end in CHECKPOINT_CHILD_TIMEOUT seconds is killed.
+ *    When the module is stopped by signal, the last checkpoint is written directly and
+ *    aggregators do not flush partial windows. Restore maps the file to memory.
+ */
+class Checkpoint
+{
+   std::string path;            ///< Checkpoint file.
+   std::string tmp_path;        ///< Temporary file renamed to path when it is complete.
+   Checkpoint_writer writer;    ///< Output of write_file().
+   int interval = CHECKPOINT_DEFAULT_INTERVAL; ///< Seconds between checkpoints.
+   int timer_id = -1;           ///< Timer in Timer_service, -1 if not started.
+   time_t next_snapshot = 0;    ///< Time of the next checkpoint.
+   pid_t child = -1;            ///< Process writing checkpoint, -1 if none.
+   time_t child_started = 0;    ///< When child was forked.
+
+   /**
+    * \brief Write state of aggregators to temporary file and rename it to path.
+    * \details Does not print anything, so it can run in forked child.
+    * \return 0 on success, otherwise index of failed step to write_errors.
+    */
+   int write_file(void);
+
+   /**
+    * \brief Collect finished child process, kill it if it runs longer than CHECKPOINT_CHILD_TIMEOUT.
+    * \param[in] block wait until child ends.
+    * \return true if no child is running.
+    */
+   bool reap_child(bool block);
+
+   /**
+    * \brief Fork process which writes checkpoint, called by timer.
+    * \details While child runs, it is checked every second.
+    * \return seconds to the next call.
+    */
+   int snapshot(void);
+
+public:
+
+   /**
+    * \brief Set checkpoint file and interval.
+    * \param[in] spec file optionally followed by :seconds.
+    * \return 0 on success, -1 on invalid interval.
+    */
+   int init(std::string const &spec);
+
+   /**
+    * \brief Restore state of aggregators if checkpoint file exists. Call after pipelines are built.
+    * \return 0 on success or if there is no checkpoint, -1 on damaged file.
+    */
+   int restore(void);
+
+   /**
+    * \brief Start periodic checkpoints.
+    */
+   void start(void);
+
+   /**
+    * \brief Stop periodic checkpoints and write the last one, aggregators then do not flush.
+    * \return 0 on success, -1 on error (aggregators flush as usual).
+    */
+   int finish(void);
+
+   /**
+    * \brief Stop periodic checkpoints without writing.
+    */
+   void stop(void);
+
+   ~Checkpoint(void);
+};
+
+#endif /* checkpoint_h */
@@ -0,0 +1,182 @@
+/**
+ * \file compiled_pipeline.cpp
+ * \brief Definition of Compiled_pipeline class.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#include "aggregator/aggregator.hpp"
+#include "builder.hpp"
+#include "compiled_pipeline.hpp"
+#include "filter/filter.hpp"
+#include "selector/selector.hpp"
+
+#include <stdio.h>
+
+int Compiled_pipeline::emit(Builder_stage_base *builder, int parent)
+{
+   Stage_intf *stage = builder->get_my_stage();
+   builderVec const &next = builder->get_next_builders();
+   Op op = {};
+
+   op.parent = parent;
+   if ((op.filter = dynamic_cast<Filter*>(stage)) != NULL) {
+      if (op.filter->is_unsatisfiable()) {
+         /* No record reaches the subtree. */
+         return 0;
+      }
+      Stage_intf *succ = next.size() == 1 ? next.front()->get_my_stage() : NULL;
+
+      if ((op.selector = dynamic_cast<Selector*>(succ)) != NULL) {
+         op.kind = OP_FILTER_SELECTOR;
+      } else if ((op.agg = dynamic_cast<Agg*>(succ)) != NULL) {
+         op.kind = OP_FILTER_AGG;
+      } else {
+         op.kind = OP_FILTER;
+      }
+   } else if ((op.selector = dynamic_cast<Selector*>(stage)) != NULL) {
+      op.kind = OP_SELECTOR;
+   } else if ((op.agg = dynamic_cast<Agg*>(stage)) != NULL) {
+      /* Successors of Aggregator get records from Aggregator itself. */
+      op.kind = OP_AGG;
+   } else {
+      op.kind = OP_STAGE;
+      op.stage = stage;
+   }
+
+   int index = program.size();
+   int ret = 0;
+
+   program.push_back(op);
+   if (op.kind == OP_FILTER) {
+      for (auto const &item: next) {
+         ret |= emit(item, index);
+      }
+   }
+   program[index].end = program.size();
+   return ret;
+}
+
+int Compiled_pipeline::compile(std::vector<Builder_stage_base*> const &roots)
+{
+   int ret = 0;
+
+   program.clear();
+   for (auto const &item: roots) {
+      ret |= emit(item, -1);
+   }
+   sel.resize(program.size());
+   return ret;
+}
+
+int Compiled_pipeline::init(char const * /* options */, const std::vector<Stage_intf*> /* succ */)
+{
+   return 0;
+}
+
+int Compiled_pipeline::eval(void const *rec, ur_template_t const *in_tmplt)
+{
+   Op const *ops = program.data();
+   size_t n_ops = program.size();
+   size_t i = 0;
+   int ret = 0;
+
+   while (i < n_ops) {
+      Op const &op = ops[i];
+
+      switch (op.kind) {
+      case OP_FILTER:
+         if (!op.filter->match(rec, in_tmplt)) {
+            /* Skip whole subtree of filter. */
+            i = op.end;
+            continue;
+         }
+         break;
+      case OP_FILTER_SELECTOR:
+         if (op.filter->match(rec, in_tmplt)) {
+            ret |= op.selector->Selector::eval(rec, in_tmplt);
+         }
+         break;
+      case OP_FILTER_AGG:
+         if (op.filter->match(rec, in_tmplt)) {
+            ret |= op.agg->Agg::eval(rec, in_tmplt);
+         }
+         break;
+      case OP_SELECTOR:
+         ret |= op.selector->Selector::eval(rec, in_tmplt);
+         break;
+      case OP_AGG:
+         ret |= op.agg->Agg::eval(rec, in_tmplt);
+         break;
+      case OP_STAGE:
+         ret |= op.stage->eval(rec, in_tmplt);
+         break;
+      }
+      i++;
+   }
+   return ret;
+}
+
+int Compiled_pipeline::eval_batch(Record_batch const &batch, uint16_t const *in_sel, size_t n_sel)
+{
+   ur_template_t const *tmplt = batch.get_template();
+   size_t n_ops = program.size();
+   size_t i = 0;
+   int ret = 0;
+
+   while (i < n_ops) {
+      Op const &op = program[i];
+      uint16_t const *cur = in_sel;
+      size_t n_cur = n_sel;
+
+      if (op.parent >= 0) {
+         cur = sel[op.parent].data();
+         n_cur = sel[op.parent].size();
+      }
+
+      switch (op.kind) {
+      case OP_FILTER:
+         op.filter->select(batch, cur, n_cur, sel[i]);
+         if (sel[i].empty()) {
+            i = op.end;
+            continue;
+         }
+         break;
+      case OP_FILTER_SELECTOR:
+         op.filter->select(batch, cur, n_cur, sel[i]);
+         for (auto const &idx: sel[i]) {
+            ret |= op.selector->Selector::eval(batch.row(idx), tmplt);
+         }
+         break;
+      case OP_FILTER_AGG:
+         op.filter->select(batch, cur, n_cur, sel[i]);
+         ret |= op.agg->Agg::eval_batch(batch, sel[i].data(), sel[i].size());
+         break;
+      case OP_SELECTOR:
+         for (size_t j = 0; j < n_cur; j++) {
+            ret |= op.selector->Selector::eval(batch.row(cur[j]), tmplt);
+         }
+         break;
+      case OP_AGG:
+         ret |= op.agg->Agg::eval_batch(batch, cur, n_cur);
+         break;
+      case OP_STAGE:
+         ret |= op.stage->eval_batch(batch, cur, n_cur);
+         break;
+      }
+      i++;
+   }
+   return ret;
+}
+
+void Compiled_pipeline::print(void) const
+{
+   static char const *names[] = {
+      "filter", "filter+selector", "filter+aggregator", "selector", "aggregator", "stage"
+   };
+
+   for (size_t i = 0; i < program.size(); i++) {
+      fprintf(stderr, "%3zu: %-18s parent %3d end %3zu\n", i, names[program[i].kind],
+              program[i].parent, program[i].end);
+   }
+}
@@ -0,0 +1,112 @@
+/**
+ * \file compiled_pipeline.hpp
+ * \brief Processing pipelines compiled to flat program.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#if !defined(COMPILED_PIPELINE_H)
+#define COMPILED_PIPELINE_H
+
+#include "batch.hpp"
+#include "interface.hpp"
+
+#include <stdint.h>
+#include <vector>
+
+#include <unirec/unirec.h>
+
+class Agg;
+class Builder_stage_base;
+class Filter;
+class Selector;
+
+/**
+ * \brief All main branches of rules compiled to one flat program of stage operations.
+ * \details Stages are laid out in the same depth-first order in which send() visits them.
+ *    Every Filter operation knows the index behind its subtree, so rejected record
+ *    jumps over it. Stages are called directly by their type, not through Stage_intf.
+ *    Filter with single Selector or Aggregator successor is fused into one operation.
+ *    Filter which never matches is left out with its subtree.
+ *    Outputs of Aggregators still go through send(), because they are produced
+ *    by Aggregator itself (flush of window, timeout).
+ *
+ *    Stages are owned by builders, program only points to them.
+ */
+class Compiled_pipeline: public Stage_intf
+{
+   /** Type of operation. */
+   enum op_kind {
+      OP_FILTER,          ///< Filter with subtree behind it.
+      OP_FILTER_SELECTOR, ///< Filter fused with its only successor Selector.
+      OP_FILTER_AGG,      ///< Filter fused with its only successor Aggregator.
+      OP_SELECTOR,
+      OP_AGG,
+      OP_STAGE            ///< Other stage, called through Stage_intf with its own successors.
+   };
+
+   /**
+    * \brief One operation of program.
+    */
+   struct Op {
+      op_kind kind;
+      Filter *filter;     ///< OP_FILTER*: evaluated filter.
+      Selector *selector; ///< OP_SELECTOR, OP_FILTER_SELECTOR: output stage.
+      Agg *agg;           ///< OP_AGG, OP_FILTER_AGG: aggregation stage.
+      Stage_intf *stage;  ///< OP_STAGE: stage of unknown type.
+      size_t end;         ///< Index of the first operation behind subtree of this operation.
+      int parent;         ///< Index of operation whose output is input of this one, -1 for roots.
+   };
+
+   std::vector<Op> program;                 ///< Operations in depth-first order.
+   std::vector<std::vector<uint16_t> > sel; ///< Output selection of every operation for batches.
+
+   /**
+    * \brief Append operation for stage of builder and its subtree.
+    * \param[in] *builder builder of the stage.
+    * \param[in] parent index of parent operation.
+    * \return 0 on success, otherwise a negative error value.
+    */
+   int emit(Builder_stage_base *builder, int parent);
+
+public:
+
+   /**
+    * \brief Compile pipelines of initialized builders.
+    * \param[in] &roots builders of main branches.
+    * \return 0 on success, otherwise a negative error value.
+    */
+   int compile(std::vector<Builder_stage_base*> const &roots);
+
+   /**
+    * \brief Program is made by compile(), nothing to do.
+    * \return 0
+    */
+   int init(char const *options, const std::vector<Stage_intf*> succ);
+
+   /**
+    * \brief Run program for one record.
+    * \param[in] *rec record for processing.
+    * \param[in] *in_tmplt unirec template of input record.
+    * \return 0 on success, otherwise a negative error value.
+    */
+   int eval(void const *rec, ur_template_t const *in_tmplt);
+
+   /**
+    * \brief Run program for selected records of batch.
+    * \details Every operation works over the whole selection before the next operation starts,
+    *    as stages do with send_batch().
+    * \param[in] &batch records for processing.
+    * \param[in] *in_sel indexes of selected records in batch.
+    * \param[in] n_sel number of selected records.
+    * \return 0 on success, otherwise a negative error value.
+    */
+   int eval_batch(Record_batch const &batch, uint16_t const *in_sel, size_t n_sel);
+
+   /**
+    * \brief Print program to stderr. For debugging.
+    */
+   void print(void) const;
+};
+
+#endif /* compiled_pipeline_h */
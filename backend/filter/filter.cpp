@@ -7,6 +7,8 @@
  */
 
 #include "filter.hpp"
+#include "filter_jit.hpp"
+#include "filter_optimizer.hpp"
 #include "../fields.h"
 #include "../interface.hpp"
 
@@ -23,6 +25,15 @@ ff3_error_t data_func(struct ff3_s *filter, void const *rec, ff3_extern_id_t id,
 ff3_error_t rval_map_func(struct ff3_s *, const char *, ff3_type_t, ff3_extern_id_t, char *, size_t *);
 ff3_error_t lookup_func(struct ff3_s * /* filter */ , const char *fieldstr, ff3_lvalue_t * lvalue);
 
+/*
+ * Template of evaluated record, source of computed fields and buffers for converted IPv4 address
+ * and computed value. Thread local, so more threads can evaluate one filter at once.
+ */
+static thread_local ur_template_t const *eval_tmplt = NULL;
+static thread_local Field_source const *eval_source = NULL;
+static thread_local uint64_t ip4_buf[2];
+static thread_local uint64_t value_buf[2];
+
 
 /**
  * Data Callback signature
@@ -35,25 +46,32 @@ ff3_error_t lookup_func(struct ff3_s * /* filter */ , const char *fieldstr, ff3_
  * \param[in/out] buf    in - Pointer to buffer, out - Pointer to buffer with retrieved data
  * \param[in/out] vsize  in - Size of passed buffer, out - size of valid data in buffer
  */
-ff3_error_t data_func(struct ff3_s *filter, void const *rec, ff3_extern_id_t id, char **data,
+ff3_error_t data_func(struct ff3_s * /* filter */ , void const *rec, ff3_extern_id_t id, char **data,
                       size_t * /* size */ )
 {
+   if (eval_source != NULL) {
+      char const *value = eval_source->value(rec, id.index, value_buf);
+
+      if (value != NULL) {
+         *data = (char*) value;
+         return FF_OK;
+      }
+   }
+
    if (ur_get_type(id.index) == UR_TYPE_IP) {
 
-      const ip_addr_t *addr =
-         (const ip_addr_t*) (ur_get_ptr_by_id(static_cast<ur_template_t const*>(filter->in_tmplt), rec, id.index));
+      const ip_addr_t *addr = (const ip_addr_t*) (ur_get_ptr_by_id(eval_tmplt, rec, id.index));
 
       if (ip_is4(addr)) {
-         filter->ui64[0] = (*addr).ui64[0];
-         filter->ui64[1] = (*addr).ui64[1];
-         filter->ui64[1] <<= 32;
-         *data = (char *) (&filter->ui64);
+         ip4_buf[0] = (*addr).ui64[0];
+         ip4_buf[1] = (*addr).ui64[1];
+         ip4_buf[1] <<= 32;
+         *data = (char *) (&ip4_buf);
          return FF_OK;
       }
    }
 
-   *data =
-      (char*) (ur_get_ptr_by_id(static_cast<ur_template_t const*>(filter->in_tmplt), rec, id.index));
+   *data = (char*) (ur_get_ptr_by_id(eval_tmplt, rec, id.index));
 
    return FF_OK;
 }
@@ -155,6 +173,21 @@ int Filter::init(char const *options, const std::vector<Stage_intf*>succ)
    callbacks->ff3_lookup_func = lookup_func;
    callbacks->ff3_rval_map_func = rval_map_func;
    if (ff3_init(&filter, options, callbacks) == FF_OK) {
+      filter->root = Filter_optimizer::optimize(filter->root);
+      unsatisfiable = Filter_optimizer::is_false(filter->root);
+      if (unsatisfiable) {
+         std::cerr << "Warning: filter \"" << options << "\" never matches, stages behind it get no records"
+                   << std::endl;
+      }
+      use_kernels = kernels.compile(filter->root) == 0;
+      native_match = aot_find_filter(options);
+      if (native_match == NULL && Filter_jit::instance().is_enabled()) {
+         /* Interpreted until compiled function is loaded, reload does not wait for compiler. */
+         std::string body;
+         if (generate(body, false) == 0) {
+            jit_job = Filter_jit::instance().request(body, &native_match);
+         }
+      }
       return 0;
    } else {
       char msg[300];
@@ -164,19 +197,113 @@ int Filter::init(char const *options, const std::vector<Stage_intf*>succ)
    }
 }
 
-int Filter::eval(void const *rec, ur_template_t const *in_tmplt)
+bool Filter::interpret(void const *rec, ur_template_t const *in_tmplt)
+{
+   eval_tmplt = in_tmplt;
+   return ff3_eval(filter, rec) != 0;
+}
+
+bool Filter::match(void const *rec, ur_template_t const *in_tmplt)
 {
-   filter->in_tmplt = (void const *) in_tmplt;
-   int res = ff3_eval(filter, rec);
+   aot_filter_func native = native_match.load(std::memory_order_acquire);
+   if (native != NULL) {
+      int ret = native(rec, in_tmplt);
+      if (ret >= 0) {
+         return ret;
+      }
+   }
+   return interpret(rec, in_tmplt);
+}
 
-   if (res != 0) {
+bool Filter::match(void const *rec, ur_template_t const *in_tmplt, Field_source const *source)
+{
+   /* Compiled expression reads only values stored in record. */
+   eval_source = source;
+   bool ret = interpret(rec, in_tmplt);
+   eval_source = NULL;
+   return ret;
+}
+
+int Filter::generate(std::string &body, bool static_ids) const
+{
+   std::string expr;
+   std::vector<std::string> fields;
+
+   if (!use_kernels || kernels.generate(expr, fields, static_ids) != 0) {
+      return -1;
+   }
+
+   std::string present;
+   for (auto const &field: fields) {
+      present += (present.empty() ? "!ur_is_present(tmplt, " : " || !ur_is_present(tmplt, ") + field + ")";
+   }
+   body = "   if (" + present + ") {\n      return -1;\n   }\n";
+   body += "   return " + expr + ";\n";
+   return 0;
+}
+
+bool Filter::get_lower_bound(int id, uint64_t &bound) const
+{
+   return filter != NULL && Filter_kernels::lower_bound(filter->root, id, bound);
+}
+
+int Filter::eval(void const *rec, ur_template_t const *in_tmplt)
+{
+   if (match(rec, in_tmplt)) {
       send(rec, in_tmplt);
    }
    return 0;
 }
 
+void Filter::select(Record_batch const &batch, uint16_t const *sel, size_t n_sel,
+                    std::vector<uint16_t> &out)
+{
+   out.clear();
+   if (!use_kernels) {
+      for (size_t i = 0; i < n_sel; i++) {
+         if (match(batch.row(sel[i]), batch.get_template())) {
+            out.push_back(sel[i]);
+         }
+      }
+      return;
+   }
+   eval_tmplt = batch.get_template();
+   kernels.bind(batch);
+
+   /* Selection vector to bitmask, one word per group of records. */
+   size_t n_words = (batch.size() + KERNEL_WIDTH - 1) / KERNEL_WIDTH;
+   sel_bits.assign(n_words, 0);
+   for (size_t i = 0; i < n_sel; i++) {
+      sel_bits[sel[i] / KERNEL_WIDTH] |= 1U << (sel[i] % KERNEL_WIDTH);
+   }
+
+   for (size_t w = 0; w < n_words; w++) {
+      if (sel_bits[w] == 0) {
+         continue;
+      }
+      uint32_t res = kernels.eval(batch, w * KERNEL_WIDTH, sel_bits[w], filter);
+
+      for (; res; res &= res - 1) {
+         out.push_back(w * KERNEL_WIDTH + __builtin_ctz(res));
+      }
+   }
+}
+
+int Filter::eval_batch(Record_batch const &batch, uint16_t const *sel, size_t n_sel)
+{
+   select(batch, sel, n_sel, out_sel);
+   send_batch(batch, out_sel.data(), out_sel.size());
+   return 0;
+}
+
 Filter::~Filter()
 {
-   ff3_options_free(callbacks);
-   ff3_free(filter);
+   Filter_jit::instance().cancel(jit_job);
+   /* Stage of reloaded branch can be destroyed without initialization. */
+   if (callbacks != NULL) {
+      ff3_options_free(callbacks);
+   }
+   if (filter != NULL) {
+      ff3_free(filter);
+   }
 }
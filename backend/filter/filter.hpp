@@ -6,19 +6,56 @@
  * \date 2020
  */
 
+#if !defined(FILTER_H)
+#define FILTER_H
+
+#include "../aot.hpp"
 #include "../interface.hpp"
+#include "filter_kernels.hpp"
 
 extern "C" {
 #include "ffilter.h"
 }
 
+#include <atomic>
+
+/**
+ * \brief Values of fields which are not stored in evaluated record in their final form.
+ * \details Lets stage evaluate filter on its internal records, e.g. Aggregator
+ *    on stored records before average or count distinct is computed.
+ */
+struct Field_source {
+
+   /**
+    * \param[in] *rec evaluated record.
+    * \param[in] id UniRec ID of field.
+    * \param[out] *buf buffer for computed value, 16 bytes.
+    * \return pointer to value, NULL if value is read from record as it is.
+    */
+   virtual char const* value(void const *rec, int id, uint64_t *buf) const = 0;
+
+   virtual ~Field_source(void) {};
+};
+
 /**
  * Implementation of Filter in pipeline.
  */
 class Filter: public Stage_intf
 {
    ff3_t *filter = NULL;     ///< Pointer to netflow filter implementation from ffilter.h
-   ff3_options_t *callbacks; ///< Callbacks function for ffilter.
+   ff3_options_t *callbacks = NULL; ///< Callbacks function for ffilter.
+   Filter_kernels kernels;   ///< Filter expression compiled for batches.
+   bool use_kernels = false; ///< If filter expression contains comparisons supported by kernels.
+   std::vector<uint32_t> sel_bits; ///< Selected records of batch as bitmask.
+   std::vector<uint16_t> out_sel;  ///< Records of batch which pass the filter.
+   std::atomic<aot_filter_func> native_match{NULL}; ///< Expression compiled ahead of time or at runtime, NULL if interpreted.
+   int jit_job = -1;         ///< Compilation of expression by Filter_jit, -1 if none.
+   bool unsatisfiable = false; ///< If optimized filter expression is constant false.
+
+   /**
+    * \brief Evaluate filter expression by ffilter.
+    */
+   bool interpret(void const *rec, ur_template_t const *in_tmplt);
 
 public:
 
@@ -26,11 +63,64 @@ public:
     * \brief Initiate function for Filter. Call this function before records processing starts.
     * \param[in] *options settings for Filter class.
     *    In options is expected whole filter body (filter expression).
+    *    Parsed expression is simplified by Filter_optimizer.
     * \param[in] *succ vector of next immediate components in pipeline.
     * \return 0 on success, otherwise a negative error value.
     */
    int init(char const *options, const std::vector<Stage_intf*> succ);
 
+   /**
+    * \brief Evaluate filter expression without passing record to successors.
+    * \details Can be called by more threads at once.
+    * \param[in] *rec record for processing.
+    * \param[in] *in_tmplt unirec template of input record.
+    * \return true if record passes the filter.
+    */
+   bool match(void const *rec, ur_template_t const *in_tmplt);
+
+   /**
+    * \brief Evaluate filter expression on record whose fields are partly provided by source.
+    * \param[in] *rec record for processing.
+    * \param[in] *in_tmplt unirec template of input record.
+    * \param[in] *source values of fields not stored in rec in final form.
+    * \return true if record passes the filter.
+    */
+   bool match(void const *rec, ur_template_t const *in_tmplt, Field_source const *source);
+
+   /**
+    * \return true if no record can pass the filter.
+    */
+   bool is_unsatisfiable(void) const
+   {
+      return unsatisfiable;
+   }
+
+   /**
+    * \brief Find bound which field must exceed in every record passing the filter.
+    * \param[in] id UniRec ID of field.
+    * \param[out] &bound value which field must be greater than.
+    * \return true if filter contains such condition.
+    */
+   bool get_lower_bound(int id, uint64_t &bound) const;
+
+   /**
+    * \brief Translate filter expression to body of C/C++ function with signature of aot_filter_func.
+    * \details Function returns -1 if record misses some field, see Filter_kernels::generate().
+    * \param[out] &body statements of function.
+    * \param[in] static_ids reference fields by F_ macros instead of numeric IDs.
+    * \return 0 on success, -1 if expression must be interpreted.
+    */
+   int generate(std::string &body, bool static_ids) const;
+
+   /**
+    * \brief Evaluate filter over selected records of batch without passing them to successors.
+    * \param[in] &batch records for processing.
+    * \param[in] *sel indexes of selected records in batch, in ascending order.
+    * \param[in] n_sel number of selected records.
+    * \param[out] &out indexes of records which pass the filter, in ascending order.
+    */
+   void select(Record_batch const &batch, uint16_t const *sel, size_t n_sel, std::vector<uint16_t> &out);
+
    /**
     * \brief Start processing the record.
     * \param[in] *rec record for processing.
@@ -39,5 +129,27 @@ public:
     */
    int eval(void const *rec, ur_template_t const *in_tmplt);
 
+   /**
+    * \brief Pass record which already passed match() to successors without evaluating it again.
+    * \details Used by Aggregator, which evaluates its group filter before the group is finished.
+    * \param[in] *rec record for processing.
+    * \param[in] *in_tmplt unirec template of input record.
+    */
+   void forward(void const *rec, ur_template_t const *in_tmplt)
+   {
+      send(rec, in_tmplt);
+   }
+
+   /**
+    * \brief Evaluate filter over selected records of batch by vector kernels.
+    * \param[in] &batch records for processing.
+    * \param[in] *sel indexes of selected records in batch.
+    * \param[in] n_sel number of selected records.
+    * \return 0 on success, otherwise a negative error value.
+    */
+   int eval_batch(Record_batch const &batch, uint16_t const *sel, size_t n_sel);
+
    ~Filter();
 };
+
+#endif /* filter_h */
@@ -0,0 +1,288 @@
+/**
+ * \file filter_jit.cpp
+ * \brief Definition of Filter_jit class.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#include "filter_jit.hpp"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <iterator>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+/** Flags of compiler, objects depend on them. */
+static char const *const compiler_flags[] = {"-O3", "-march=native", "-shared", "-fPIC", "-w"};
+
+/**
+ * \brief 64 bit FNV-1a hash.
+ */
+static uint64_t hash_source(std::string const &text)
+{
+   uint64_t hash = 14695981039346656037ULL;
+
+   for (unsigned char c: text) {
+      hash ^= c;
+      hash *= 1099511628211ULL;
+   }
+   return hash;
+}
+
+Filter_jit& Filter_jit::instance(void)
+{
+   static Filter_jit jit;
+   return jit;
+}
+
+bool Filter_jit::is_trusted(std::string const &path, bool directory)
+{
+   struct stat st;
+
+   if (lstat(path.c_str(), &st) != 0) {
+      return false;
+   }
+   if ((directory ? !S_ISDIR(st.st_mode) : !S_ISREG(st.st_mode)) || st.st_uid != geteuid() ||
+       (st.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+      return false;
+   }
+   return true;
+}
+
+int Filter_jit::set_dir(std::string const &directory)
+{
+   if (!is_trusted(directory, true)) {
+      fprintf(stderr, "Error: directory of compiled filters %s must be owned by the user running the module "
+              "and not writable by group or others\n", directory.c_str());
+      return -1;
+   }
+   dir = directory;
+   return 0;
+}
+
+std::string Filter_jit::describe_toolchain(void)
+{
+   char const *cc = getenv("CC");
+   if (cc == NULL || *cc == '\0') {
+      cc = "cc";
+   }
+   std::string text = cc;
+   char line[4096];
+
+   for (char const *flag: compiler_flags) {
+      text += std::string(" ") + flag;
+   }
+   text += "\n";
+
+   /* Another version of compiler can generate other code. */
+   std::string command = std::string(cc) + " --version 2>/dev/null";
+   FILE *pipe = popen(command.c_str(), "r");
+   if (pipe != NULL) {
+      while (fgets(line, sizeof(line), pipe) != NULL) {
+         text += line;
+      }
+      pclose(pipe);
+   }
+
+   /* -march=native, code for one CPU can end with SIGILL on another one. First processor is enough. */
+   static char const *const cpu_keys[] = {"vendor_id", "cpu family", "model", "stepping", "flags",
+                                          "CPU implementer", "CPU architecture", "CPU variant", "CPU part",
+                                          "Features"};
+   FILE *cpuinfo = fopen("/proc/cpuinfo", "r");
+   if (cpuinfo != NULL) {
+      while (fgets(line, sizeof(line), cpuinfo) != NULL && line[0] != '\n') {
+         for (char const *key: cpu_keys) {
+            if (strncmp(line, key, strlen(key)) == 0) {
+               text += line;
+               break;
+            }
+         }
+      }
+      fclose(cpuinfo);
+   }
+   return text;
+}
+
+int Filter_jit::compile(std::string const &source, std::string const &object)
+{
+   char const *cc = getenv("CC");
+   if (cc == NULL || *cc == '\0') {
+      cc = "cc";
+   }
+
+   std::vector<char const*> argv = {cc};
+   argv.insert(argv.end(), std::begin(compiler_flags), std::end(compiler_flags));
+   argv.insert(argv.end(), {"-o", object.c_str(), source.c_str(), NULL});
+
+   pid_t pid = fork();
+   if (pid == 0) {
+      execvp(cc, (char* const*) argv.data());
+      _exit(127);
+   }
+   if (pid < 0) {
+      fprintf(stderr, "Warning: cannot fork compiler of filter: %s\n", strerror(errno));
+      return -1;
+   }
+
+   int status;
+   while (waitpid(pid, &status, 0) < 0) {
+      if (errno != EINTR) {
+         return -1;
+      }
+   }
+   if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "Warning: %s failed to compile %s, filter is interpreted\n", cc, source.c_str());
+      return -1;
+   }
+   return 0;
+}
+
+aot_filter_func Filter_jit::get(std::string const &body)
+{
+   std::string source = "#include <stdbool.h>\n#include <stdint.h>\n#include <unirec/unirec.h>\n\n";
+   source += "int " FILTER_JIT_SYMBOL "(void const *rec, ur_template_t const *tmplt)\n{\n" + body + "}\n";
+
+   if (toolchain.empty()) {
+      toolchain = describe_toolchain();
+   }
+   uint64_t hash = hash_source(toolchain + source);
+
+   auto it = loaded.find(hash);
+   if (it != loaded.end()) {
+      return it->second;
+   }
+
+   /* Objects of directory which other user can modify are not loaded. */
+   if (!is_trusted(dir, true)) {
+      fprintf(stderr, "Warning: directory %s can be modified by other user, filter is interpreted\n", dir.c_str());
+      loaded[hash] = NULL;
+      return NULL;
+   }
+
+   char name[32];
+   snprintf(name, sizeof(name), "/filter_%016" PRIx64, hash);
+   std::string object = dir + name + ".so";
+
+   if (access(object.c_str(), R_OK) != 0) {
+      /* Write to temporary files, other process can compile the same expression at once. */
+      std::string tmp = dir + name + "." + std::to_string(getpid());
+      std::string src = tmp + ".c";
+      std::string tmp_object = tmp + ".so";
+      FILE *file = fopen(src.c_str(), "w");
+
+      if (file == NULL) {
+         fprintf(stderr, "Warning: cannot create %s: %s, filter is interpreted\n", src.c_str(), strerror(errno));
+         loaded[hash] = NULL;
+         return NULL;
+      }
+      bool ok = fputs(source.c_str(), file) >= 0;
+      ok = fclose(file) == 0 && ok;
+      ok = ok && compile(src, tmp_object) == 0 && chmod(tmp_object.c_str(), S_IRWXU) == 0 &&
+           rename(tmp_object.c_str(), object.c_str()) == 0;
+      if (!ok) {
+         /* Source is kept for inspection. */
+         unlink(tmp_object.c_str());
+         loaded[hash] = NULL;
+         return NULL;
+      }
+      unlink(src.c_str());
+   }
+
+   aot_filter_func func = NULL;
+   void *handle = NULL;
+   if (!is_trusted(object, false)) {
+      fprintf(stderr, "Warning: %s is not a regular file of the user or it is writable by others, "
+              "filter is interpreted\n", object.c_str());
+   } else if ((handle = dlopen(object.c_str(), RTLD_NOW | RTLD_LOCAL)) == NULL) {
+      fprintf(stderr, "Warning: cannot load %s: %s, filter is interpreted\n", object.c_str(), dlerror());
+   } else {
+      func = (aot_filter_func) dlsym(handle, FILTER_JIT_SYMBOL);
+      if (func == NULL) {
+         fprintf(stderr, "Warning: %s has no " FILTER_JIT_SYMBOL ", filter is interpreted\n", object.c_str());
+         dlclose(handle);
+      }
+   }
+   loaded[hash] = func;
+   return func;
+}
+
+int Filter_jit::request(std::string const &body, std::atomic<aot_filter_func> *target)
+{
+   std::lock_guard<std::mutex> lock(mutex);
+   int id = next_id++;
+
+   jobs.push_back({id, body, target});
+   if (!worker.joinable()) {
+      stopping = false;
+      worker = std::thread(&Filter_jit::run, this);
+   }
+   wake.notify_one();
+   return id;
+}
+
+void Filter_jit::cancel(int id)
+{
+   if (id < 0) {
+      return;
+   }
+   std::unique_lock<std::mutex> lock(mutex);
+
+   for (auto it = jobs.begin(); it != jobs.end(); ++it) {
+      if (it->id == id) {
+         jobs.erase(it);
+         return;
+      }
+   }
+   done.wait(lock, [this, id]() { return running != id; });
+}
+
+void Filter_jit::run(void)
+{
+   std::unique_lock<std::mutex> lock(mutex);
+
+   while (!stopping) {
+      if (jobs.empty()) {
+         wake.wait(lock);
+         continue;
+      }
+      Job job = jobs.front();
+      jobs.pop_front();
+
+      /* Compiler runs unlocked, records are interpreted meanwhile. */
+      running = job.id;
+      lock.unlock();
+      aot_filter_func func = get(job.body);
+      lock.lock();
+      if (func != NULL) {
+         job.target->store(func);
+      }
+      running = -1;
+      done.notify_all();
+   }
+}
+
+void Filter_jit::stop(void)
+{
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+
+      stopping = true;
+      jobs.clear();
+      wake.notify_one();
+   }
+   if (worker.joinable()) {
+      worker.join();
+   }
+}
+
+Filter_jit::~Filter_jit(void)
+{
+   stop();
+}
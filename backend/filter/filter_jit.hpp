@@ -0,0 +1,134 @@
+/**
+ * \file filter_jit.hpp
+ * \brief Filter expressions compiled to native code at runtime.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#if !defined(FILTER_JIT_H)
+#define FILTER_JIT_H
+
+#include "../aot.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+/** Name of function in compiled shared object. */
+#define FILTER_JIT_SYMBOL "policer_filter"
+
+/**
+ * \brief Compiles generated C source of filter expression by local compiler and loads it by dlopen.
+ * \details Expressions are compiled by own thread, filter is interpreted until its function is loaded.
+ *    Shared objects are kept in directory under hash of their source, compiler, its flags
+ *    and CPU, so the same expression with the same field IDs is compiled only once, also across
+ *    runs of the module. Directory and objects are loaded only if they are owned by the effective
+ *    user and nobody else can write to them. Compiler is taken from CC environment variable,
+ *    cc by default. Loaded objects stay loaded until the module ends.
+ */
+class Filter_jit
+{
+   /**
+    * \brief Expression waiting for compilation.
+    */
+   struct Job {
+      int id;                               ///< ID returned by request().
+      std::string body;                     ///< Body of function generated by Filter::generate().
+      std::atomic<aot_filter_func> *target; ///< Where loaded function is stored.
+   };
+
+   std::string dir;                ///< Directory of sources and shared objects, empty if disabled.
+   std::string toolchain;          ///< Compiler, its version and flags and CPU, empty until the first job.
+   std::deque<Job> jobs;           ///< Expressions waiting for compilation.
+   std::mutex mutex;               ///< For jobs, running and stopping.
+   std::condition_variable wake;   ///< Wakes the thread when job is added.
+   std::condition_variable done;   ///< Wakes cancel() when job ends.
+   std::thread worker;             ///< Thread compiling expressions.
+   int next_id = 0;                ///< ID of the next job.
+   int running = -1;               ///< ID of job being compiled, -1 if none.
+   bool stopping = false;          ///< If the thread should end.
+   std::unordered_map<uint64_t, aot_filter_func> loaded; ///< Loaded functions by hash, used by the thread only.
+
+   /**
+    * \brief Run compiler on source.
+    * \return 0 on success, -1 on error.
+    */
+   int compile(std::string const &source, std::string const &object);
+
+   /**
+    * \return identification of compiler, its flags and CPU which compiled code depends on.
+    */
+   static std::string describe_toolchain(void);
+
+   /**
+    * \brief Check that file cannot be replaced by other user.
+    * \param[in] &path directory or regular file.
+    * \param[in] directory if path should be directory.
+    * \return true if path is owned by effective user and it is not writable by group or others.
+    */
+   static bool is_trusted(std::string const &path, bool directory);
+
+   /**
+    * \brief Get native function of filter expression, compile it if it is not in directory yet.
+    * \param[in] &body body of function generated by Filter::generate().
+    * \return function, NULL if compilation or loading failed (expression is interpreted then).
+    */
+   aot_filter_func get(std::string const &body);
+
+   /**
+    * \brief Main loop of the thread.
+    */
+   void run(void);
+
+   Filter_jit(void) {};
+
+public:
+
+   /**
+    * \return the only instance.
+    */
+   static Filter_jit& instance(void);
+
+   /**
+    * \brief Enable compilation.
+    * \param[in] &directory directory of compiled expressions.
+    * \return 0 on success, -1 if directory can be modified by other user.
+    */
+   int set_dir(std::string const &directory);
+
+   /**
+    * \return true if expressions are compiled.
+    */
+   bool is_enabled(void) const
+   {
+      return !dir.empty();
+   }
+
+   /**
+    * \brief Compile expression in background.
+    * \param[in] &body body of function generated by Filter::generate().
+    * \param[out] *target set to loaded function, stays unchanged if compilation or loading fails.
+    * \return ID of job.
+    */
+   int request(std::string const &body, std::atomic<aot_filter_func> *target);
+
+   /**
+    * \brief Remove job. Waits if it is being compiled, so target can be destroyed after return.
+    * \param[in] id ID of job, negative value is ignored.
+    */
+   void cancel(int id);
+
+   /**
+    * \brief Drop waiting jobs and end the thread.
+    */
+   void stop(void);
+
+   ~Filter_jit(void);
+};
+
+#endif /* filter_jit_h */
@@ -0,0 +1,746 @@
+/**
+ * \file filter_kernels.cpp
+ * \brief Definition of Filter_kernels class and vector kernels.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#include "filter_kernels.hpp"
+
+extern "C" {
+#include "ffilter_internal.h"
+}
+
+#include <algorithm>
+#include <immintrin.h>
+#include <inttypes.h>
+#include <limits>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * \brief Kernel compares 32 values of column with value and returns bitmask of results.
+ * \param[in] column first value, column must be readable for 32 values.
+ * \param[in] value value to compare with.
+ * \param[in] mask mask applied to values for CMP_MASKED_EQ.
+ */
+typedef uint32_t (*kernel_func)(void const *column, uint64_t value, uint64_t mask);
+
+/**
+ * \brief Kernels for all comparisons and widths of one instruction set.
+ */
+struct Kernel_table {
+   char const *name;
+   kernel_func func[6][4]; ///< Indexed by comparison and log2 of width.
+};
+
+/* ================================================================= */
+/* ========================== Scalar =============================== */
+/* ================================================================= */
+
+template <class T, int CMP> static uint32_t scalar_kernel(void const *column, uint64_t value, uint64_t mask)
+{
+   T const *col = static_cast<T const*>(column);
+   T v = (T) value;
+   T m = (T) mask;
+   uint32_t res = 0;
+
+   for (int i = 0; i < KERNEL_WIDTH; i++) {
+      T x = col[i];
+      bool r;
+
+      switch (CMP) {
+      case 0:  r = x == v;         break;
+      case 1:  r = x > v;          break;
+      case 2:  r = x < v;          break;
+      case 3:  r = (x & v) == v;   break;
+      case 4:  r = (x & v) == 0;   break;
+      default: r = (x & m) == v;   break;
+      }
+      res |= (uint32_t) r << i;
+   }
+   return res;
+}
+
+#define SCALAR_ROW(CMP) \
+   { scalar_kernel<uint8_t, CMP>, scalar_kernel<uint16_t, CMP>, \
+     scalar_kernel<uint32_t, CMP>, scalar_kernel<uint64_t, CMP> }
+
+static Kernel_table const scalar_table = {
+   "scalar",
+   { SCALAR_ROW(0), SCALAR_ROW(1), SCALAR_ROW(2), SCALAR_ROW(3), SCALAR_ROW(4), SCALAR_ROW(5) }
+};
+
+/* ================================================================= */
+/* ========================== SSE4.2 =============================== */
+/* ================================================================= */
+
+#pragma GCC push_options
+#pragma GCC target("sse4.2")
+
+template <int W> struct Sse_ops;
+
+template <> struct Sse_ops<1> {
+   static __m128i set1(uint64_t v) { return _mm_set1_epi8((char) v); }
+   static __m128i eq(__m128i a, __m128i b) { return _mm_cmpeq_epi8(a, b); }
+   static __m128i gt(__m128i a, __m128i b) { return _mm_cmpgt_epi8(a, b); }
+};
+
+template <> struct Sse_ops<2> {
+   static __m128i set1(uint64_t v) { return _mm_set1_epi16((short) v); }
+   static __m128i eq(__m128i a, __m128i b) { return _mm_cmpeq_epi16(a, b); }
+   static __m128i gt(__m128i a, __m128i b) { return _mm_cmpgt_epi16(a, b); }
+};
+
+template <> struct Sse_ops<4> {
+   static __m128i set1(uint64_t v) { return _mm_set1_epi32((int) v); }
+   static __m128i eq(__m128i a, __m128i b) { return _mm_cmpeq_epi32(a, b); }
+   static __m128i gt(__m128i a, __m128i b) { return _mm_cmpgt_epi32(a, b); }
+};
+
+template <> struct Sse_ops<8> {
+   static __m128i set1(uint64_t v) { return _mm_set1_epi64x((long long) v); }
+   static __m128i eq(__m128i a, __m128i b) { return _mm_cmpeq_epi64(a, b); }
+   static __m128i gt(__m128i a, __m128i b) { return _mm_cmpgt_epi64(a, b); }
+};
+
+/**
+ * \brief Compare vector of values, lanes of result are all ones or zeros.
+ * \details Unsigned order is computed by signed comparison with flipped sign bits.
+ */
+template <int W, int CMP> static inline __m128i sse_cmp(__m128i x, __m128i v, __m128i m)
+{
+   typedef Sse_ops<W> O;
+   __m128i sign = O::set1(1ULL << (8 * W - 1));
+
+   switch (CMP) {
+   case 0:  return O::eq(x, v);
+   case 1:  return O::gt(_mm_xor_si128(x, sign), _mm_xor_si128(v, sign));
+   case 2:  return O::gt(_mm_xor_si128(v, sign), _mm_xor_si128(x, sign));
+   case 3:  return O::eq(_mm_and_si128(x, v), v);
+   case 4:  return O::eq(_mm_and_si128(x, v), _mm_setzero_si128());
+   default: return O::eq(_mm_and_si128(x, m), v);
+   }
+}
+
+template <int CMP> static uint32_t sse_kernel_1(void const *column, uint64_t value, uint64_t mask)
+{
+   __m128i const *col = static_cast<__m128i const*>(column);
+   __m128i v = Sse_ops<1>::set1(value), m = Sse_ops<1>::set1(mask);
+   uint32_t res = 0;
+
+   for (int i = 0; i < 2; i++) {
+      __m128i r = sse_cmp<1, CMP>(_mm_load_si128(col + i), v, m);
+      res |= (uint32_t) _mm_movemask_epi8(r) << (16 * i);
+   }
+   return res;
+}
+
+template <int CMP> static uint32_t sse_kernel_2(void const *column, uint64_t value, uint64_t mask)
+{
+   __m128i const *col = static_cast<__m128i const*>(column);
+   __m128i v = Sse_ops<2>::set1(value), m = Sse_ops<2>::set1(mask);
+   uint32_t res = 0;
+
+   for (int i = 0; i < 2; i++) {
+      __m128i r0 = sse_cmp<2, CMP>(_mm_load_si128(col + 2 * i), v, m);
+      __m128i r1 = sse_cmp<2, CMP>(_mm_load_si128(col + 2 * i + 1), v, m);
+      /* Saturation keeps 0 and -1, so one byte per value remains. */
+      res |= (uint32_t) _mm_movemask_epi8(_mm_packs_epi16(r0, r1)) << (16 * i);
+   }
+   return res;
+}
+
+template <int CMP> static uint32_t sse_kernel_4(void const *column, uint64_t value, uint64_t mask)
+{
+   __m128i const *col = static_cast<__m128i const*>(column);
+   __m128i v = Sse_ops<4>::set1(value), m = Sse_ops<4>::set1(mask);
+   uint32_t res = 0;
+
+   for (int i = 0; i < 8; i++) {
+      __m128i r = sse_cmp<4, CMP>(_mm_load_si128(col + i), v, m);
+      res |= (uint32_t) _mm_movemask_ps(_mm_castsi128_ps(r)) << (4 * i);
+   }
+   return res;
+}
+
+template <int CMP> static uint32_t sse_kernel_8(void const *column, uint64_t value, uint64_t mask)
+{
+   __m128i const *col = static_cast<__m128i const*>(column);
+   __m128i v = Sse_ops<8>::set1(value), m = Sse_ops<8>::set1(mask);
+   uint32_t res = 0;
+
+   for (int i = 0; i < 16; i++) {
+      __m128i r = sse_cmp<8, CMP>(_mm_load_si128(col + i), v, m);
+      res |= (uint32_t) _mm_movemask_pd(_mm_castsi128_pd(r)) << (2 * i);
+   }
+   return res;
+}
+
+#pragma GCC pop_options
+
+#define SSE_ROW(CMP) { sse_kernel_1<CMP>, sse_kernel_2<CMP>, sse_kernel_4<CMP>, sse_kernel_8<CMP> }
+
+static Kernel_table const sse_table = {
+   "sse4.2",
+   { SSE_ROW(0), SSE_ROW(1), SSE_ROW(2), SSE_ROW(3), SSE_ROW(4), SSE_ROW(5) }
+};
+
+/* ================================================================= */
+/* =========================== AVX2 ================================ */
+/* ================================================================= */
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+template <int W> struct Avx2_ops;
+
+template <> struct Avx2_ops<1> {
+   static __m256i set1(uint64_t v) { return _mm256_set1_epi8((char) v); }
+   static __m256i eq(__m256i a, __m256i b) { return _mm256_cmpeq_epi8(a, b); }
+   static __m256i gt(__m256i a, __m256i b) { return _mm256_cmpgt_epi8(a, b); }
+};
+
+template <> struct Avx2_ops<2> {
+   static __m256i set1(uint64_t v) { return _mm256_set1_epi16((short) v); }
+   static __m256i eq(__m256i a, __m256i b) { return _mm256_cmpeq_epi16(a, b); }
+   static __m256i gt(__m256i a, __m256i b) { return _mm256_cmpgt_epi16(a, b); }
+};
+
+template <> struct Avx2_ops<4> {
+   static __m256i set1(uint64_t v) { return _mm256_set1_epi32((int) v); }
+   static __m256i eq(__m256i a, __m256i b) { return _mm256_cmpeq_epi32(a, b); }
+   static __m256i gt(__m256i a, __m256i b) { return _mm256_cmpgt_epi32(a, b); }
+};
+
+template <> struct Avx2_ops<8> {
+   static __m256i set1(uint64_t v) { return _mm256_set1_epi64x((long long) v); }
+   static __m256i eq(__m256i a, __m256i b) { return _mm256_cmpeq_epi64(a, b); }
+   static __m256i gt(__m256i a, __m256i b) { return _mm256_cmpgt_epi64(a, b); }
+};
+
+/**
+ * \brief Same as sse_cmp() for 256 bit vectors.
+ */
+template <int W, int CMP> static inline __m256i avx2_cmp(__m256i x, __m256i v, __m256i m)
+{
+   typedef Avx2_ops<W> O;
+   __m256i sign = O::set1(1ULL << (8 * W - 1));
+
+   switch (CMP) {
+   case 0:  return O::eq(x, v);
+   case 1:  return O::gt(_mm256_xor_si256(x, sign), _mm256_xor_si256(v, sign));
+   case 2:  return O::gt(_mm256_xor_si256(v, sign), _mm256_xor_si256(x, sign));
+   case 3:  return O::eq(_mm256_and_si256(x, v), v);
+   case 4:  return O::eq(_mm256_and_si256(x, v), _mm256_setzero_si256());
+   default: return O::eq(_mm256_and_si256(x, m), v);
+   }
+}
+
+template <int CMP> static uint32_t avx2_kernel_1(void const *column, uint64_t value, uint64_t mask)
+{
+   __m256i const *col = static_cast<__m256i const*>(column);
+   __m256i r = avx2_cmp<1, CMP>(_mm256_load_si256(col), Avx2_ops<1>::set1(value), Avx2_ops<1>::set1(mask));
+
+   return (uint32_t) _mm256_movemask_epi8(r);
+}
+
+template <int CMP> static uint32_t avx2_kernel_2(void const *column, uint64_t value, uint64_t mask)
+{
+   __m256i const *col = static_cast<__m256i const*>(column);
+   __m256i v = Avx2_ops<2>::set1(value), m = Avx2_ops<2>::set1(mask);
+   __m256i r0 = avx2_cmp<2, CMP>(_mm256_load_si256(col), v, m);
+   __m256i r1 = avx2_cmp<2, CMP>(_mm256_load_si256(col + 1), v, m);
+   /* Pack works in 128 bit lanes, permutation restores order of values. */
+   __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(r0, r1), 0xD8);
+
+   return (uint32_t) _mm256_movemask_epi8(packed);
+}
+
+template <int CMP> static uint32_t avx2_kernel_4(void const *column, uint64_t value, uint64_t mask)
+{
+   __m256i const *col = static_cast<__m256i const*>(column);
+   __m256i v = Avx2_ops<4>::set1(value), m = Avx2_ops<4>::set1(mask);
+   uint32_t res = 0;
+
+   for (int i = 0; i < 4; i++) {
+      __m256i r = avx2_cmp<4, CMP>(_mm256_load_si256(col + i), v, m);
+      res |= (uint32_t) _mm256_movemask_ps(_mm256_castsi256_ps(r)) << (8 * i);
+   }
+   return res;
+}
+
+template <int CMP> static uint32_t avx2_kernel_8(void const *column, uint64_t value, uint64_t mask)
+{
+   __m256i const *col = static_cast<__m256i const*>(column);
+   __m256i v = Avx2_ops<8>::set1(value), m = Avx2_ops<8>::set1(mask);
+   uint32_t res = 0;
+
+   for (int i = 0; i < 8; i++) {
+      __m256i r = avx2_cmp<8, CMP>(_mm256_load_si256(col + i), v, m);
+      res |= (uint32_t) _mm256_movemask_pd(_mm256_castsi256_pd(r)) << (4 * i);
+   }
+   return res;
+}
+
+#pragma GCC pop_options
+
+#define AVX2_ROW(CMP) { avx2_kernel_1<CMP>, avx2_kernel_2<CMP>, avx2_kernel_4<CMP>, avx2_kernel_8<CMP> }
+
+static Kernel_table const avx2_table = {
+   "avx2",
+   { AVX2_ROW(0), AVX2_ROW(1), AVX2_ROW(2), AVX2_ROW(3), AVX2_ROW(4), AVX2_ROW(5) }
+};
+
+/* ================================================================= */
+/* ======================== Filter_kernels ========================= */
+/* ================================================================= */
+
+/**
+ * \return kernels for the best instruction set supported by CPU.
+ */
+static Kernel_table const& kernels(void)
+{
+   static Kernel_table const &table = []() -> Kernel_table const& {
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2")) {
+         return avx2_table;
+      }
+      if (__builtin_cpu_supports("sse4.2")) {
+         return sse_table;
+      }
+      return scalar_table;
+   }();
+   return table;
+}
+
+/**
+ * \return index to kernel table for width of value.
+ */
+static inline int width_index(int width)
+{
+   switch (width) {
+   case 1:  return 0;
+   case 2:  return 1;
+   case 4:  return 2;
+   default: return 3;
+   }
+}
+
+char const* Filter_kernels::isa_name(void)
+{
+   return kernels().name;
+}
+
+void Filter_kernels::push(Op const &op)
+{
+   switch (op.type) {
+   case OP_AND:
+   case OP_OR:
+      depth--;
+      break;
+   case OP_NOT:
+      break;
+   default:
+      depth++;
+      if ((size_t) depth > stack.size()) {
+         stack.resize(depth);
+      }
+   }
+   program.push_back(op);
+}
+
+int Filter_kernels::translate(ff3_node_t const *node, Op &op, Leaf_value &val)
+{
+   ff3_val_t fl;
+
+   if (node->value == NULL || node->vsize > sizeof(fl)) {
+      return -1;
+   }
+   memset(&fl, 0, sizeof(fl));
+   memcpy(&fl, node->value, node->vsize);
+
+   val.value = fl.ui;
+   val.mask = ~0ULL;
+   op.ip4 = false;
+
+   switch (node->opcode) {
+   case FFAT_EQ_UI1: op.cmp = CMP_EQ;  op.width = 1; break;
+   case FFAT_EQ_UI2: op.cmp = CMP_EQ;  op.width = 2; break;
+   case FFAT_EQ_UI4: op.cmp = CMP_EQ;  op.width = 4; break;
+   case FFAT_EQ_UI8: op.cmp = CMP_EQ;  op.width = 8; break;
+   case FFAT_GT_UI1: op.cmp = CMP_GT;  op.width = 1; break;
+   case FFAT_GT_UI2: op.cmp = CMP_GT;  op.width = 2; break;
+   case FFAT_GT_UI4: op.cmp = CMP_GT;  op.width = 4; break;
+   case FFAT_GT_UI8: op.cmp = CMP_GT;  op.width = 8; break;
+   case FFAT_LT_UI1: op.cmp = CMP_LT;  op.width = 1; break;
+   case FFAT_LT_UI2: op.cmp = CMP_LT;  op.width = 2; break;
+   case FFAT_LT_UI4: op.cmp = CMP_LT;  op.width = 4; break;
+   case FFAT_LT_UI8: op.cmp = CMP_LT;  op.width = 8; break;
+   case FFAT_IS_UI1: op.cmp = CMP_IS;  op.width = 1; break;
+   case FFAT_IS_UI2: op.cmp = CMP_IS;  op.width = 2; break;
+   case FFAT_IS_UI4: op.cmp = CMP_IS;  op.width = 4; break;
+   case FFAT_IS_UI8: op.cmp = CMP_IS;  op.width = 8; break;
+   case FFAT_INS_UI1: op.cmp = CMP_INS; op.width = 1; break;
+   case FFAT_INS_UI2: op.cmp = CMP_INS; op.width = 2; break;
+   case FFAT_INS_UI4: op.cmp = CMP_INS; op.width = 4; break;
+   case FFAT_INS_UI8: op.cmp = CMP_INS; op.width = 8; break;
+
+   case FFAT_EQ_AD4:
+      /* Exact IPv4 address, IPv6 records match only IPv4-compatible address (::a.b.c.d) like in ffilter. */
+      op.cmp = CMP_MASKED_EQ;
+      op.width = 4;
+      op.ip4 = true;
+      val.value = fl.net.ip.data[3];
+      val.mask = 0xffffffff;
+      return 0;
+   case FFAT_EQ_ADP:
+      /* Only IPv4 prefix, IPv6 prefixes are left to ffilter. */
+      if (fl.net.ver != 4 || fl.net.ip.data[0] || fl.net.ip.data[1] || fl.net.ip.data[2]) {
+         return -1;
+      }
+      op.cmp = CMP_MASKED_EQ;
+      op.width = 4;
+      op.ip4 = true;
+      val.value = fl.net.ip.data[3];
+      val.mask = fl.net.mask.data[3];
+      return 0;
+
+   default:
+      return -1;
+   }
+   return 0;
+}
+
+void Filter_kernels::compile_leaf(ff3_node_t *node)
+{
+   Op op = {};
+   op.type = OP_LEAF;
+   op.node = node;
+   op.id = node->field.index;
+
+   ff3_node_t *item = node->oper == FF_OP_IN ? node->right : node;
+   bool ok = item != NULL;
+
+   while (ok && item != NULL) {
+      Op item_op = {};
+      Leaf_value val;
+
+      if (translate(item, item_op, val) != 0 ||
+          (!op.values.empty() && (item_op.cmp != op.cmp || item_op.width != op.width || item_op.ip4 != op.ip4))) {
+         ok = false;
+         break;
+      }
+      op.cmp = item_op.cmp;
+      op.width = item_op.width;
+      op.ip4 = item_op.ip4;
+      op.values.push_back(val);
+      item = node->oper == FF_OP_IN ? item->right : NULL;
+   }
+
+   if (!ok) {
+      op.type = OP_FALLBACK;
+      push(op);
+      return;
+   }
+
+   if (!op.ip4 && op.width < 8) {
+      /* Value out of range of field is compared in 64 bits by ffilter. */
+      uint64_t max = (1ULL << (8 * op.width)) - 1;
+      std::vector<Leaf_value> in_range;
+      bool always = false;
+
+      for (auto const &val: op.values) {
+         if (val.value <= max) {
+            in_range.push_back(val);
+         } else if (op.cmp == CMP_LT) {
+            always = true;
+         } else if (op.cmp == CMP_INS) {
+            in_range.push_back({val.value & max, val.mask});
+         }
+      }
+      if (always || in_range.empty()) {
+         Op c = {};
+         c.type = OP_CONST;
+         c.const_mask = always ? ~0U : 0;
+         push(c);
+         return;
+      }
+      op.values = in_range;
+   }
+   push(op);
+}
+
+bool Filter_kernels::lower_bound(ff3_node_t const *node, ur_field_id_t id, uint64_t &bound)
+{
+   uint64_t left = 0;
+   uint64_t right = 0;
+   bool has_left;
+   bool has_right;
+
+   if (node == NULL) {
+      return false;
+   }
+
+   switch (node->oper) {
+   case FF_OP_AND:
+      has_left = lower_bound(node->left, id, left);
+      has_right = lower_bound(node->right, id, right);
+      if (!has_left && !has_right) {
+         return false;
+      }
+      bound = !has_left ? right : !has_right ? left : std::max(left, right);
+      return true;
+   case FF_OP_OR:
+      if (!lower_bound(node->left, id, left) || !lower_bound(node->right, id, right)) {
+         return false;
+      }
+      bound = std::min(left, right);
+      return true;
+   case FF_OP_NOT:
+   case FF_OP_YES:
+   case FF_OP_IN:
+      return false;
+   default:
+      break;
+   }
+
+   Op op = {};
+   Leaf_value val;
+
+   if ((int) node->field.index != id || translate(node, op, val) != 0 || op.ip4) {
+      return false;
+   }
+   if (op.cmp == CMP_GT) {
+      bound = val.value;
+      return true;
+   }
+   /* Optimizer merges range of field to equality, x == v is x > v - 1. */
+   if (op.cmp == CMP_EQ && val.value > 0) {
+      bound = val.value - 1;
+      return true;
+   }
+   return false;
+}
+
+void Filter_kernels::compile_node(ff3_node_t *node)
+{
+   Op op = {};
+
+   if (node == NULL) {
+      op.type = OP_CONST;
+      op.const_mask = 0;
+      push(op);
+      return;
+   }
+
+   switch (node->oper) {
+   case FF_OP_YES:
+      op.type = OP_CONST;
+      op.const_mask = ~0U;
+      push(op);
+      return;
+   case FF_OP_AND:
+   case FF_OP_OR:
+      if (node->left != NULL && node->right != NULL) {
+         compile_node(node->left);
+         compile_node(node->right);
+         op.type = node->oper == FF_OP_AND ? OP_AND : OP_OR;
+         push(op);
+         return;
+      }
+      break;
+   case FF_OP_NOT:
+      /* Not has only one child. */
+      if ((node->left == NULL) != (node->right == NULL)) {
+         compile_node(node->left != NULL ? node->left : node->right);
+         op.type = OP_NOT;
+         push(op);
+         return;
+      }
+      break;
+   default:
+      compile_leaf(node);
+      return;
+   }
+   op.type = OP_FALLBACK;
+   op.node = node;
+   push(op);
+}
+
+int Filter_kernels::compile(ff3_node_t *root)
+{
+   program.clear();
+   stack.clear();
+   depth = 0;
+   compile_node(root);
+
+   for (auto const &op: program) {
+      if (op.type == OP_LEAF) {
+         return 0;
+      }
+   }
+   /* Nothing for kernels, ffilter alone is faster. */
+   program.clear();
+   return -1;
+}
+
+void Filter_kernels::bind(Record_batch const &batch)
+{
+   columns.resize(program.size());
+   for (size_t i = 0; i < program.size(); i++) {
+      Op const &op = program[i];
+      Record_batch::Column const *col = NULL;
+
+      if (op.type == OP_LEAF) {
+         col = batch.column(op.id);
+         if (col != NULL && (op.ip4 ? !col->is_ip : col->is_ip || col->elem_size != op.width)) {
+            col = NULL;
+         }
+      }
+      columns[i] = col;
+   }
+}
+
+uint32_t Filter_kernels::eval(Record_batch const &batch, size_t base, uint32_t selected, ff3_t *filter)
+{
+   Kernel_table const &table = kernels();
+   int top = 0;
+
+   for (size_t i = 0; i < program.size(); i++) {
+      Op const &op = program[i];
+      Record_batch::Column const *col = columns[i];
+      uint32_t res = 0;
+
+      switch (op.type) {
+      case OP_AND:
+         top--;
+         stack[top - 1] &= stack[top];
+         continue;
+      case OP_OR:
+         top--;
+         stack[top - 1] |= stack[top];
+         continue;
+      case OP_NOT:
+         stack[top - 1] = ~stack[top - 1];
+         continue;
+      case OP_CONST:
+         res = op.const_mask;
+         break;
+      case OP_LEAF:
+         if (col != NULL) {
+            kernel_func func = table.func[op.cmp][width_index(op.width)];
+
+            if (op.ip4) {
+               for (auto const &val: op.values) {
+                  res |= func(col->ip4 + base, val.value, val.mask);
+               }
+               res &= table.func[CMP_EQ][0](col->is_ip4 + base, 1, 0);
+            } else {
+               for (auto const &val: op.values) {
+                  res |= func(col->data + base * op.width, val.value, val.mask);
+               }
+            }
+            break;
+         }
+         /* Field is not in columns, fall through to ffilter. */
+         /* FALLTHRU */
+      case OP_FALLBACK:
+         for (uint32_t bits = selected; bits; bits &= bits - 1) {
+            int bit = __builtin_ctz(bits);
+
+            if (ff3_eval_node(filter, op.node, batch.row(base + bit)) > 0) {
+               res |= 1U << bit;
+            }
+         }
+         break;
+      }
+      stack[top++] = res;
+   }
+   return stack[0] & selected;
+}
+
+int Filter_kernels::generate(std::string &expr, std::vector<std::string> &fields, bool static_ids) const
+{
+   std::vector<std::string> operands;
+   char buf[64];
+
+   if (program.empty()) {
+      return -1;
+   }
+   fields.clear();
+   for (auto const &op: program) {
+      std::string a, b;
+
+      switch (op.type) {
+      case OP_AND:
+      case OP_OR:
+         b = operands.back();
+         operands.pop_back();
+         a = operands.back();
+         operands.back() = "(" + a + (op.type == OP_AND ? " && " : " || ") + b + ")";
+         continue;
+      case OP_NOT:
+         operands.back() = "!" + operands.back();
+         continue;
+      case OP_CONST:
+         operands.push_back(op.const_mask ? "true" : "false");
+         continue;
+      case OP_FALLBACK:
+         return -1;
+      case OP_LEAF:
+         break;
+      }
+
+      /* ID of dynamically defined field differs between runs. */
+      if ((static_ids && op.id > ur_field_specs.ur_last_statically_defined_id) ||
+          (op.ip4 ? ur_get_type(op.id) != UR_TYPE_IP : ur_get_size(op.id) != op.width)) {
+         return -1;
+      }
+      std::string field = static_ids ? std::string("F_") + ur_get_name(op.id) : std::to_string(op.id);
+      if (std::find(fields.begin(), fields.end(), field) == fields.end()) {
+         fields.push_back(field);
+      }
+
+      std::string value;
+      if (op.ip4) {
+         value = "((ip_addr_t const*) ur_get_ptr_by_id(tmplt, rec, " + field + "))";
+      } else {
+         value = "*(uint" + std::to_string(8 * op.width) + "_t const*) ur_get_ptr_by_id(tmplt, rec, " + field + ")";
+      }
+
+      std::string leaf;
+      for (auto const &val: op.values) {
+         std::string v, m;
+         snprintf(buf, sizeof(buf), "UINT64_C(%" PRIu64 ")", val.value);
+         v = buf;
+         snprintf(buf, sizeof(buf), "UINT64_C(0x%" PRIx64 ")", val.mask);
+         m = buf;
+
+         std::string cmp;
+         switch (op.cmp) {
+         case CMP_EQ:  cmp = value + " == " + v; break;
+         case CMP_GT:  cmp = value + " > " + v; break;
+         case CMP_LT:  cmp = value + " < " + v; break;
+         case CMP_IS:  cmp = "(" + value + " & " + v + ") == " + v; break;
+         case CMP_INS: cmp = "(" + value + " & " + v + ") == 0"; break;
+         default:
+            if (op.ip4) {
+               cmp = "((ip_is4" + value + " ? " + value + "->ui32[2] : " + value + "->ui32[3]) & " + m + ") == " + v;
+            } else {
+               cmp = "(" + value + " & " + m + ") == " + v;
+            }
+            break;
+         }
+         leaf += (leaf.empty() ? "(" : " || (") + cmp + ")";
+      }
+      if (op.ip4) {
+         /* Only IPv4 and IPv4-compatible IPv6 (::a.b.c.d) records match IPv4 comparison, like in ffilter. */
+         leaf = "(ip_is4" + value + " || (" + value + "->ui64[0] == 0 && " + value + "->ui32[2] == 0)) && (" +
+                leaf + ")";
+      }
+      operands.push_back("(" + leaf + ")");
+   }
+   expr = operands.back();
+   return 0;
+}
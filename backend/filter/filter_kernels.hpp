@@ -0,0 +1,162 @@
+/**
+ * \file filter_kernels.hpp
+ * \brief Evaluation of filter expression over columns of record batch.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#if !defined(FILTER_KERNELS_H)
+#define FILTER_KERNELS_H
+
+#include "../batch.hpp"
+
+extern "C" {
+#include "ffilter.h"
+}
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** Number of records evaluated by one call of kernel, one bit per record. */
+#define KERNEL_WIDTH 32
+
+/**
+ * \brief Filter expression compiled from ffilter tree to postfix program.
+ * \details Comparisons of integer fields and IPv4 addresses (also in lists) are evaluated
+ *    by vector kernels over columns, 32 records at once, into bitmask.
+ *    Bitmasks are combined by AND/OR/NOT bit operations.
+ *    Other comparisons are evaluated by ffilter record by record,
+ *    so the result is always the same as ff3_eval() returns.
+ */
+class Filter_kernels
+{
+   /** Type of comparison in kernel. */
+   enum cmp_type {
+      CMP_EQ = 0,
+      CMP_GT,
+      CMP_LT,
+      CMP_IS,        ///< All bits of value are set.
+      CMP_INS,       ///< No bit of value is set.
+      CMP_MASKED_EQ, ///< Equality after applying mask, used for IPv4 prefixes.
+      CMP_COUNT
+   };
+
+   /** Type of program instruction. */
+   enum op_type {
+      OP_LEAF,       ///< Comparison evaluated by kernel.
+      OP_FALLBACK,   ///< Subtree evaluated by ffilter.
+      OP_CONST,      ///< Result known during compilation.
+      OP_AND,
+      OP_OR,
+      OP_NOT
+   };
+
+   /**
+    * \brief Value to compare with, leaf of IN operator has more of them.
+    */
+   struct Leaf_value {
+      uint64_t value;
+      uint64_t mask;
+   };
+
+   /**
+    * \brief Instruction of program.
+    */
+   struct Op {
+      op_type type;
+      cmp_type cmp;                   ///< OP_LEAF: comparison.
+      int width;                      ///< OP_LEAF: size of compared values in bytes.
+      bool ip4;                       ///< OP_LEAF: compare IPv4 column, only IPv4-compatible IPv6 records match.
+      ur_field_id_t id;               ///< OP_LEAF: compared field.
+      std::vector<Leaf_value> values; ///< OP_LEAF: values, result is OR of all comparisons.
+      uint32_t const_mask;            ///< OP_CONST: result.
+      ff3_node_t *node;               ///< OP_LEAF, OP_FALLBACK: node for evaluation by ffilter.
+   };
+
+   std::vector<Op> program;                  ///< Postfix program.
+   std::vector<uint32_t> stack;              ///< Bitmasks during evaluation.
+   std::vector<Record_batch::Column const*> columns; ///< Column of every leaf in current batch, NULL if missing.
+   int depth = 0;                            ///< Current depth of stack during compilation.
+
+   /**
+    * \brief Compile subtree and append it to program.
+    * \param[in] node subtree of ffilter.
+    */
+   void compile_node(ff3_node_t *node);
+
+   /**
+    * \brief Compile comparison or IN list. Append fallback if kernels do not support it.
+    * \param[in] node leaf of ffilter.
+    */
+   void compile_leaf(ff3_node_t *node);
+
+   /**
+    * \brief Translate one comparison of ffilter to kernel comparison.
+    * \param[in] node leaf of ffilter or item of IN list.
+    * \param[out] op filled comparison.
+    * \param[out] val filled value.
+    * \return 0 on success, -1 if kernels do not support this comparison.
+    */
+   static int translate(ff3_node_t const *node, Op &op, Leaf_value &val);
+
+   /**
+    * \brief Push instruction to program and track depth of stack.
+    */
+   void push(Op const &op);
+
+public:
+
+   /**
+    * \brief Compile filter expression.
+    * \param[in] root root of ffilter tree.
+    * \return 0 if at least some comparisons can be evaluated by kernels, otherwise -1.
+    */
+   int compile(ff3_node_t *root);
+
+   /**
+    * \brief Prepare evaluation of records of batch. Call once per batch.
+    * \param[in] batch batch of records.
+    */
+   void bind(Record_batch const &batch);
+
+   /**
+    * \brief Evaluate program over 32 records.
+    * \param[in] batch batch set by bind().
+    * \param[in] base index of first record, multiple of 32.
+    * \param[in] selected bits of records which are needed.
+    * \param[in] filter ffilter for evaluation of fallback instructions.
+    * \return bitmask of records which pass the filter.
+    */
+   uint32_t eval(Record_batch const &batch, size_t base, uint32_t selected, ff3_t *filter);
+
+   /**
+    * \brief Translate compiled program to C/C++ expression.
+    * \details Expression reads record \c rec of template \c tmplt. Fields are referenced by
+    *    static UniRec IDs (F_ macros of fields.h) for ahead-of-time compilation, so only statically
+    *    defined fields can be used, or by numeric IDs of this process for code compiled at runtime.
+    * \param[out] expr boolean expression.
+    * \param[out] fields references of fields read by expression, without duplicates.
+    * \param[in] static_ids reference fields by F_ macros instead of numbers.
+    * \return 0 on success, -1 if program contains comparison evaluated by ffilter.
+    */
+   int generate(std::string &expr, std::vector<std::string> &fields, bool static_ids) const;
+
+   /**
+    * \return name of instruction set selected for kernels (avx2, sse4.2 or scalar).
+    */
+   static char const* isa_name(void);
+
+   /**
+    * \brief Find bound which field must exceed in every record passing the expression.
+    * \details Recognizes comparisons "field > value" and "field == value" of unsigned integers, also inside AND
+    *    (the higher bound) and OR (the lower one of both branches).
+    * \param[in] node root of ffilter tree.
+    * \param[in] id UniRec ID of field.
+    * \param[out] bound value which field must be greater than.
+    * \return true if bound is found.
+    */
+   static bool lower_bound(ff3_node_t const *node, ur_field_id_t id, uint64_t &bound);
+};
+
+#endif /* filter_kernels_h */
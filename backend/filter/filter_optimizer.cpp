@@ -0,0 +1,482 @@
+/**
+ * \file filter_optimizer.cpp
+ * \brief Definition of Filter_optimizer class.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#include "filter_optimizer.hpp"
+
+extern "C" {
+#include "fcore.h"
+#include "ffilter_internal.h"
+}
+
+#include <algorithm>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+/** Opcodes of unsigned comparisons, rows EQ, GT, LT, columns by width 1, 2, 4, 8 bytes. */
+static ff3_attr_t const unsigned_opcodes[3][4] = {
+   {FFAT_EQ_UI1, FFAT_EQ_UI2, FFAT_EQ_UI4, FFAT_EQ_UI8},
+   {FFAT_GT_UI1, FFAT_GT_UI2, FFAT_GT_UI4, FFAT_GT_UI8},
+   {FFAT_LT_UI1, FFAT_LT_UI2, FFAT_LT_UI4, FFAT_LT_UI8}
+};
+static ff3_oper_t const unsigned_opers[3] = {FF_OP_EQ, FF_OP_GT, FF_OP_LT};
+
+/**
+ * \return maximal value of unsigned field.
+ */
+static uint64_t max_value(int width)
+{
+   return width == 8 ? UINT64_MAX : (1ULL << (8 * width)) - 1;
+}
+
+ff3_node_t* Filter_optimizer::new_node(ff3_oper_t oper, ff3_node_t *left, ff3_node_t *right)
+{
+   /* Nodes are released by ffilter, so they are allocated by its allocator. */
+   ff3_node_t *node = (ff3_node_t*) calloc(1, sizeof(ff3_node_t));
+   if (node == NULL) {
+      throw std::bad_alloc();
+   }
+   node->oper = oper;
+   node->left = left;
+   node->right = right;
+   return node;
+}
+
+ff3_node_t* Filter_optimizer::constant(bool value)
+{
+   ff3_node_t *node = new_node(FF_OP_YES, NULL, NULL);
+   return value ? node : new_node(FF_OP_NOT, NULL, node);
+}
+
+void Filter_optimizer::release(ff3_node_t *node)
+{
+   node->left = NULL;
+   node->right = NULL;
+   ff3_free_node(node);
+}
+
+ff3_node_t* Filter_optimizer::absorb(std::vector<ff3_node_t*> &terms, bool value)
+{
+   for (auto &term: terms) {
+      ff3_free_node(term);
+   }
+   terms.clear();
+   return constant(value);
+}
+
+bool Filter_optimizer::is_true(ff3_node_t const *node)
+{
+   return node != NULL && node->oper == FF_OP_YES;
+}
+
+bool Filter_optimizer::is_false(ff3_node_t const *node)
+{
+   return node != NULL && node->oper == FF_OP_NOT && (node->left == NULL) != (node->right == NULL) &&
+          is_true(node->left != NULL ? node->left : node->right);
+}
+
+bool Filter_optimizer::is_comparison(ff3_node_t const *node)
+{
+   /* Opcode is not set in nodes of other operations. */
+   return node->oper >= FF_OP_EQ && node->oper <= FF_OP_ISNSET;
+}
+
+bool Filter_optimizer::is_negatable(ff3_node_t const *node)
+{
+   uint64_t value;
+
+   switch (node->opcode) {
+   case FFAT_IS_UI1:
+   case FFAT_IS_UI2:
+   case FFAT_IS_UI4:
+   case FFAT_IS_UI8:
+   case FFAT_INS_UI1:
+   case FFAT_INS_UI2:
+   case FFAT_INS_UI4:
+   case FFAT_INS_UI8:
+      break;
+   default:
+      return false;
+   }
+   if (!is_comparison(node) || node->value == NULL || node->vsize != sizeof(uint64_t)) {
+      return false;
+   }
+   memcpy(&value, node->value, sizeof(value));
+   return __builtin_popcountll(value) == 1;
+}
+
+bool Filter_optimizer::equal(ff3_node_t const *a, ff3_node_t const *b)
+{
+   if (a == NULL || b == NULL) {
+      return a == b;
+   }
+   if (a->oper != b->oper) {
+      return false;
+   }
+   switch (a->oper) {
+   case FF_OP_YES:
+      return true;
+   case FF_OP_NOT:
+   case FF_OP_AND:
+   case FF_OP_OR:
+      return equal(a->left, b->left) && equal(a->right, b->right);
+   default:
+      break;
+   }
+   if (a->field.index != b->field.index || a->vsize != b->vsize ||
+       (a->vsize > 0 && memcmp(a->value, b->value, a->vsize) != 0) ||
+       (is_comparison(a) && a->opcode != b->opcode)) {
+      return false;
+   }
+   /* Values of FF_OP_IN are in right list. */
+   return equal(a->left, b->left) && equal(a->right, b->right);
+}
+
+bool Filter_optimizer::complementary(ff3_node_t const *a, ff3_node_t const *b)
+{
+   for (int i = 0; i < 2; i++, std::swap(a, b)) {
+      if (a->oper == FF_OP_NOT && (a->left == NULL) != (a->right == NULL) &&
+          equal(a->left != NULL ? a->left : a->right, b)) {
+         return true;
+      }
+   }
+   if (!is_negatable(a) || !is_negatable(b) || a->field.index != b->field.index ||
+       memcmp(a->value, b->value, a->vsize) != 0) {
+      return false;
+   }
+   return ff3_negate(a->opcode) == b->opcode;
+}
+
+bool Filter_optimizer::get_range(ff3_node_t const *node, Range &range, int &width)
+{
+   int row = -1;
+
+   if (!is_comparison(node) || node->value == NULL || node->vsize != sizeof(uint64_t)) {
+      return false;
+   }
+   for (int r = 0; r < 3 && row < 0; r++) {
+      for (int c = 0; c < 4; c++) {
+         if (unsigned_opcodes[r][c] == node->opcode) {
+            row = r;
+            width = 1 << c;
+            break;
+         }
+      }
+   }
+   if (row < 0) {
+      return false;
+   }
+
+   /* Unsigned comparisons compare field with 64 bit value. */
+   uint64_t value;
+   uint64_t max = max_value(width);
+   memcpy(&value, node->value, sizeof(value));
+
+   range = {1, 0};
+   switch (unsigned_opers[row]) {
+   case FF_OP_EQ:
+      range = {value, value};
+      break;
+   case FF_OP_GT:
+      if (value != UINT64_MAX) {
+         range = {value + 1, max};
+      }
+      break;
+   default:
+      if (value != 0) {
+         range = {0, value - 1};
+      }
+      break;
+   }
+   range.hi = std::min(range.hi, max);
+   if (range.lo > range.hi) {
+      range = {1, 0};
+   }
+   return true;
+}
+
+void Filter_optimizer::set_comparison(ff3_node_t *node, ff3_oper_t oper, int width, uint64_t value)
+{
+   int row = oper == FF_OP_EQ ? 0 : oper == FF_OP_GT ? 1 : 2;
+   int column = width == 1 ? 0 : width == 2 ? 1 : width == 4 ? 2 : 3;
+
+   node->oper = oper;
+   node->opcode = unsigned_opcodes[row][column];
+   memcpy(node->value, &value, sizeof(value));
+}
+
+ff3_node_t* Filter_optimizer::range_node(Range const &range, uint64_t max, int width, ff3_node_t const *like,
+                                         std::vector<ff3_node_t*> &pool)
+{
+   auto leaf = [&](ff3_oper_t oper, uint64_t value) {
+      ff3_node_t *node;
+
+      if (!pool.empty()) {
+         node = pool.back();
+         pool.pop_back();
+      } else {
+         node = new_node(like->oper, NULL, NULL);
+         node->field = like->field;
+         node->type = like->type;
+         node->value = (char*) malloc(sizeof(uint64_t));
+         if (node->value == NULL) {
+            ff3_free_node(node);
+            throw std::bad_alloc();
+         }
+         node->vsize = sizeof(uint64_t);
+      }
+      set_comparison(node, oper, width, value);
+      return node;
+   };
+
+   if (range.lo == range.hi) {
+      return leaf(FF_OP_EQ, range.lo);
+   } else if (range.lo == 0) {
+      return leaf(FF_OP_LT, range.hi + 1);
+   } else if (range.hi == max) {
+      return leaf(FF_OP_GT, range.lo - 1);
+   }
+   ff3_node_t *gt = leaf(FF_OP_GT, range.lo - 1);
+   return new_node(FF_OP_AND, gt, leaf(FF_OP_LT, range.hi + 1));
+}
+
+bool Filter_optimizer::merge_ranges(bool is_and, std::vector<ff3_node_t*> &terms)
+{
+   /**
+    * \brief Comparisons of one field.
+    */
+   struct Group {
+      std::vector<size_t> members; ///< Indexes of terms.
+      std::vector<Range> merged;   ///< Intervals replacing them.
+      int width;
+      bool keep;                   ///< Nothing to merge, terms stay as they are.
+   };
+   std::vector<Group> groups;
+   std::vector<int> group_of(terms.size(), -1);
+
+   for (size_t i = 0; i < terms.size(); i++) {
+      Range range;
+      int width;
+
+      if (group_of[i] >= 0 || !get_range(terms[i], range, width)) {
+         continue;
+      }
+      Group group;
+      std::vector<Range> ranges;
+      uint64_t max = max_value(width);
+      bool trivial = false;
+
+      group.width = width;
+      for (size_t j = i; j < terms.size(); j++) {
+         Range r;
+         int w;
+
+         if (group_of[j] < 0 && terms[j]->field.index == terms[i]->field.index &&
+             get_range(terms[j], r, w) && w == width) {
+            group_of[j] = groups.size();
+            group.members.push_back(j);
+            ranges.push_back(r);
+            trivial |= r.lo > r.hi || (r.lo == 0 && r.hi == max);
+         }
+      }
+
+      if (is_and) {
+         Range all = {0, max};
+         for (auto const &r: ranges) {
+            all.lo = std::max(all.lo, r.lo);
+            all.hi = std::min(all.hi, r.hi);
+         }
+         if (all.lo > all.hi) {
+            ff3_node_t *node = absorb(terms, false);
+            terms.push_back(node);
+            return true;
+         }
+         if (all.lo != 0 || all.hi != max) {
+            group.merged.push_back(all);
+         }
+      } else {
+         std::sort(ranges.begin(), ranges.end(), [](Range const &a, Range const &b) { return a.lo < b.lo; });
+         for (auto const &r: ranges) {
+            if (r.lo > r.hi) {
+               continue;
+            }
+            if (!group.merged.empty() && (group.merged.back().hi == max || r.lo <= group.merged.back().hi + 1)) {
+               group.merged.back().hi = std::max(group.merged.back().hi, r.hi);
+            } else {
+               group.merged.push_back(r);
+            }
+         }
+         if (group.merged.size() == 1 && group.merged.front().lo == 0 && group.merged.front().hi == max) {
+            ff3_node_t *node = absorb(terms, true);
+            terms.push_back(node);
+            return true;
+         }
+      }
+      group.keep = !trivial && group.merged.size() == group.members.size();
+      groups.push_back(group);
+   }
+
+   std::vector<ff3_node_t*> out;
+   for (size_t i = 0; i < terms.size(); i++) {
+      if (group_of[i] < 0) {
+         out.push_back(terms[i]);
+         continue;
+      }
+      Group const &group = groups[group_of[i]];
+      if (group.keep) {
+         out.push_back(terms[i]);
+         continue;
+      }
+      if (group.members.front() != i) {
+         continue;
+      }
+
+      std::vector<ff3_node_t*> pool;
+      for (auto const &index: group.members) {
+         pool.push_back(terms[index]);
+      }
+      ff3_node_t const *like = pool.front();
+      for (auto const &range: group.merged) {
+         out.push_back(range_node(range, max_value(group.width), group.width, like, pool));
+      }
+      for (auto &node: pool) {
+         ff3_free_node(node);
+      }
+   }
+   terms = out;
+   return false;
+}
+
+ff3_node_t* Filter_optimizer::negate(ff3_node_t *node)
+{
+   Range range;
+   int width;
+
+   if (is_negatable(node)) {
+      node->opcode = ff3_negate(node->opcode);
+      return node;
+   }
+   if (get_range(node, range, width) && node->oper != FF_OP_EQ) {
+      uint64_t value;
+      memcpy(&value, node->value, sizeof(value));
+
+      /* Not x > v is x < v + 1, not x < v is x > v - 1. */
+      if (node->oper == FF_OP_GT && value != UINT64_MAX) {
+         set_comparison(node, FF_OP_LT, width, value + 1);
+         return node;
+      } else if (node->oper == FF_OP_LT && value != 0) {
+         set_comparison(node, FF_OP_GT, width, value - 1);
+         return node;
+      }
+      ff3_free_node(node);
+      return constant(true);
+   }
+   return new_node(FF_OP_NOT, NULL, node);
+}
+
+void Filter_optimizer::flatten(ff3_node_t *node, ff3_oper_t oper, std::vector<ff3_node_t*> &terms)
+{
+   if (node->oper == oper && node->left != NULL && node->right != NULL) {
+      flatten(node->left, oper, terms);
+      flatten(node->right, oper, terms);
+      release(node);
+   } else {
+      terms.push_back(node);
+   }
+}
+
+ff3_node_t* Filter_optimizer::fold(ff3_oper_t oper, std::vector<ff3_node_t*> &terms)
+{
+   bool is_and = oper == FF_OP_AND;
+   std::vector<ff3_node_t*> kept;
+
+   for (auto &term: terms) {
+      if (is_true(term) || is_false(term)) {
+         if (is_true(term) != is_and) {
+            return absorb(terms, !is_and);
+         }
+         ff3_free_node(term);
+         term = NULL;
+         continue;
+      }
+
+      bool duplicate = false;
+      for (auto const &item: kept) {
+         if (complementary(item, term)) {
+            return absorb(terms, !is_and);
+         }
+         duplicate |= equal(item, term);
+      }
+      if (duplicate) {
+         ff3_free_node(term);
+         term = NULL;
+         continue;
+      }
+      kept.push_back(term);
+   }
+   terms.clear();
+
+   if (merge_ranges(is_and, kept)) {
+      return kept.front();
+   }
+   if (kept.empty()) {
+      return constant(is_and);
+   }
+   /* Terms keep their order, so evaluation is short-circuited as written. */
+   ff3_node_t *node = kept.front();
+   for (size_t i = 1; i < kept.size(); i++) {
+      node = new_node(oper, node, kept[i]);
+   }
+   return node;
+}
+
+ff3_node_t* Filter_optimizer::optimize(ff3_node_t *node, bool negated)
+{
+   ff3_node_t *child;
+   ff3_oper_t oper;
+
+   switch (node->oper) {
+   case FF_OP_YES:
+      return negated ? new_node(FF_OP_NOT, NULL, node) : node;
+   case FF_OP_NOT:
+      if ((node->left == NULL) == (node->right == NULL)) {
+         break;
+      }
+      child = node->left != NULL ? node->left : node->right;
+      release(node);
+      return optimize(child, !negated);
+   case FF_OP_AND:
+   case FF_OP_OR:
+      if (node->left == NULL || node->right == NULL) {
+         break;
+      }
+      /* De Morgan. */
+      oper = node->oper;
+      if (negated) {
+         oper = oper == FF_OP_AND ? FF_OP_OR : FF_OP_AND;
+      }
+      {
+         std::vector<ff3_node_t*> terms;
+         ff3_node_t *left = optimize(node->left, negated);
+         ff3_node_t *right = optimize(node->right, negated);
+
+         release(node);
+         flatten(left, oper, terms);
+         flatten(right, oper, terms);
+         return fold(oper, terms);
+      }
+   default:
+      return negated ? negate(node) : node;
+   }
+   /* Malformed node is left as it is. */
+   return negated ? new_node(FF_OP_NOT, NULL, node) : node;
+}
+
+ff3_node_t* Filter_optimizer::optimize(ff3_node_t *root)
+{
+   return root == NULL ? NULL : optimize(root, false);
+}
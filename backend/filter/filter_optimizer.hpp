@@ -0,0 +1,156 @@
+/**
+ * \file filter_optimizer.hpp
+ * \brief Simplification of filter expression tree.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#if !defined(FILTER_OPTIMIZER_H)
+#define FILTER_OPTIMIZER_H
+
+extern "C" {
+#include "ffilter.h"
+}
+
+#include <stdint.h>
+#include <vector>
+
+/**
+ * \brief Rewrites tree built by ffilter parser to equivalent tree which is cheaper to evaluate.
+ * \details Negations are pushed down to leaves, nested AND/OR are flattened, constants are folded,
+ *    duplicate terms are removed and term together with its negation is folded to constant.
+ *    Unsigned comparisons of one field in AND/OR are merged to the smallest set of intervals.
+ *    Constant true is FF_OP_YES node, constant false is FF_OP_NOT node over it,
+ *    so ffilter and Filter_kernels evaluate the result as they are.
+ */
+class Filter_optimizer
+{
+   /**
+    * \brief Interval of values, empty if lo > hi.
+    */
+   struct Range {
+      uint64_t lo;
+      uint64_t hi;
+   };
+
+   /**
+    * \brief Allocate node which can be released by ff3_free_node().
+    */
+   static ff3_node_t* new_node(ff3_oper_t oper, ff3_node_t *left, ff3_node_t *right);
+
+   /**
+    * \return new constant node.
+    */
+   static ff3_node_t* constant(bool value);
+
+   /**
+    * \brief Release node without its children.
+    */
+   static void release(ff3_node_t *node);
+
+   /**
+    * \brief Release all terms and replace them by constant.
+    */
+   static ff3_node_t* absorb(std::vector<ff3_node_t*> &terms, bool value);
+
+   /**
+    * \return true if leaf compares value, so its opcode is valid.
+    */
+   static bool is_comparison(ff3_node_t const *node);
+
+   /**
+    * \brief Bit test of one bit, ffilter negates "all bits set" to "no bit set",
+    *    which is negation only for one bit.
+    * \return true if opcode of leaf can be negated by ff3_negate().
+    */
+   static bool is_negatable(ff3_node_t const *node);
+
+   /**
+    * \return true if both subtrees are the same expression.
+    */
+   static bool equal(ff3_node_t const *a, ff3_node_t const *b);
+
+   /**
+    * \return true if one term is negation of the other.
+    */
+   static bool complementary(ff3_node_t const *a, ff3_node_t const *b);
+
+   /**
+    * \brief Interval of values of unsigned field which pass comparison.
+    * \param[in] *node leaf.
+    * \param[out] &range passing values.
+    * \param[out] &width width of field in bytes.
+    * \return true if leaf is unsigned comparison (EQ, GT or LT).
+    */
+   static bool get_range(ff3_node_t const *node, Range &range, int &width);
+
+   /**
+    * \brief Turn leaf to unsigned comparison with value.
+    */
+   static void set_comparison(ff3_node_t *node, ff3_oper_t oper, int width, uint64_t value);
+
+   /**
+    * \brief Create leaves for interval, reuse leaves from pool first.
+    * \param[in] &range interval, neither empty nor whole domain of field.
+    * \param[in] max maximal value of field.
+    * \param[in] width width of field in bytes.
+    * \param[in] *like leaf of the field, copied when pool is empty.
+    * \param[in,out] &pool leaves of the same field which can be rewritten.
+    * \return comparison or AND of two comparisons.
+    */
+   static ff3_node_t* range_node(Range const &range, uint64_t max, int width, ff3_node_t const *like,
+                                 std::vector<ff3_node_t*> &pool);
+
+   /**
+    * \brief Merge unsigned comparisons of one field in terms.
+    * \param[in] is_and terms are in AND, otherwise in OR.
+    * \param[in,out] &terms terms of AND/OR.
+    * \return true if terms are constant, terms contain only this constant then.
+    */
+   static bool merge_ranges(bool is_and, std::vector<ff3_node_t*> &terms);
+
+   /**
+    * \brief Push negation to leaf.
+    * \return equivalent of NOT leaf.
+    */
+   static ff3_node_t* negate(ff3_node_t *node);
+
+   /**
+    * \brief Collect terms of nested nodes with the same operation, release these nodes.
+    */
+   static void flatten(ff3_node_t *node, ff3_oper_t oper, std::vector<ff3_node_t*> &terms);
+
+   /**
+    * \brief Simplify terms of AND/OR and connect the rest to tree.
+    */
+   static ff3_node_t* fold(ff3_oper_t oper, std::vector<ff3_node_t*> &terms);
+
+   /**
+    * \brief Optimize subtree.
+    * \param[in] *node root of subtree, it is consumed.
+    * \param[in] negated subtree is under odd number of NOT.
+    * \return root of optimized subtree.
+    */
+   static ff3_node_t* optimize(ff3_node_t *node, bool negated);
+
+public:
+
+   /**
+    * \brief Optimize filter expression.
+    * \param[in] *root root of tree, it is consumed.
+    * \return root of optimized tree.
+    */
+   static ff3_node_t* optimize(ff3_node_t *root);
+
+   /**
+    * \return true if node is constant true.
+    */
+   static bool is_true(ff3_node_t const *node);
+
+   /**
+    * \return true if node is constant false.
+    */
+   static bool is_false(ff3_node_t const *node);
+};
+
+#endif /* filter_optimizer_h */
@@ -9,6 +9,9 @@
 #if !defined(INTERFACE_H)
 #define INTERFACE_H
 
+#include "batch.hpp"
+
+#include <stdint.h>
 #include <vector>
 
 #include <unirec/unirec.h>
@@ -36,6 +39,20 @@ protected:
          successor->eval(out_rec, out_tmplt);
    }
 
+   /**
+    * \brief Send selected records of batch to next immediate components in pipeline.
+    * \param[in] &batch records ready to send.
+    * \param[in] *sel indexes of selected records in batch.
+    * \param[in] n_sel number of selected records.
+    */
+   void send_batch(Record_batch const &batch, uint16_t const *sel, size_t n_sel)
+   {
+      if (n_sel == 0)
+         return;
+      for (auto const &successor: pipeline_successors)
+         successor->eval_batch(batch, sel, n_sel);
+   }
+
 public:
 
    /**
@@ -54,6 +71,24 @@ public:
     */
    virtual int eval(void const *rec, ur_template_t const *in_tmplt) = 0;
 
+   /**
+    * \brief Start processing the selected records of batch.
+    * \details Default implementation passes records one by one to eval().
+    *    Override it when component can work over columns of batch.
+    * \param[in] &batch records for processing.
+    * \param[in] *sel indexes of selected records in batch, in ascending order.
+    * \param[in] n_sel number of selected records.
+    * \return 0 on success, otherwise a negative error value.
+    */
+   virtual int eval_batch(Record_batch const &batch, uint16_t const *sel, size_t n_sel)
+   {
+      int ret = 0;
+
+      for (size_t i = 0; i < n_sel; i++)
+         ret |= eval(batch.row(sel[i]), batch.get_template());
+      return ret;
+   }
+
    virtual ~Stage_intf(void) {};
 };
 
@@ -7,12 +7,17 @@
  */
 
 #include "program_arguments.hpp"
+#include "aot.hpp"
+#include "batch.hpp"
+#include "string_functions.hpp"
 
 #include <iostream>
 #include <fstream>
 #include <getopt.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <libtrap/trap.h>
 
@@ -25,7 +30,23 @@
   BASIC("policer","policer description",EXPECTED_N_TRAP_INPUTS,-1)
 
 #define MODULE_PARAMS(PARAM) \
-  PARAM('f', "source_code", "Input file with source code", required_argument, "string")
+  PARAM('f', "source_code", "Input file with source code", required_argument, "string") \
+  PARAM('e', "event_time", "Drive windows by TIME_LAST of records, argument is allowed lateness in seconds", required_argument, "int") \
+  PARAM('R', "replay", "Read records directly from TRAP files (comma separated) instead of input interface", required_argument, "string") \
+  PARAM('P', "parallel", "Replay every file of -R option in its own thread with its own pipelines", no_argument, "none") \
+  PARAM('B', "batch", "Pass records to pipelines in batches of given size with fields transposed to columns", required_argument, "int") \
+  PARAM('C', "combiners", "Threads of -P share pipelines, aggregators pre-aggregate in per-thread tables of given size", required_argument, "int") \
+  PARAM('G', "object_graph", "Pass records through graph of stage objects instead of compiled pipeline", no_argument, "none") \
+  PARAM('S', "columnar", "Aggregators with global window store aggregated fields in typed columns", no_argument, "none") \
+  PARAM('q', "quota", "Memory limit of stored groups of every aggregator in MiB", required_argument, "int") \
+  PARAM('Q', "global_quota", "Memory limit of stored groups of all aggregators together in MiB", required_argument, "int") \
+  PARAM('E', "evict", "Eviction when memory limit is reached: oldest (default), lru or smallest", required_argument, "string") \
+  PARAM('H', "admission", "Store keys of threshold rules after sketch estimate reaches fraction of threshold, format fraction[:width]", required_argument, "string") \
+  PARAM('D', "spill_dir", "Directory where aggregators spill groups over memory limit instead of evicting them", required_argument, "string") \
+  PARAM('K', "checkpoint", "Save state of aggregators to file periodically and restore it on start, format file[:seconds]", required_argument, "string") \
+  PARAM('c', "rule_cache", "Cache of built rules, unchanged rules are loaded from it without parsing", required_argument, "string") \
+  PARAM('A', "aot", "Translate rules to C++ source for policer-aot target and exit, no interface is opened", required_argument, "string") \
+  PARAM('J', "jit", "Compile filter expressions to shared objects in given directory by local compiler (CC)", required_argument, "string")
 
 /**
  * \param[in] argc from command line.
@@ -34,6 +55,20 @@
  */
 unsigned int count_trap_interfaces(int argc, char *argv[]);
 
+/**
+ * \brief Find option of module before TRAP initialization by getopt pass over copy of arguments.
+ * \details Options of TRAP (-i, -h, -v) are not removed yet, they are added to known options,
+ *    so their values are skipped. Option is found the same way as it is parsed later,
+ *    with attached value (-Rfile) and not as value of other option (-f -R).
+ * \param[in] argc from command line.
+ * \param[in] argv from command line, not changed.
+ * \param[in] optstring short options of module.
+ * \param[in] longopts long options of module.
+ * \param[in] opt searched option.
+ * \return True if option is present.
+ */
+bool find_option(int argc, char *argv[], char const *optstring, struct option const *longopts, int opt);
+
 /**
  * \brief Check if the file exists.
  * \param[in] fileName the name of the file you are looking for.
@@ -47,20 +82,27 @@ int Program_arguments::processing_arguments(void)
 
    INIT_MODULE_INFO_STRUCT(MODULE_BASIC_INFO, MODULE_PARAMS)
 
-   n_outputs_in_argument = count_trap_interfaces(argc, argv) - EXPECTED_N_TRAP_INPUTS;
-   module_info->num_ifc_out = n_outputs_in_argument;
-   module_info->num_ifc_in = EXPECTED_N_TRAP_INPUTS;
+   /* Rules are only translated to source code, no record is processed. */
+   if (!find_option(argc, argv, module_getopt_string, long_options, 'A')) {
+      /* Records of replay are not received through TRAP. */
+      int n_inputs = find_option(argc, argv, module_getopt_string, long_options, 'R') ? 0 : EXPECTED_N_TRAP_INPUTS;
 
-   TRAP_DEFAULT_INITIALIZATION(argc, argv, *module_info);
+      n_outputs_in_argument = count_trap_interfaces(argc, argv) - n_inputs;
+      module_info->num_ifc_out = n_outputs_in_argument;
+      module_info->num_ifc_in = n_inputs;
 
-   if (n_outputs_in_argument <= 0) {
-      std::cerr << "Error: at least one output interface must be set" << std::endl;
-      return -1;
-   }
-   if (n_outputs_in_argument > 32) {
-      std::cerr << "Error: More than 32 output interfaces is not allowed by TRAP library." << std::endl;
-      std::cerr << "       You must reduce the number of selectors" << std::endl;
-      return -2;
+      TRAP_DEFAULT_INITIALIZATION(argc, argv, *module_info);
+      trap_initialized = true;
+
+      if (n_outputs_in_argument <= 0) {
+         std::cerr << "Error: at least one output interface must be set" << std::endl;
+         return -1;
+      }
+      if (n_outputs_in_argument > 32) {
+         std::cerr << "Error: More than 32 output interfaces is not allowed by TRAP library." << std::endl;
+         std::cerr << "       You must reduce the number of selectors" << std::endl;
+         return -2;
+      }
    }
 
    signed char opt;
@@ -71,6 +113,85 @@ int Program_arguments::processing_arguments(void)
          srcIn_flag = true;
          srcIn_filename = optarg;
          break;
+      case 'R':
+         replay_filenames = divide_str(optarg, ",");
+         break;
+      case 'P':
+         parallel_replay = true;
+         break;
+      case 'B':
+         batch_size = atoi(optarg);
+         if (batch_size <= 0 || batch_size > BATCH_MAX_SIZE) {
+            std::cerr << "Error: size of batch must be from 1 to " << BATCH_MAX_SIZE << "." << std::endl;
+            return -3;
+         }
+         break;
+      case 'C':
+         combiner_size = atoi(optarg);
+         if (combiner_size <= 0) {
+            std::cerr << "Error: size of pre-aggregation table must be > 0." << std::endl;
+            return -3;
+         }
+         break;
+      case 'G':
+         object_graph = true;
+         break;
+      case 'S':
+         columnar = true;
+         break;
+      case 'q':
+         quota = atoi(optarg);
+         if (quota <= 0) {
+            std::cerr << "Error: memory limit must be > 0 MiB." << std::endl;
+            return -3;
+         }
+         break;
+      case 'Q':
+         global_quota = atoi(optarg);
+         if (global_quota <= 0) {
+            std::cerr << "Error: memory limit must be > 0 MiB." << std::endl;
+            return -3;
+         }
+         break;
+      case 'E':
+         evict_policy = optarg;
+         if (evict_policy != "oldest" && evict_policy != "lru" && evict_policy != "smallest") {
+            std::cerr << "Error: eviction policy must be oldest, lru or smallest." << std::endl;
+            return -3;
+         }
+         break;
+      case 'H': {
+         double fraction = 0;
+         int width = 1;
+         if (sscanf(optarg, "%lf:%d", &fraction, &width) < 1 || fraction <= 0 || fraction > 1 || width <= 0) {
+            std::cerr << "Error: admission must be fraction from (0, 1] optionally followed by :width > 0." << std::endl;
+            return -3;
+         }
+         admission = optarg;
+         break;
+      }
+      case 'D':
+         spill_dir = optarg;
+         break;
+      case 'K':
+         checkpoint = optarg;
+         break;
+      case 'c':
+         rule_cache = optarg;
+         break;
+      case 'A':
+         aot_output = optarg;
+         break;
+      case 'J':
+         jit_dir = optarg;
+         break;
+      case 'e':
+         event_time_lateness = atoi(optarg);
+         if (event_time_lateness < 0) {
+            std::cerr << "Error: lateness of event time must be >= 0." << std::endl;
+            return -3;
+         }
+         break;
       default:
          std::cerr << "Error: Invalid arguments." << std::endl;
          return -3;
@@ -89,8 +210,56 @@ bool Program_arguments::check_arguments(void)
 {
    using namespace std;
 
+   for (auto const &item: replay_filenames) {
+      if (!is_file_exist(item)) {
+         std::cerr << "Error: replay file " << item << " does not exist" << std::endl;
+         return false;
+      }
+   }
+   if (parallel_replay && replay_filenames.empty()) {
+      std::cerr << "Error: parameter -P requires -R" << std::endl;
+      return false;
+   }
+   if (combiner_size > 0 && !parallel_replay) {
+      std::cerr << "Error: parameter -C requires -P" << std::endl;
+      return false;
+   }
+   if (combiner_size > 0 && (batch_size > 0 || event_time_lateness >= 0)) {
+      /* Batches and watermark of event time belong to one thread. */
+      std::cerr << "Error: parameter -C cannot be combined with -B or -e" << std::endl;
+      return false;
+   }
+   if (combiner_size > 0 && columnar) {
+      /* Columns of aggregator are not shared by pre-aggregation tables. */
+      std::cerr << "Error: parameter -C cannot be combined with -S" << std::endl;
+      return false;
+   }
+
+   if (!spill_dir.empty() && quota == 0 && global_quota == 0) {
+      std::cerr << "Error: parameter -D requires -q or -Q" << std::endl;
+      return false;
+   }
+   if (!spill_dir.empty() && access(spill_dir.c_str(), W_OK) != 0) {
+      std::cerr << "Error: spill directory " << spill_dir << " is not writable" << std::endl;
+      return false;
+   }
+
+   if (!jit_dir.empty() && access(jit_dir.c_str(), W_OK) != 0) {
+      std::cerr << "Error: directory of compiled filters " << jit_dir << " is not writable" << std::endl;
+      return false;
+   }
+
+   if (!checkpoint.empty() && (combiner_size > 0 || columnar || !spill_dir.empty())) {
+      /* Pre-aggregation tables, columns and run files are not part of checkpoint. */
+      std::cerr << "Error: parameter -K cannot be combined with -C, -S or -D" << std::endl;
+      return false;
+   }
+
    if (srcIn_flag) {
       return is_file_exist(srcIn_filename);
+   } else if (aot_rules != NULL && aot_output.empty()) {
+      /* Binary of policer-aot target contains its rules. */
+      return true;
    } else {
       std::cerr << "Error: parameter -f is required" << std::endl;
       return false;
@@ -117,8 +286,10 @@ int Program_arguments::get_number_of_output_interfaces(void)
 
 Program_arguments::~Program_arguments(void)
 {
-   trap_send_flush(0);
-   trap_finalize();
+   if (trap_initialized) {
+      trap_send_flush(0);
+      trap_finalize();
+   }
 }
 
 unsigned int count_trap_interfaces(int argc, char *argv[])
@@ -146,6 +317,37 @@ unsigned int count_trap_interfaces(int argc, char *argv[])
    return ifc_cnt;
 }
 
+bool find_option(int argc, char *argv[], char const *optstring, struct option const *longopts, int opt)
+{
+   std::string shortopts = std::string("i:h::v") + optstring;
+   std::vector<struct option> all_longopts;
+   for (struct option const *o = longopts; o->name != NULL; o++) {
+      all_longopts.push_back(*o);
+   }
+   all_longopts.push_back({"ifcspec", required_argument, NULL, 'i'});
+   all_longopts.push_back({"help", optional_argument, NULL, 'h'});
+   all_longopts.push_back({NULL, 0, NULL, 0});
+
+   /* getopt permutes arguments, they are parsed again later. */
+   std::vector<char*> args(argv, argv + argc);
+   args.push_back(NULL);
+
+   bool found = false;
+   int saved_opterr = opterr;
+   int ret;
+   opterr = 0;
+   optind = 1;
+   /* Whole pass, so getopt does not stay in the middle of grouped options. */
+   while ((ret = getopt_long(argc, args.data(), shortopts.c_str(), all_longopts.data(), NULL)) != -1) {
+      if (ret == opt) {
+         found = true;
+      }
+   }
+   optind = 1;
+   opterr = saved_opterr;
+   return found;
+}
+
 bool is_file_exist(std::string fileName)
 {
    std::ifstream infile(fileName);
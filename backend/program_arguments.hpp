@@ -10,6 +10,7 @@
 #define PROGRAM_ARGUMENTS_H
 
 #include <string>
+#include <vector>
 
 /**
  * Return this constant if everything is ok.
@@ -26,6 +27,23 @@ class Program_arguments
    int n_outputs_in_argument = 0; ///< Number of output Libtrap interfaces.
    std::string srcIn_filename;    ///< Filename with user's rules.
    bool srcIn_flag = false;       ///< If -f option is present.
+   int event_time_lateness = -1;  ///< Allowed lateness in event-time mode, negative if mode is off.
+   std::vector<std::string> replay_filenames; ///< TRAP files for offline replay (-R option).
+   bool parallel_replay = false;  ///< If each replay file is processed by its own thread (-P option).
+   int batch_size = 0;            ///< Number of records in batch (-B option), 0 means record by record.
+   int combiner_size = 0;         ///< Slots of per-thread pre-aggregation table (-C option), 0 if not used.
+   bool object_graph = false;     ///< If records go through graph of stage objects instead of compiled pipeline (-G option).
+   bool columnar = false;         ///< If aggregators store aggregated fields in typed columns (-S option).
+   int quota = 0;                 ///< Memory limit of every aggregator in MiB (-q option), 0 if not set.
+   int global_quota = 0;          ///< Memory limit of all aggregators in MiB (-Q option), 0 if not set.
+   std::string evict_policy;      ///< Eviction policy when memory limit is reached (-E option), empty for default.
+   std::string admission;         ///< Admission of keys through sketch as fraction[:width] (-H option), empty if not set.
+   std::string spill_dir;         ///< Directory of groups spilled over memory limit (-D option), empty if not set.
+   std::string checkpoint;        ///< Checkpoint of aggregator state as file[:seconds] (-K option), empty if not set.
+   std::string rule_cache;        ///< Cache of built rules (-c option), empty if not set.
+   std::string aot_output;        ///< Generated source of rules (-A option), empty if not set.
+   std::string jit_dir;           ///< Directory of filter expressions compiled at runtime (-J option), empty if not set.
+   bool trap_initialized = false; ///< If TRAP interfaces were initialized.
 
    /**
     * \brief Check private class members srcIn_flag and srcIn_filename.
@@ -71,6 +89,167 @@ public:
       return srcIn_filename;
    }
 
+   /**
+    * \return True if -f option is present, otherwise rules embedded in binary are used.
+    */
+   bool has_srcIn(void)
+   {
+      return srcIn_flag;
+   }
+
+   /**
+    * \return True if records are read directly from TRAP files instead of input interface.
+    */
+   bool is_replay(void)
+   {
+      return !replay_filenames.empty();
+   }
+
+   /**
+    * \return Names of TRAP files for offline replay.
+    */
+   std::vector<std::string> const& get_replay_filenames(void)
+   {
+      return replay_filenames;
+   }
+
+   /**
+    * \return True if each replay file has its own pipelines and thread.
+    */
+   bool is_parallel_replay(void)
+   {
+      return parallel_replay;
+   }
+
+   /**
+    * \return Number of records processed together as batch, 0 if records are processed one by one.
+    */
+   int get_batch_size(void)
+   {
+      return batch_size;
+   }
+
+   /**
+    * \return Number of slots in pre-aggregation table of every replay thread, 0 if not used.
+    *    If set, threads of parallel replay share one set of pipelines.
+    */
+   int get_combiner_size(void)
+   {
+      return combiner_size;
+   }
+
+   /**
+    * \return True if stages call each other through send() instead of compiled pipeline.
+    */
+   bool is_object_graph(void)
+   {
+      return object_graph;
+   }
+
+   /**
+    * \return True if aggregators with global window keep aggregated fields in typed columns.
+    */
+   bool is_columnar(void)
+   {
+      return columnar;
+   }
+
+   /**
+    * \return Memory limit of every aggregator in MiB, 0 if not set.
+    */
+   int get_quota(void)
+   {
+      return quota;
+   }
+
+   /**
+    * \return Memory limit of all aggregators together in MiB, 0 if not set.
+    */
+   int get_global_quota(void)
+   {
+      return global_quota;
+   }
+
+   /**
+    * \return Eviction policy of aggregators (oldest, lru or smallest), empty for default.
+    */
+   std::string const& get_evict_policy(void)
+   {
+      return evict_policy;
+   }
+
+   /**
+    * \return Admission of keys through sketch as fraction[:width], empty if not set.
+    */
+   std::string const& get_admission(void)
+   {
+      return admission;
+   }
+
+   /**
+    * \return Directory where aggregators spill groups over memory limit, empty if not set.
+    */
+   std::string const& get_spill_dir(void)
+   {
+      return spill_dir;
+   }
+
+   /**
+    * \return Checkpoint of aggregator state as file[:seconds], empty if not set.
+    */
+   std::string const& get_checkpoint(void)
+   {
+      return checkpoint;
+   }
+
+   /**
+    * \return Cache of built rules, empty if not set.
+    */
+   std::string const& get_rule_cache(void)
+   {
+      return rule_cache;
+   }
+
+   /**
+    * \return File to which rules are translated as C++ source, empty if module processes records.
+    */
+   std::string const& get_aot_output(void)
+   {
+      return aot_output;
+   }
+
+   /**
+    * \return Directory of filter expressions compiled at runtime, empty if they are interpreted.
+    */
+   std::string const& get_jit_dir(void)
+   {
+      return jit_dir;
+   }
+
+   /**
+    * \return True if windows are driven by TIME_LAST of records (-e option).
+    */
+   bool is_event_time(void)
+   {
+      return event_time_lateness >= 0;
+   }
+
+   /**
+    * \return Allowed lateness of records in seconds for event-time mode.
+    */
+   int get_event_time_lateness(void)
+   {
+      return event_time_lateness;
+   }
+
+   /**
+    * \return options which change stages built from rules, part of key of rule cache.
+    */
+   std::string get_build_variant(void)
+   {
+      return is_event_time() ? "event-time" : "";
+   }
+
    ~Program_arguments(void);
 };
 
@@ -0,0 +1,166 @@
+/**
+ * \file replay.cpp
+ * \brief Definition of Replay_file class.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#include "replay.hpp"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+#include <libtrap/trap.h>
+
+/**
+ * \brief Read 32 bit number in network byte order from unaligned memory.
+ */
+static inline uint32_t read_u32(uint8_t const *ptr)
+{
+   uint32_t val;
+   memcpy(&val, ptr, sizeof(val));
+   return ntohl(val);
+}
+
+/**
+ * \brief Read 16 bit number in network byte order from unaligned memory.
+ */
+static inline uint16_t read_u16(uint8_t const *ptr)
+{
+   uint16_t val;
+   memcpy(&val, ptr, sizeof(val));
+   return ntohs(val);
+}
+
+int Replay_file::open(std::string const &fname)
+{
+   filename = fname;
+   fd = ::open(filename.c_str(), O_RDONLY);
+   if (fd < 0) {
+      fprintf(stderr, "Error: cannot open replay file %s\n", filename.c_str());
+      return -1;
+   }
+   struct stat st;
+   if (fstat(fd, &st) != 0) {
+      fprintf(stderr, "Error: cannot get size of replay file %s\n", filename.c_str());
+      return -1;
+   }
+   size = st.st_size;
+   if (size == 0) {
+      fprintf(stderr, "Error: replay file %s is empty\n", filename.c_str());
+      return -1;
+   }
+   void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+   if (addr == MAP_FAILED) {
+      fprintf(stderr, "Error: cannot map replay file %s\n", filename.c_str());
+      return -1;
+   }
+   data = static_cast<uint8_t const*>(addr);
+   /* Records are read only once and in order. */
+   madvise(addr, size, MADV_SEQUENTIAL);
+
+   return read_header();
+}
+
+int Replay_file::read_header(void)
+{
+   if (size < 5) {
+      fprintf(stderr, "Error: replay file %s has no header\n", filename.c_str());
+      return -2;
+   }
+   if (data[0] != TRAP_FMT_UNIREC) {
+      fprintf(stderr, "Error: replay file %s does not contain UniRec data\n", filename.c_str());
+      return -2;
+   }
+   uint32_t fmt_len = read_u32(data + 1);
+   if (fmt_len > size - 5) {
+      fprintf(stderr, "Error: replay file %s has broken header\n", filename.c_str());
+      return -2;
+   }
+   /* Specification may or may not be terminated by '\0'. */
+   char const *fmt = reinterpret_cast<char const*>(data + 5);
+   data_fmt.assign(fmt, strnlen(fmt, fmt_len));
+   pos = buffer_end = 5 + fmt_len;
+
+   if (ur_define_set_of_fields(data_fmt.c_str()) != 0) {
+      fprintf(stderr, "Error: cannot define fields of replay file %s\n", filename.c_str());
+      return -3;
+   }
+   tmplt = ur_create_template_from_ifc_spec(data_fmt.c_str());
+   if (tmplt == NULL) {
+      fprintf(stderr, "Error: cannot create template of replay file %s\n", filename.c_str());
+      return -3;
+   }
+   return 0;
+}
+
+void const* Replay_file::next(uint16_t &rec_size)
+{
+   /* Skip to next buffer. */
+   while (pos >= buffer_end) {
+      if (pos + 4 > size) {
+         return NULL;
+      }
+      buffer_end = pos + 4 + read_u32(data + pos);
+      pos += 4;
+      if (buffer_end > size) {
+         fprintf(stderr, "Warning: replay file %s is truncated\n", filename.c_str());
+         buffer_end = size;
+      }
+   }
+   if (pos + 2 > buffer_end) {
+      return NULL;
+   }
+   rec_size = read_u16(data + pos);
+   void const *rec = data + pos + 2;
+   pos += 2 + rec_size;
+   if (pos > buffer_end) {
+      fprintf(stderr, "Warning: replay file %s contains broken message\n", filename.c_str());
+      return NULL;
+   }
+   return rec;
+}
+
+Replay_file::Replay_file(Replay_file &&other) noexcept: filename(std::move(other.filename)), fd(other.fd),
+   data(other.data), size(other.size), pos(other.pos), buffer_end(other.buffer_end),
+   data_fmt(std::move(other.data_fmt)), tmplt(other.tmplt)
+{
+   other.fd = -1;
+   other.data = NULL;
+   other.size = 0;
+   other.pos = 0;
+   other.buffer_end = 0;
+   other.tmplt = NULL;
+}
+
+Replay_file& Replay_file::operator=(Replay_file &&other) noexcept
+{
+   std::swap(filename, other.filename);
+   std::swap(fd, other.fd);
+   std::swap(data, other.data);
+   std::swap(size, other.size);
+   std::swap(pos, other.pos);
+   std::swap(buffer_end, other.buffer_end);
+   std::swap(data_fmt, other.data_fmt);
+   std::swap(tmplt, other.tmplt);
+   return *this;
+}
+
+Replay_file::~Replay_file(void)
+{
+   if (tmplt != NULL) {
+      ur_free_template(tmplt);
+   }
+   if (data != NULL) {
+      munmap(const_cast<uint8_t*>(data), size);
+   }
+   if (fd >= 0) {
+      close(fd);
+   }
+}
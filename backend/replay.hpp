@@ -0,0 +1,97 @@
+/**
+ * \file replay.hpp
+ * \brief Direct reading of TRAP files for offline replay.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#if !defined(REPLAY_H)
+#define REPLAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include <unirec/unirec.h>
+
+/**
+ * \brief TRAP file mapped to memory. Records are read in place without copying.
+ * \details Expected layout of the file (written by file interface of libtrap):
+ * \code
+ *    uint8_t  data_type;           // TRAP_FMT_UNIREC
+ *    uint32_t spec_len;            // network byte order
+ *    char     spec[spec_len];      // "ipaddr DST_IP,ipaddr SRC_IP,..."
+ *    // then buffers until end of file:
+ *    uint32_t buffer_len;          // network byte order
+ *    { uint16_t size; char data[size]; } messages[];  // size in network byte order
+ * \endcode
+ */
+class Replay_file
+{
+   std::string filename;          ///< Name of mapped file.
+   int fd = -1;                   ///< File descriptor of mapped file.
+   uint8_t const *data = NULL;    ///< Begin of mapped file.
+   size_t size = 0;               ///< Size of mapped file.
+   size_t pos = 0;                ///< Position of next message.
+   size_t buffer_end = 0;         ///< End of current buffer.
+   std::string data_fmt;          ///< UniRec specification of records in file.
+   ur_template_t *tmplt = NULL;   ///< UniRec template created from data_fmt.
+
+   /**
+    * \brief Read file header with data format and create template.
+    * \return 0 on success, otherwise a negative error value.
+    */
+   int read_header(void);
+
+public:
+
+   Replay_file(void) {}
+
+   /**
+    * \brief Take mapped file of other, which is left closed.
+    */
+   Replay_file(Replay_file &&other) noexcept;
+
+   /**
+    * \brief Exchange mapped files, file of this one is released with other.
+    */
+   Replay_file& operator=(Replay_file &&other) noexcept;
+
+   /** Mapping and template are owned, file cannot be copied. */
+   Replay_file(Replay_file const &) = delete;
+   Replay_file& operator=(Replay_file const &) = delete;
+
+   /**
+    * \brief Map file to memory and read its header.
+    * \param[in] fname name of TRAP file.
+    * \return 0 on success, otherwise a negative error value.
+    */
+   int open(std::string const &fname);
+
+   /**
+    * \brief Get next record from file.
+    * \param[out] rec_size size of returned record.
+    * \return pointer to record inside mapped file, NULL at the end of data.
+    */
+   void const* next(uint16_t &rec_size);
+
+   /**
+    * \return UniRec template of records in file.
+    */
+   ur_template_t const* get_template(void)
+   {
+      return tmplt;
+   }
+
+   /**
+    * \return name of mapped file.
+    */
+   std::string const& get_filename(void)
+   {
+      return filename;
+   }
+
+   ~Replay_file(void);
+};
+
+#endif /* replay_h */
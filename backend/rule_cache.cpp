@@ -0,0 +1,174 @@
+/**
+ * \file rule_cache.cpp
+ * \brief Definition of Rule_cache class.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#include "rule_cache.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * \brief Header of rule cache file.
+ */
+struct Rule_cache_header {
+   char magic[8];         ///< RULE_CACHE_MAGIC without terminating zero.
+   uint32_t version;      ///< RULE_CACHE_VERSION.
+   int32_t interfaces;    ///< Number of output interfaces.
+   uint64_t key;          ///< Hash of rules, variant and binary.
+   uint32_t nodes;        ///< Number of stages.
+   uint32_t fields_len;   ///< Length of input fields, they follow the header.
+   uint32_t warnings_len; ///< Length of warnings, they follow input fields.
+};
+
+/**
+ * \brief 64 bit FNV-1a hash.
+ */
+static uint64_t hash_text(std::string const &text)
+{
+   uint64_t hash = 14695981039346656037ULL;
+
+   for (unsigned char c: text) {
+      hash ^= c;
+      hash *= 1099511628211ULL;
+   }
+   return hash;
+}
+
+/**
+ * \return identification of running binary, other build of module can build other stages from the same rules.
+ */
+static std::string binary_id(void)
+{
+   struct stat st;
+   char buf[128];
+
+   if (stat("/proc/self/exe", &st) != 0) {
+      return std::string();
+   }
+   snprintf(buf, sizeof(buf), "%lu:%lu:%lld:%lld", (unsigned long) st.st_dev, (unsigned long) st.st_ino,
+            (long long) st.st_size, (long long) st.st_mtime);
+   return buf;
+}
+
+void Rule_cache::init(std::string const &file, std::string const &rules, std::string const &build_variant)
+{
+   path = file;
+   variant = build_variant;
+   key = hash_text(rules + '\0' + variant + '\0' + binary_id());
+}
+
+int Rule_cache::load(void)
+{
+   int fd = open(path.c_str(), O_RDONLY);
+   if (fd < 0) {
+      return -1;
+   }
+
+   struct stat st;
+   if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(Rule_cache_header)) {
+      close(fd);
+      return -1;
+   }
+   char *data = (char*) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (data == MAP_FAILED) {
+      return -1;
+   }
+
+   size_t size = st.st_size;
+   Rule_cache_header header;
+   memcpy(&header, data, sizeof(header));
+   size_t pos = sizeof(header);
+   bool ok = memcmp(header.magic, RULE_CACHE_MAGIC, sizeof(header.magic)) == 0 &&
+             header.version == RULE_CACHE_VERSION && header.key == key &&
+             size - pos >= (size_t) header.fields_len + header.warnings_len;
+
+   if (ok) {
+      input_fields.assign(data + pos, header.fields_len);
+      pos += header.fields_len;
+      warnings.assign(data + pos, header.warnings_len);
+      pos += header.warnings_len;
+      nodes.clear();
+      nodes.reserve(header.nodes);
+   }
+   for (uint32_t i = 0; ok && i < header.nodes; i++) {
+      Rule_cache_node node;
+      uint32_t len;
+
+      if (size - pos < 1 + 2 * sizeof(uint32_t)) {
+         ok = false;
+         break;
+      }
+      node.kind = data[pos++];
+      memcpy(&node.children, data + pos, sizeof(uint32_t));
+      pos += sizeof(uint32_t);
+      memcpy(&len, data + pos, sizeof(uint32_t));
+      pos += sizeof(uint32_t);
+      if (size - pos < len) {
+         ok = false;
+         break;
+      }
+      node.options.assign(data + pos, len);
+      pos += len;
+      nodes.push_back(node);
+   }
+   munmap(data, size);
+
+   if (!ok) {
+      nodes.clear();
+      input_fields.clear();
+      warnings.clear();
+      return -1;
+   }
+   n_interfaces = header.interfaces;
+   loaded = true;
+   return 0;
+}
+
+int Rule_cache::save(void)
+{
+   std::string tmp = path + ".tmp";
+   FILE *file = fopen(tmp.c_str(), "wb");
+   if (file == NULL) {
+      fprintf(stderr, "Warning: cannot create rule cache %s: %s\n", tmp.c_str(), strerror(errno));
+      return -1;
+   }
+
+   Rule_cache_header header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, RULE_CACHE_MAGIC, sizeof(header.magic));
+   header.version = RULE_CACHE_VERSION;
+   header.interfaces = n_interfaces;
+   header.key = key;
+   header.nodes = nodes.size();
+   header.fields_len = input_fields.size();
+   header.warnings_len = warnings.size();
+
+   bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(input_fields.data(), 1, input_fields.size(), file) == input_fields.size() &&
+             fwrite(warnings.data(), 1, warnings.size(), file) == warnings.size();
+   for (size_t i = 0; ok && i < nodes.size(); i++) {
+      uint32_t len = nodes[i].options.size();
+      ok = fwrite(&nodes[i].kind, 1, 1, file) == 1 &&
+           fwrite(&nodes[i].children, sizeof(uint32_t), 1, file) == 1 &&
+           fwrite(&len, sizeof(len), 1, file) == 1 &&
+           fwrite(nodes[i].options.data(), 1, len, file) == len;
+   }
+   if (fclose(file) != 0) {
+      ok = false;
+   }
+   if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+      fprintf(stderr, "Warning: cannot write rule cache %s\n", path.c_str());
+      unlink(tmp.c_str());
+      return -1;
+   }
+   return 0;
+}
@@ -0,0 +1,159 @@
+/**
+ * \file rule_cache.hpp
+ * \brief Binary cache of stages built from rules.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#if !defined(RULE_CACHE_H)
+#define RULE_CACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** Identifies rule cache file. */
+#define RULE_CACHE_MAGIC "PLCRRULE"
+/**
+ * Version of rule cache format, file of other version is rebuilt.
+ * Increment it also when Builder builds other stages from the same rules.
+ */
+#define RULE_CACHE_VERSION 3
+
+/** Kind of stage in rule cache. */
+#define RULE_CACHE_FILTER 'F'
+#define RULE_CACHE_AGG 'A'
+#define RULE_CACHE_SELECTOR 'S'
+
+/**
+ * \brief One stage of cached pipelines.
+ */
+struct Rule_cache_node {
+   char kind;             ///< RULE_CACHE_FILTER, RULE_CACHE_AGG or RULE_CACHE_SELECTOR.
+   std::string options;   ///< Options of stage derived from rules.
+   uint32_t children;     ///< Number of successors, they follow the node.
+};
+
+/**
+ * \brief Stages of all branches with their options, so unchanged rules are not parsed again.
+ * \details Cache is keyed by hash of rules text, command line options which change built stages
+ *    and identification of the binary. It keeps the result of parsing, semantic checks
+ *    and alias substitution: tree of stages in pre-order, input template fields, number
+ *    of output interfaces and warnings printed by Builder, which are printed again when cache is loaded.
+ *    Other options given by command line are not cached, Builder appends them.
+ */
+class Rule_cache
+{
+   std::string path;                   ///< Cache file.
+   uint64_t key = 0;                   ///< Hash of rules, variant and binary.
+   std::string variant;                ///< Command line options which change built stages.
+   bool loaded = false;                ///< If cache file matches rules.
+   int n_interfaces = 0;               ///< Number of output interfaces.
+   std::string input_fields;           ///< Input template fields separated by comma.
+   std::vector<Rule_cache_node> nodes; ///< Stages of all branches in pre-order.
+   std::string warnings;               ///< Warnings printed when stages were built, one per line.
+
+public:
+
+   /**
+    * \brief Set cache file and key.
+    * \param[in] file path to cache file.
+    * \param[in] rules text of rules.
+    * \param[in] build_variant command line options which change built stages, see Program_arguments.
+    */
+   void init(std::string const &file, std::string const &rules, std::string const &build_variant);
+
+   /**
+    * \brief Read cache file if it exists and matches rules.
+    * \return 0 if cache is loaded, -1 if rules must be parsed.
+    */
+   int load(void);
+
+   /**
+    * \brief Write cache file.
+    * \return 0 on success, -1 on error.
+    */
+   int save(void);
+
+   /**
+    * \brief Use stages filled by setters as if they were loaded from file.
+    */
+   void set_loaded(void)
+   {
+      loaded = true;
+   }
+
+   /**
+    * \return true if cache was loaded.
+    */
+   bool is_loaded(void) const
+   {
+      return loaded;
+   }
+
+   /**
+    * \return number of output interfaces of cached rules.
+    */
+   int get_number_of_output_interfaces(void) const
+   {
+      return n_interfaces;
+   }
+
+   /**
+    * \param[in] n number of output interfaces of rules.
+    */
+   void set_number_of_output_interfaces(int n)
+   {
+      n_interfaces = n;
+   }
+
+   /**
+    * \return input template fields of cached rules separated by comma.
+    */
+   std::string const& get_input_fields(void) const
+   {
+      return input_fields;
+   }
+
+   /**
+    * \param[in] fields input template fields of rules separated by comma.
+    */
+   void set_input_fields(std::string const &fields)
+   {
+      input_fields = fields;
+   }
+
+   /**
+    * \return command line options which change built stages, given to init().
+    */
+   std::string const& get_variant(void) const
+   {
+      return variant;
+   }
+
+   /**
+    * \return warnings printed when stages were built, one per line.
+    */
+   std::string const& get_warnings(void) const
+   {
+      return warnings;
+   }
+
+   /**
+    * \param[in] text warnings printed when stages were built, one per line.
+    */
+   void set_warnings(std::string const &text)
+   {
+      warnings = text;
+   }
+
+   /**
+    * \return stages in pre-order.
+    */
+   std::vector<Rule_cache_node>& get_nodes(void)
+   {
+      return nodes;
+   }
+};
+
+#endif /* rule_cache_h */
@@ -17,8 +17,6 @@
 
 #include <libtrap/trap.h>
 
-#define SEND_EOF 1
-
 int Selector::define_new_alias_field(char const *alias_name, char const *field_name)
 {
    ur_field_type_t type = ur_get_type(ur_get_id_by_name(field_name));
@@ -148,6 +146,7 @@ int Selector::init(char const *options, std::vector<Stage_intf*> /* succ */ )
 
 int Selector::eval(void const *in_rec, ur_template_t const *in_tmplt)
 {
+   std::lock_guard<std::mutex> lock(out_mutex);
 
    // TODO: create two loops without inner if statement
    for (auto const &item: dict) {
@@ -170,21 +169,29 @@ int Selector::eval(void const *in_rec, ur_template_t const *in_tmplt)
    return 0;
 }
 
-Selector::~Selector()
+int Selector::set_interface(int ifc)
 {
-   if (SEND_EOF == 1) {
-      int ret = trap_send(ifc_num, out_rec, 1);
+   std::lock_guard<std::mutex> lock(out_mutex);
 
-      if (ret != TRAP_E_OK) {
-         std::cerr << "ERROR while sending message of module ending: trap_last_error_msg" << std::endl;
-         std::cerr << "Receiving side probably did not notice shutdown of module" << std::endl;
-      }
+   if (ifc == ifc_num) {
+      return 0;
+   }
+   /* Data format of the interface is set again, it may belong to other selector before. */
+   if (ur_set_output_template(ifc, out_tmplt) != 0) {
+      fprintf(stderr, "Error: cannot set output template of interface %d\n", ifc);
+      return -1;
    }
+   ifc_num = ifc;
+   return 0;
+}
+
+Selector::~Selector()
+{
+   /* End of data message is sent by Backend once all pipelines are destroyed. */
    for (auto const &item:dict) {
       free(item.alias_name);
       free(item.field_name);
    }
-   ur_finalize();
    ur_free_template(out_tmplt);
    ur_free_record(out_rec);
 }
@@ -8,6 +8,7 @@
 
 #include "../interface.hpp"
 
+#include <mutex>
 #include <vector>
 #include <string>
 
@@ -34,6 +35,7 @@ class Selector:public Stage_intf {
    const char delimiter = ',';       ///< Delimiter in csv output.
    int static_size_of_out_tmplt = 0; ///< Total size of UniRec record except variable-length fields.
    void *out_rec = NULL;             ///< Output record.
+   std::mutex out_mutex;             ///< For out_rec, records can come from more threads (timeouts, shared replay).
 
    /**
     * \brief Set output trap interface from number in string datatype.
@@ -103,5 +105,12 @@ public:
     */
    int eval(void const *rec, ur_template_t const *in_tmplt);
 
+   /**
+    * \brief Send records to other output interface, used when branch is reused after reload.
+    * \param[in] ifc index of output trap interface.
+    * \return 0 on success, otherwise a negative error value.
+    */
+   int set_interface(int ifc);
+
    ~Selector();
 };
@@ -9,6 +9,7 @@
 #include "string_functions.hpp"
 
 #include <algorithm>
+#include <ctype.h>
 #include <string>
 #include <vector>
 
@@ -55,8 +56,162 @@ std::string vecOfstr2str(const std::vector<std::string> vec, const std::string d
    return output;
 }
 
-std::string replace_aliases_in_selector_body(std::string input, const std::string searched,
-                                             const std::string replaceStr)
+std::string replace_identifiers(std::string const &input, aliasMapT const &aliases)
+{
+   std::string output;
+   size_t pos = 0;
+
+   output.reserve(input.size());
+   while (pos < input.size()) {
+      if (!isalnum((unsigned char) input[pos]) && input[pos] != '_') {
+         output.push_back(input[pos++]);
+         continue;
+      }
+      size_t begin = pos;
+      while (pos < input.size() && (isalnum((unsigned char) input[pos]) || input[pos] == '_')) {
+         pos++;
+      }
+      std::string token = input.substr(begin, pos - begin);
+      auto it = aliases.find(token);
+      output.append(it == aliases.end() ? token : it->second);
+   }
+   return output;
+}
+
+void collect_identifiers(std::string const &input, std::unordered_set<std::string> &identifiers)
+{
+   size_t pos = 0;
+
+   while (pos < input.size()) {
+      if (!isalnum((unsigned char) input[pos]) && input[pos] != '_') {
+         pos++;
+         continue;
+      }
+      size_t begin = pos;
+      while (pos < input.size() && (isalnum((unsigned char) input[pos]) || input[pos] == '_')) {
+         pos++;
+      }
+      identifiers.insert(input.substr(begin, pos - begin));
+   }
+}
+
+/**
+ * \return true if character is part of ffilter identifier.
+ */
+static bool is_ident_char(char c)
+{
+   return isalnum((unsigned char) c) || c == '_' || c == '-';
+}
+
+/**
+ * \return identifier which ends before position end (backward == true) or starts at position begin.
+ */
+static std::string word_at(std::string const &input, size_t pos, bool backward)
+{
+   if (backward) {
+      while (pos > 0 && isspace((unsigned char) input[pos - 1])) {
+         pos--;
+      }
+      size_t end = pos;
+      while (pos > 0 && is_ident_char(input[pos - 1])) {
+         pos--;
+      }
+      return input.substr(pos, end - pos);
+   }
+   while (pos < input.size() && isspace((unsigned char) input[pos])) {
+      pos++;
+   }
+   size_t begin = pos;
+   while (pos < input.size() && is_ident_char(input[pos])) {
+      pos++;
+   }
+   return input.substr(begin, pos - begin);
+}
+
+/**
+ * \return input without leading and trailing white spaces.
+ */
+static std::string trim(std::string const &input)
+{
+   size_t begin = input.find_first_not_of(" \t\n");
+   if (begin == std::string::npos) {
+      return std::string();
+   }
+   return input.substr(begin, input.find_last_not_of(" \t\n") - begin + 1);
+}
+
+std::vector<std::string> split_conjuncts(std::string const &expression)
+{
+   std::string input = trim(expression);
+   std::vector<std::string> operands;
+   size_t start = 0;
+   int depth = 0;
+   bool wrapped = !input.empty() && input.front() == '(';
+
+   for (size_t pos = 0; pos < input.size(); pos++) {
+      char c = input[pos];
+      size_t len = 0;
+
+      if (c == '"') {
+         size_t end = input.find('"', pos + 1);
+         pos = end == std::string::npos ? input.size() : end;
+         continue;
+      } else if (c == '(' || c == '[') {
+         depth++;
+      } else if (c == ')' || c == ']') {
+         depth--;
+         /* Parentheses around the whole expression. */
+         wrapped = wrapped && (depth > 0 || pos + 1 == input.size());
+      } else if (depth == 0 && (input.compare(pos, 2, "&&") == 0 || input.compare(pos, 2, "||") == 0)) {
+         len = 2;
+      } else if (depth == 0 && isalpha((unsigned char) c) && (pos == 0 || !is_ident_char(input[pos - 1]))) {
+         std::string word = word_at(input, pos, false);
+         std::string prev = word_at(input, pos, true);
+         std::string next = word_at(input, pos + word.size(), false);
+
+         if ((word == "and" || word == "or") &&
+             !((prev == "src" && next == "dst") || (prev == "dst" && next == "src"))) {
+            len = word.size();
+         } else {
+            pos += word.size() - 1;
+            continue;
+         }
+      }
+      if (len == 0) {
+         continue;
+      }
+      if (c == '|' || c == 'o') {
+         /* Operands of "or" are not conjuncts. */
+         return {input};
+      }
+      operands.push_back(trim(input.substr(start, pos - start)));
+      start = pos + len;
+      pos += len - 1;
+   }
+
+   if (operands.empty()) {
+      if (wrapped && input.size() > 2) {
+         std::vector<std::string> inner = split_conjuncts(input.substr(1, input.size() - 2));
+         if (inner.size() > 1) {
+            return inner;
+         }
+      }
+      return {input};
+   }
+   operands.push_back(trim(input.substr(start)));
+
+   std::vector<std::string> output;
+   for (auto const &item: operands) {
+      if (item.empty()) {
+         return {input};
+      }
+      std::vector<std::string> inner = split_conjuncts(item);
+      output.insert(output.end(), inner.begin(), inner.end());
+   }
+   return output;
+}
+
+std::string replace_aliases_in_selector_body(std::string input, aliasMapT const &aliases)
 {
    if (input.empty()) {
       return std::string();
@@ -70,18 +225,18 @@ std::string replace_aliases_in_selector_body(std::string input, const std::strin
 
       if (equalPos != std::string::npos) {
          std::string rightSide = item.substr(equalPos + 1, item.size() - equalPos);
-         rightSide = findAndReplaceAll(rightSide, searched, replaceStr);
+         rightSide = replace_identifiers(rightSide, aliases);
          item.replace(item.begin() + equalPos + 1, item.end(), rightSide);
       } else {
-         if (item.find(searched) != std::string::npos)
-            item = replaceStr;
+         auto it = aliases.find(item);
+         if (it != aliases.end())
+            item = it->second;
       }
    }
    return vecOfstr2str(inputVec, ",");
 }
 
-std::string replace_aliases_in_group_filter_body(std::string input, const std::string searched,
-                                                 const std::string replaceStr)
+std::string replace_aliases_in_group_filter_body(std::string const &input, aliasMapT const &aliases)
 {
-   return findAndReplaceAll(input, searched, replaceStr);
+   return replace_identifiers(input, aliases);
 }
@@ -10,6 +10,8 @@
 #define STRING_FUNCTIONS_H
 
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 /**
@@ -39,33 +41,63 @@ std::string findAndReplaceAll(std::string input, const std::string searched,
 std::string vecOfstr2str(const std::vector<std::string> vec, const std::string delimiter);
 
 /**
- * \brief Replace searched string in selector body. Replacing aggregator variable to unirec keyword.
+ * \brief Mapping of variable names to unirec keywords.
+ */
+using aliasMapT = std::unordered_map<std::string, std::string>;
+
+/**
+ * \brief Replace whole identifiers found in aliases in one pass through input.
+ * \param[in] input source of string.
+ * \param[in] aliases identifiers to be replaced and their replacements.
+ * \return String after substitutions.
+ */
+std::string replace_identifiers(std::string const &input, aliasMapT const &aliases);
+
+/**
+ * \brief Add all identifiers (names of variables and unirec fields) of input to set.
+ * \param[in] input source of string.
+ * \param[in,out] identifiers set of found identifiers.
+ */
+void collect_identifiers(std::string const &input, std::unordered_set<std::string> &identifiers);
+
+/**
+ * \brief Split filter expression to operands of its top-level "and".
+ * \details Operands in parentheses are split too. Expression with top-level "or" is not split,
+ *    "src and dst" of ffilter is not an operator.
+ * \see Example:
+ * \code
+ *    split_conjuncts("SRC_IP in [10.0.0.0/8] and (BYTES > 10 and PACKETS > 2)")
+ *       output -> {"SRC_IP in [10.0.0.0/8]", "BYTES > 10", "PACKETS > 2"}
+ * \endcode
+ * \param[in] expression filter expression.
+ * \return operands, whole expression if it cannot be split.
+ */
+std::vector<std::string> split_conjuncts(std::string const &expression);
+
+/**
+ * \brief Replace aggregator variables in selector body by unirec keywords.
  * \details Function divide input string to tokens by comma delimiter.
  *    Token may have two forms - (1. partA), or (2. partB = partC).
- *    PartA and partC will be edited if contains searched string.
+ *    PartA is replaced if it is variable, variables in partC are replaced.
  * \see Example:
  * \code
- *    replace_vares_in_selector_body("var", "var", "PACKETS")
+ *    replace_aliases_in_selector_body("var", {{"var", "PACKETS"}})
  *       output -> "PACKETS"
- *    replace_vares_in_selector_body("userKeyword = var + var", "var", "PACKETS")
+ *    replace_aliases_in_selector_body("userKeyword = var + var", {{"var", "PACKETS"}})
  *       output -> "userKeyword=PACKETS+PACKETS"
  * \endcode
  * \param[in] input source of string.
- * \param[in] searched wanted string.
- * \param[in] replaceStr the search string will be replaced with replaceStr.
+ * \param[in] aliases variables and their unirec keywords.
  * \return New Selector stage body without aggregator variables.
  */
-std::string replace_aliases_in_selector_body(std::string input, const std::string searched,
-                                             const std::string replaceStr);
+std::string replace_aliases_in_selector_body(std::string input, aliasMapT const &aliases);
 
 /**
- * \brief Replace searched string in group-filter body. Replacing aggregator variable to unirec keyword.
+ * \brief Replace aggregator variables in group-filter body by unirec keywords.
  * \param[in] input source of string.
- * \param[in] searched wanted string.
- * \param[in] replaceStr the search string will be replaced with replaceStr.
+ * \param[in] aliases variables and their unirec keywords.
  * \return New Group-filter stage body without aggregator variables.
  */
-std::string replace_aliases_in_group_filter_body(std::string input, const std::string searched,
-                                                 const std::string replaceStr);
+std::string replace_aliases_in_group_filter_body(std::string const &input, aliasMapT const &aliases);
 
 #endif /* string_functions_h */
@@ -0,0 +1,26 @@
+/**
+ * \file template_generation.hpp
+ * \brief Counter of changes of input template.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#if !defined(TEMPLATE_GENERATION_H)
+#define TEMPLATE_GENERATION_H
+
+#include <atomic>
+#include <stdint.h>
+
+/**
+ * \brief Generation of input template, incremented when format of received data changes.
+ * \details Updated template can be allocated at address of the freed one, so data derived
+ *    from template (offsets) are valid only for the same address and the same generation.
+ * \return counter shared by all translation units.
+ */
+inline std::atomic<uint32_t>& input_template_generation(void)
+{
+   static std::atomic<uint32_t> generation(0);
+   return generation;
+}
+
+#endif /* template_generation_h */
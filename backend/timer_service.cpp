@@ -0,0 +1,102 @@
+/**
+ * \file timer_service.cpp
+ * \brief Definition of Timer_service class.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#include "timer_service.hpp"
+
+Timer_service& Timer_service::instance(void)
+{
+   static Timer_service service;
+   return service;
+}
+
+int Timer_service::add(int delay, Timer_callback callback)
+{
+   std::lock_guard<std::mutex> lock(mtx);
+   int id = next_id++;
+
+   callbacks[id] = callback;
+   heap.push((Entry) {clock::now() + std::chrono::seconds(delay), id});
+   if (!worker.joinable()) {
+      stopping = false;
+      worker = std::thread(&Timer_service::run, this);
+   }
+   wake.notify_one();
+   return id;
+}
+
+void Timer_service::cancel(int id)
+{
+   if (id < 0) {
+      return;
+   }
+   std::unique_lock<std::mutex> lock(mtx);
+
+   /* Entry stays in heap and is skipped when it expires. */
+   callbacks.erase(id);
+   if (std::this_thread::get_id() != worker.get_id()) {
+      done.wait(lock, [this, id]() { return running != id; });
+   }
+}
+
+void Timer_service::run(void)
+{
+   std::unique_lock<std::mutex> lock(mtx);
+
+   while (!stopping) {
+      if (heap.empty()) {
+         wake.wait(lock);
+         continue;
+      }
+      Entry next = heap.top();
+
+      if (callbacks.find(next.id) == callbacks.end()) {
+         /* Cancelled timer. */
+         heap.pop();
+         continue;
+      }
+      if (clock::now() < next.due) {
+         wake.wait_until(lock, next.due);
+         continue;
+      }
+      heap.pop();
+
+      /* Callback is called unlocked, it can take long and can add timers. */
+      Timer_callback callback = callbacks[next.id];
+      running = next.id;
+      lock.unlock();
+      int delay = callback();
+      lock.lock();
+      running = -1;
+      done.notify_all();
+
+      if (delay < 0) {
+         callbacks.erase(next.id);
+      } else if (callbacks.find(next.id) != callbacks.end()) {
+         heap.push((Entry) {next.due + std::chrono::seconds(delay), next.id});
+      }
+   }
+}
+
+void Timer_service::stop(void)
+{
+   {
+      std::lock_guard<std::mutex> lock(mtx);
+
+      stopping = true;
+      callbacks.clear();
+      heap = decltype(heap)();
+      wake.notify_one();
+   }
+   if (worker.joinable()) {
+      worker.join();
+   }
+}
+
+Timer_service::~Timer_service(void)
+{
+   stop();
+}
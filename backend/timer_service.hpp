@@ -0,0 +1,98 @@
+/**
+ * \file timer_service.hpp
+ * \brief One thread for timeouts of all stages.
+ * \author Adam Piecek <adam.piecek@gnj.cz>
+ * \date 2020
+ */
+
+#if !defined(TIMER_SERVICE_H)
+#define TIMER_SERVICE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * \brief Callback of timer.
+ * \return seconds to the next call, negative value to stop the timer.
+ */
+using Timer_callback = std::function<int(void)>;
+
+/**
+ * \brief Shared scheduler of periodic callbacks.
+ * \details Timers are kept in min-heap ordered by time of expiration. Single thread sleeps
+ *    on condition variable until the nearest expiration or until timers change,
+ *    so adding or cancelling timer takes effect immediately.
+ *    Next expiration is counted from the planned one, so period does not drift
+ *    with duration of callback.
+ *    The thread is started by the first timer and stopped by stop() or at exit.
+ */
+class Timer_service
+{
+   using clock = std::chrono::steady_clock;
+
+   /**
+    * \brief Planned call of timer.
+    */
+   struct Entry {
+      clock::time_point due; ///< Time of call.
+      int id;                ///< Timer.
+
+      bool operator>(Entry const &other) const
+      {
+         return due > other.due;
+      }
+   };
+
+   std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry> > heap; ///< Planned calls.
+   std::unordered_map<int, Timer_callback> callbacks; ///< Active timers, cancelled ones are removed.
+   std::mutex mtx;                  ///< For heap, callbacks and running.
+   std::condition_variable wake;    ///< Wakes the thread when timers change.
+   std::condition_variable done;    ///< Wakes cancel() when callback ends.
+   std::thread worker;              ///< Thread calling callbacks.
+   int next_id = 0;                 ///< ID of the next timer.
+   int running = -1;                ///< ID of timer whose callback is running, -1 if none.
+   bool stopping = false;           ///< If the thread should end.
+
+   Timer_service(void) {};
+
+   /**
+    * \brief Main loop of the thread.
+    */
+   void run(void);
+
+public:
+
+   /**
+    * \return service shared by all stages.
+    */
+   static Timer_service& instance(void);
+
+   /**
+    * \brief Register new timer.
+    * \param[in] delay seconds to the first call, 0 calls it immediately.
+    * \param[in] callback function called from the service thread.
+    * \return ID of timer.
+    */
+   int add(int delay, Timer_callback callback);
+
+   /**
+    * \brief Remove timer. Waits if its callback is running, so owner can be destroyed after return.
+    * \param[in] id ID of timer, negative value is ignored.
+    */
+   void cancel(int id);
+
+   /**
+    * \brief Cancel all timers and end the thread.
+    */
+   void stop(void);
+
+   ~Timer_service(void);
+};
+
+#endif /* timer_service_h */
@@ -0,0 +1,39 @@
+#!/bin/sh
+# Generate rules with many branches to measure time of parsing, checks and building.
+# Usage: gen_rules.sh <branches> <rules file>
+# Prints value for -i option with one blackhole output interface per branch.
+# Policer built with MODE=perf prints time of every phase to stderr, e.g.:
+#    make MODE=perf
+#    ./policer -f rules.txt -i "$(bench/gen_rules.sh 10000 rules.txt)"
+
+usage() {
+   echo "Usage: $0 <branches> <rules file>" >&2
+   exit 1
+}
+
+[ $# -eq 2 ] || usage
+case "$1" in
+   ''|*[!0-9]*|0) usage ;;
+esac
+
+awk -v n="$1" 'BEGIN {
+   for (i = 0; i < n; i++) {
+      printf "branch rule%d{\n", i
+      printf "    filter: SRC_PORT == %d and DST_PORT == %d;\n", i % 65536, (i * 7) % 65536
+      printf "    grouper: SRC_IP;\n"
+      printf "    window: type = global, range = %d seconds;\n", 1 + i % 60
+      printf "    aggregator: cd = COUNT_DISTINCT(DST_IP), sum = SUM(PACKETS);\n"
+      printf "    group-filter: sum > %d;\n", i % 100
+      printf "    selector: SRC_IP, sum, cd;\n"
+      printf "}\n"
+   }
+}' > "$2" || exit 1
+
+# Input interface followed by output interfaces
+awk -v n="$1" 'BEGIN {
+   printf "u:policer_in"
+   for (i = 0; i < n; i++) {
+      printf ",b:"
+   }
+   printf "\n"
+}'
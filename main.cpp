@@ -6,6 +6,7 @@
  * \date 2020
  */
 
+#include "backend/aot.hpp"
 #include "backend/backend.hpp"
 #include "parsing/ast/ast_adapted.hpp"
 #include "parsing/exception.hpp"
@@ -14,7 +15,13 @@
 #include <boost/spirit/home/x3.hpp>
 #include <fstream>
 #include <iostream>
+#include <stdio.h>
 #include <string>
+#include <utility>
+
+#ifdef MEASURE
+#include <ctime>
+#endif
 
 int main(int argc, char **argv)
 {
@@ -26,48 +33,98 @@ int main(int argc, char **argv)
       return ret;
    }
 
-   /* Open the file containing the user rules. */
-   std::ifstream in(config.get_srcIn_filename(), std::ios_base::in);
-
    std::string storage;         /* We will read the contents here. */
-   in.unsetf(std::ios::skipws); /* No white space skipping! */
-   std::copy(std::istream_iterator < char >(in),
-             std::istream_iterator < char >(), std::back_inserter(storage));
-
-   Parser parser(storage);
-
-   try {
-      /* Parse user rules. */
-      parser.run();
-   }
-   catch(ProgramError::Error & e) {
-      std::cerr << e.msg_body << std::endl;
-      return e.retCode;
+   Rule_cache cache;
+   bool use_cache = !config.get_rule_cache().empty() && config.get_aot_output().empty();
+
+   if (config.has_srcIn()) {
+      /* Open the file containing the user rules. */
+      std::ifstream in(config.get_srcIn_filename(), std::ios_base::in);
+
+      in.unsetf(std::ios::skipws); /* No white space skipping! */
+      std::copy(std::istream_iterator < char >(in),
+                std::istream_iterator < char >(), std::back_inserter(storage));
+
+      /* Unchanged rules are loaded from cache without parsing. */
+      if (use_cache) {
+         cache.init(config.get_rule_cache(), storage, config.get_build_variant());
+         cache.load();
+      }
+   } else {
+      /* Binary of policer-aot target contains built rules. */
+      aot_load_rules(cache);
+      use_cache = true;
+      fprintf(stderr, "Using rules compiled from %s\n", aot_rules->source);
+      if (config.get_build_variant() != aot_rules->variant) {
+         fprintf(stderr, "Error: rules were compiled with other options (%s), compile them with the same -e\n",
+                 *aot_rules->variant ? aot_rules->variant : "without event time");
+         return -1;
+      }
    }
 
-   /* Check the number of output interfaces. */
-   if ((ret = config.check_number_of_output_interfaces(parser.get_number_of_output_interfaces()))) {
-      return ret;
-   }
-
-   /* Take the information obtained during parsing. */
-   Inter_repr data = parser.get_data();
-
-   // data.print(data.filterVars);
-   // data.print(data.group_filterVars);
-   // data.print(data.aggrVars);
-   // data.print(data.selVars);
-
-   if (check_inter_repr(data)) {
-      return -1;
+   Inter_repr data;
+
+   if (cache.is_loaded()) {
+      if ((ret = config.check_number_of_output_interfaces(cache.get_number_of_output_interfaces()))) {
+         return ret;
+      }
+   } else {
+      Parser parser(storage);
+
+      try {
+         /* Parse user rules. */
+         parser.run();
+      }
+      catch(ProgramError::Error & e) {
+         std::cerr << e.msg_body << std::endl;
+         return e.retCode;
+      }
+
+      /* Translate rules to source code instead of processing. */
+      if (!config.get_aot_output().empty()) {
+         data = std::move(parser.get_data());
+         if (check_inter_repr(data)) {
+            return -1;
+         }
+         client::ast::Builder builder(&data, &config);
+         /* Cache is not written, init() only records options which change built stages. */
+         cache.init(std::string(), storage, config.get_build_variant());
+         builder.describe(cache);
+         cache.set_number_of_output_interfaces(parser.get_number_of_output_interfaces());
+         cache.set_input_fields(client::ast::Unirec_input_template_fields(&data).get_input_template_fields());
+         return aot_generate(config.get_aot_output(), config.get_srcIn_filename(), cache) == 0 ? 0 : -1;
+      }
+
+      /* Check the number of output interfaces. */
+      if ((ret = config.check_number_of_output_interfaces(parser.get_number_of_output_interfaces()))) {
+         return ret;
+      }
+
+      /* Take the information obtained during parsing. */
+      data = std::move(parser.get_data());
+
+      // data.print(data.filterVars);
+      // data.print(data.group_filterVars);
+      // data.print(data.aggrVars);
+      // data.print(data.selVars);
+
+      if (check_inter_repr(data)) {
+         return -1;
+      }
    }
 
    Backend backend(&data, &config);
 
+#ifdef MEASURE
+   clock_t begin = clock();
+#endif
    /* Prepare backend. */
-   if (backend.build_backend() != 0) {
+   if (backend.build_backend(use_cache ? &cache : NULL) != 0) {
       return -1;
    }
+#ifdef MEASURE
+   fprintf(stderr, "build: %.3f s\n", double (clock() - begin) / CLOCKS_PER_SEC);
+#endif
 
    /* Start Policer processing. */
    if (backend.start_processing() != 0) {
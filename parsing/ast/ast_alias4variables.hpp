@@ -11,6 +11,8 @@
 
 #include "ast_variables.hpp"
 
+#include <utility>
+
 namespace client { namespace ast
 {
 
@@ -36,11 +38,8 @@ namespace client { namespace ast
        * \param[in] fb User variables from each Filter bodie.
        * \param[in] gfb User variables from each Group-filter bodie.
        */
-      Alias4variables(filMapT fb, grfiMapT gfb) {
-         filterVars = fb;
-         group_filterVars = gfb;
-         lastAggr = NULL;
-      };
+      Alias4variables(filMapT fb, grfiMapT gfb): filterVars(std::move(fb)),
+         group_filterVars(std::move(gfb)), lastAggr(NULL) {};
 
       filMapT& get_filterVars(void) {
         return filterVars;
@@ -15,7 +15,7 @@
 
 using namespace client::ast;
 
-std::string Check_branch_names::make_path(stackT vec)
+std::string Check_branch_names::make_path(stackT const &vec)
 {
    std::string retString;
    if (vec.empty()) {
@@ -38,21 +38,20 @@ size_t Check_branch_names::get_depth()
    return stack.size();
 }
 
-void Check_branch_names::check_and_push(stackT & vec, std::string const &elem)
+void Check_branch_names::check_and_push(namesT & names, std::string const &elem)
 {
-   if (find(vec.begin(), vec.end(), elem) != vec.end()) {
+   if (!names.insert(elem).second) {
       using namespace ProgramError;
       check_branch_names_tag tag;
       throw Semantic(tag, make_path(stack).c_str(), elem.c_str());
    }
-   vec.push_back(elem);
 }
 
 template <typename First, typename Rest>
 void Check_branch_names::check_branches(First &one, Rest &more)
 {
-   std::vector<std::string> names;
-   names.push_back(one.name);
+   namesT names;
+   names.insert(one.name);
 
    stack.push_back(one.name);
    (*this) (one);
@@ -13,6 +13,7 @@
 #include "ast_visitor.hpp"
 #include <vector>
 #include <string>
+#include <unordered_set>
 
 
 namespace client { namespace ast
@@ -47,6 +48,11 @@ namespace client { namespace ast
       private:
    
       using stackT = std::vector<branchPathT>;
+
+      /**
+       * \brief Names of sibling branches, hashed so thousands of branches are checked in linear time.
+       */
+      using namesT = std::unordered_set<std::string>;
    
       /**
        * \brief Storing names of branches depending on the current position in the AST.
@@ -54,18 +60,18 @@ namespace client { namespace ast
       stackT stack;
 
       /**
-       * \brief Push branch name to stack and implicitly check duplicate names.
-       * \param[in, out] vec vector of branch names.
-       * \param[in] elem item to push.
+       * \brief Insert branch name to set of names and implicitly check duplicate names.
+       * \param[in, out] names set of branch names.
+       * \param[in] elem item to insert.
        */
-      void check_and_push(stackT& vec, std::string const& elem);
+      void check_and_push(namesT& names, std::string const& elem);
 
       /**
        * \brief Wrapper for get_BranchPath(void).
        * \param[in] stackT stack of branch names.
        * \return path consists of the names of branches that are separated by a slash.
        */
-      branchPathT make_path(stackT);
+      branchPathT make_path(stackT const&);
    
       /**
        * \brief Push to branch names to stack procedure.
@@ -44,7 +44,7 @@ namespace client { namespace ast
       /**
        * \return filter variables.
        */
-      filMapT get_filterVars(void)
+      filMapT& get_filterVars(void)
       {
          return filterVars;
       }
@@ -52,7 +52,7 @@ namespace client { namespace ast
       /**
        * \return group-filter variables.
        */
-      grfiMapT get_group_filterVars(void)
+      grfiMapT& get_group_filterVars(void)
       {
          return group_filterVars;
       }
@@ -72,12 +72,12 @@ namespace client { namespace ast
       /**
        * \brief User variables from each Filter bodie. (It will be empty yet.)
        */
-      filMapT filterVars;
+      filMapT &filterVars;
 
       /**
        * \brief User variables from each Group-filter bodie.
        */
-      grfiMapT group_filterVars;
+      grfiMapT &group_filterVars;
    
       /**
        * \brief User variables from corresponding Aggregator stage.
@@ -87,14 +87,10 @@ namespace client { namespace ast
       public:
    
       /**
-       * \param[in] User variables from each Filter bodie.
-       * \param[in] User variables from each Group-filter bodie.
+       * \param[in] User variables from each Filter bodie, they are not copied.
+       * \param[in] User variables from each Group-filter bodie, they are not copied.
        */
-      Check_filter_bodies(filMapT fb, grfiMapT gfb)
-      {
-         filterVars = fb;
-         group_filterVars = gfb;
-      };
+      Check_filter_bodies(filMapT &fb, grfiMapT &gfb): filterVars(fb), group_filterVars(gfb) {};
    
       using Variables::operator();
    
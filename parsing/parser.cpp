@@ -27,8 +27,14 @@
 #include "config.hpp"
 #include "parser.hpp"
 
-#include <vector>
 #include <string>
+#include <utility>
+#include <vector>
+
+#ifdef MEASURE
+#include <ctime>
+#include <stdio.h>
+#endif
 
 namespace For_handler
 {
@@ -111,8 +117,8 @@ void Parser::parse(void)
    /* Additionaly parsing filter body and group-filter body */
    client::ast::Parse_filter_bodies filters;
    filters(data.ast);
-   data.filterVars = filters.get_filterVars();
-   data.group_filterVars = filters.get_group_filterVars();
+   data.filterVars = std::move(filters.get_filterVars());
+   data.group_filterVars = std::move(filters.get_group_filterVars());
 }
 
 void Parser::print(void)
@@ -141,23 +147,38 @@ void Parser::semantic_check(void)
 void Parser::add_aliases(void)
 {
    using namespace client::ast;
-   Alias4variables alv(data.filterVars, data.group_filterVars);
+   Alias4variables alv(std::move(data.filterVars), std::move(data.group_filterVars));
 
    alv(data.ast);
-   data.filterVars = alv.get_filterVars();
-   data.group_filterVars = alv.get_group_filterVars();
-   data.aggrVars = alv.get_aggrVars();
-   data.selVars = alv.get_selVars();
+   data.filterVars = std::move(alv.get_filterVars());
+   data.group_filterVars = std::move(alv.get_group_filterVars());
+   data.aggrVars = std::move(alv.get_aggrVars());
+   data.selVars = std::move(alv.get_selVars());
 }
 
 void Parser::run(void)
 {
+#ifdef MEASURE
+   clock_t begin = clock();
+#endif
    parse();
+#ifdef MEASURE
+   clock_t parsed = clock();
+#endif
 #ifdef DEVEL
    print();
 #endif
    semantic_check();
+#ifdef MEASURE
+   clock_t checked = clock();
+#endif
    add_aliases();
+#ifdef MEASURE
+   clock_t end = clock();
+   fprintf(stderr, "parse: %.3f s, check: %.3f s, aliases: %.3f s\n",
+           double (parsed - begin) / CLOCKS_PER_SEC, double (checked - parsed) / CLOCKS_PER_SEC,
+           double (end - checked) / CLOCKS_PER_SEC);
+#endif
 }
 
 int Parser::get_number_of_output_interfaces(void)
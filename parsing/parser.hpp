@@ -68,9 +68,9 @@ public:
    void run(void);
 
    /**
-    * \return information obtained during parsing.
+    * \return information obtained during parsing, move it out to avoid copying of syntax tree.
     */
-   Inter_repr get_data(void) {
+   Inter_repr& get_data(void) {
       return data;
    }
 